@@ -0,0 +1,38 @@
+-- ----------------------------------------------------------------
+-- hll_add_agg throughput for each log2m.
+--
+-- Usage: psql -X -v nrows=20000000 -v ngroups=1000 -f bench/add_agg.sql <db>
+--
+-- Each log2m is run once into a single group and once spread over
+-- ngroups groups, where the registers no longer stay in cache.  An
+-- expthresh of 0 goes straight to dense registers.  Divide nrows by
+-- the reported times for rows per second.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET work_mem = '8GB';
+SET max_parallel_workers_per_gather = 0;
+
+CREATE TEMP TABLE bench_hashes AS
+SELECT gs % :ngroups AS grp, hll_hash_bigint(gs) AS hashval
+  FROM generate_series(1, :nrows) AS gs;
+VACUUM ANALYZE bench_hashes;
+
+\timing on
+
+SELECT 11 AS log2m, hll_cardinality(hll_add_agg(hashval, 11, 5, 0, 1)) FROM bench_hashes;
+SELECT 12 AS log2m, hll_cardinality(hll_add_agg(hashval, 12, 5, 0, 1)) FROM bench_hashes;
+SELECT 13 AS log2m, hll_cardinality(hll_add_agg(hashval, 13, 5, 0, 1)) FROM bench_hashes;
+SELECT 14 AS log2m, hll_cardinality(hll_add_agg(hashval, 14, 5, 0, 1)) FROM bench_hashes;
+SELECT 15 AS log2m, hll_cardinality(hll_add_agg(hashval, 15, 5, 0, 1)) FROM bench_hashes;
+SELECT 16 AS log2m, hll_cardinality(hll_add_agg(hashval, 16, 5, 0, 1)) FROM bench_hashes;
+SELECT 17 AS log2m, hll_cardinality(hll_add_agg(hashval, 17, 5, 0, 1)) FROM bench_hashes;
+
+SELECT 11 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 11, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
+SELECT 12 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 12, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
+SELECT 13 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 13, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
+SELECT 14 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 14, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
+SELECT 15 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 15, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
+SELECT 16 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 16, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
+SELECT 17 AS log2m, count(hll_add_agg) FROM (SELECT hll_add_agg(hashval, 17, 5, 0, 1) FROM bench_hashes GROUP BY grp) AS tt;
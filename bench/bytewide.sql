@@ -0,0 +1,47 @@
+-- ----------------------------------------------------------------
+-- Size and cost of the byte wide schema version 5.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/bytewide.sql <db>
+--
+-- Builds nsketches dense log2m=14 sketches of 1000 hashes, stores
+-- each as versions 1 and 5, and for each version prints their total
+-- size and times their hll_union_agg, their hll_cardinality and an
+-- hll_add to them, which unpacks the sketch and packs the result in
+-- the same version.  Subtract the time of the first query of each
+-- group, which only reads the sketches.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+SELECT hll_set_output_version(1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT 1 AS vers,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 1000::bigint) AS gs
+ GROUP BY gs % :nsketches;
+
+SELECT hll_set_output_version(5);
+
+INSERT INTO bench_sketches
+SELECT 5, hll_union(sketch, sketch)
+  FROM bench_sketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SELECT hll_set_output_version(1);
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 1;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE vers = 1;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 1;
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 1;
+
+SELECT hll_set_output_version(5);
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 5;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE vers = 5;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 5;
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 5;
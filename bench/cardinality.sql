@@ -0,0 +1,39 @@
+-- ----------------------------------------------------------------
+-- hll_cardinality of stored dense sketches for each log2m.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/cardinality.sql <db>
+--
+-- Builds nsketches dense sketches per log2m from 10 to 17 and times
+-- the cardinality of all of them.  Subtract the time of the first
+-- query of each pair, which only reads the sketches.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT log2m, hll_add_agg(hll_hash_bigint(gs), log2m, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs,
+       generate_series(10, 17) AS log2m
+ GROUP BY log2m, gs % :nsketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 10;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 10;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 11;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 11;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 12;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 12;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 13;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 13;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 14;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 14;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 15;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 15;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 16;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 16;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 17;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 17;
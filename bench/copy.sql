@@ -0,0 +1,66 @@
+-- ----------------------------------------------------------------
+-- Bulk loading of pre-built sketches with COPY, text and binary.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/copy.sql <db>
+--
+-- Builds nsketches each of explicit, sparse, and dense log2m=11 and
+-- log2m=14 sketches, writes each kind to a text and a binary file in
+-- the current directory with \copy, and times loading every file
+-- into a column whose type modifiers match, so each value and its
+-- modifiers are checked.  Remove the bench_copy_* files afterwards.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SELECT hll_set_max_sparse(-1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT 'explicit' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 11, 5, -1, 1) AS sketch
+  FROM generate_series(1, :nsketches * 100) AS gs
+ GROUP BY gs % :nsketches
+UNION ALL
+SELECT 'sparse' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 1) AS sketch
+  FROM generate_series(1, :nsketches * 200) AS gs
+ GROUP BY gs % :nsketches
+UNION ALL
+SELECT 'dense11' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 11, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs
+ GROUP BY gs % :nsketches
+UNION ALL
+SELECT 'dense14' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs
+ GROUP BY gs % :nsketches;
+
+SELECT kind, hll_type(sketch), count(*), sum(length(sketch::bytea))
+  FROM bench_sketches
+ GROUP BY 1, 2
+ ORDER BY 1, 2;
+
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'explicit') TO 'bench_copy_explicit.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'explicit') TO 'bench_copy_explicit.bin' WITH (FORMAT binary)
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'sparse') TO 'bench_copy_sparse.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'sparse') TO 'bench_copy_sparse.bin' WITH (FORMAT binary)
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense11') TO 'bench_copy_dense11.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense11') TO 'bench_copy_dense11.bin' WITH (FORMAT binary)
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense14') TO 'bench_copy_dense14.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense14') TO 'bench_copy_dense14.bin' WITH (FORMAT binary)
+
+CREATE TEMP TABLE bench_explicit (sketch hll(11,5,-1,1));
+CREATE TEMP TABLE bench_sparse (sketch hll(14,5,0,1));
+CREATE TEMP TABLE bench_dense11 (sketch hll(11,5,0,0));
+CREATE TEMP TABLE bench_dense14 (sketch hll(14,5,0,0));
+
+\timing on
+
+\copy bench_explicit FROM 'bench_copy_explicit.txt'
+\copy bench_explicit FROM 'bench_copy_explicit.bin' WITH (FORMAT binary)
+\copy bench_sparse FROM 'bench_copy_sparse.txt'
+\copy bench_sparse FROM 'bench_copy_sparse.bin' WITH (FORMAT binary)
+\copy bench_dense11 FROM 'bench_copy_dense11.txt'
+\copy bench_dense11 FROM 'bench_copy_dense11.bin' WITH (FORMAT binary)
+\copy bench_dense14 FROM 'bench_copy_dense14.txt'
+\copy bench_dense14 FROM 'bench_copy_dense14.bin' WITH (FORMAT binary)
@@ -0,0 +1,56 @@
+-- ----------------------------------------------------------------
+-- Repeated reads of the same stored sketches with the decode cache.
+--
+-- Usage: psql -X -v nsketches=2000 -f bench/decode_cache.sql <db>
+--
+-- Builds nsketches dense log2m=14 sketches, which are TOASTed, and
+-- times three rounds of the hll_cardinality of each, an hll_union
+-- of neighbouring ones and an hll_union_agg of all of them, first
+-- with hll.decode_cache_size off and then large enough to hold them.
+-- The first round with the cache on fills it.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+SELECT hll_set_output_version(1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT gs % :nsketches AS id,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 5000) AS gs
+ GROUP BY gs % :nsketches;
+VACUUM ANALYZE bench_sketches;
+
+SELECT hll_decode_cache_reset();
+
+\timing on
+
+SET hll.decode_cache_size = 0;
+
+SELECT sum(#sketch) FROM bench_sketches;
+SELECT sum(#hll_union(a.sketch, b.sketch)) FROM bench_sketches a JOIN bench_sketches b ON b.id = a.id + 1;
+SELECT #hll_union_agg(sketch) FROM bench_sketches;
+SELECT sum(#sketch) FROM bench_sketches;
+SELECT sum(#hll_union(a.sketch, b.sketch)) FROM bench_sketches a JOIN bench_sketches b ON b.id = a.id + 1;
+SELECT #hll_union_agg(sketch) FROM bench_sketches;
+SELECT sum(#sketch) FROM bench_sketches;
+SELECT sum(#hll_union(a.sketch, b.sketch)) FROM bench_sketches a JOIN bench_sketches b ON b.id = a.id + 1;
+SELECT #hll_union_agg(sketch) FROM bench_sketches;
+
+SET hll.decode_cache_size = '1GB';
+
+SELECT sum(#sketch) FROM bench_sketches;
+SELECT sum(#hll_union(a.sketch, b.sketch)) FROM bench_sketches a JOIN bench_sketches b ON b.id = a.id + 1;
+SELECT #hll_union_agg(sketch) FROM bench_sketches;
+SELECT sum(#sketch) FROM bench_sketches;
+SELECT sum(#hll_union(a.sketch, b.sketch)) FROM bench_sketches a JOIN bench_sketches b ON b.id = a.id + 1;
+SELECT #hll_union_agg(sketch) FROM bench_sketches;
+SELECT sum(#sketch) FROM bench_sketches;
+SELECT sum(#hll_union(a.sketch, b.sketch)) FROM bench_sketches a JOIN bench_sketches b ON b.id = a.id + 1;
+SELECT #hll_union_agg(sketch) FROM bench_sketches;
+
+\timing off
+
+SELECT * FROM hll_decode_cache_stats();
@@ -0,0 +1,58 @@
+-- ----------------------------------------------------------------
+-- Size and cost of the delta coded schema version 3.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/delta.sql <db>
+--
+-- Builds nsketches explicit log2m=11 sketches of 100 hashes and as
+-- many sparse log2m=14 ones of 1000, stores each as versions 1 and
+-- 3, and for each version prints their total size and times their
+-- hll_cardinality and an hll_add to them, which unpacks the sketch
+-- and packs the result in the same version.  Subtract the time of
+-- the first query of each group, which only reads the sketches.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+SELECT hll_set_max_sparse(-1);
+
+SELECT hll_set_output_version(1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT 1 AS vers, 'explicit' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 11, 5, -1, 1) AS sketch
+  FROM generate_series(1, :nsketches * 100) AS gs
+ GROUP BY gs % :nsketches
+UNION ALL
+SELECT 1 AS vers, 'sparse' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 1) AS sketch
+  FROM generate_series(1, :nsketches * 1000) AS gs
+ GROUP BY gs % :nsketches;
+
+SELECT hll_set_output_version(3);
+
+INSERT INTO bench_sketches
+SELECT 3, kind, hll_union(sketch, sketch)
+  FROM bench_sketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SELECT hll_set_output_version(1);
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 1 AND kind = 'explicit';
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 1 AND kind = 'explicit';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 1 AND kind = 'explicit';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 1 AND kind = 'sparse';
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 1 AND kind = 'sparse';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 1 AND kind = 'sparse';
+
+SELECT hll_set_output_version(3);
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 3 AND kind = 'explicit';
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 3 AND kind = 'explicit';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 3 AND kind = 'explicit';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 3 AND kind = 'sparse';
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 3 AND kind = 'sparse';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 3 AND kind = 'sparse';
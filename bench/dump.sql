@@ -0,0 +1,71 @@
+-- ----------------------------------------------------------------
+-- Text dump and restore of stored sketches, hex against base64.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/dump.sql <db>
+--
+-- Builds nsketches each of sparse, and dense log2m=11 and log2m=14
+-- sketches, then for each hll.output_format prints the size of their
+-- text, and times writing each kind to a text file in the current
+-- directory with \copy and loading it back.  Remove the
+-- bench_dump_* files afterwards.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SELECT hll_set_max_sparse(-1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT 'sparse' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 1) AS sketch
+  FROM generate_series(1, :nsketches * 200) AS gs
+ GROUP BY gs % :nsketches
+UNION ALL
+SELECT 'dense11' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 11, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs
+ GROUP BY gs % :nsketches
+UNION ALL
+SELECT 'dense14' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs
+ GROUP BY gs % :nsketches;
+
+CREATE TEMP TABLE bench_load (sketch hll);
+
+SET hll.output_format = hex;
+
+SELECT kind, count(*), sum(length(sketch::text))
+  FROM bench_sketches
+ GROUP BY 1
+ ORDER BY 1;
+
+\timing on
+
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'sparse') TO 'bench_dump_sparse_hex.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense11') TO 'bench_dump_dense11_hex.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense14') TO 'bench_dump_dense14_hex.txt'
+
+\copy bench_load FROM 'bench_dump_sparse_hex.txt'
+\copy bench_load FROM 'bench_dump_dense11_hex.txt'
+\copy bench_load FROM 'bench_dump_dense14_hex.txt'
+
+\timing off
+
+TRUNCATE bench_load;
+
+SET hll.output_format = base64;
+
+SELECT kind, count(*), sum(length(sketch::text))
+  FROM bench_sketches
+ GROUP BY 1
+ ORDER BY 1;
+
+\timing on
+
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'sparse') TO 'bench_dump_sparse_base64.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense11') TO 'bench_dump_dense11_base64.txt'
+\copy (SELECT sketch FROM bench_sketches WHERE kind = 'dense14') TO 'bench_dump_dense14_base64.txt'
+
+\copy bench_load FROM 'bench_dump_sparse_base64.txt'
+\copy bench_load FROM 'bench_dump_dense11_base64.txt'
+\copy bench_load FROM 'bench_dump_dense14_base64.txt'
@@ -0,0 +1,57 @@
+-- ----------------------------------------------------------------
+-- Size and cost of the entropy coded schema version 4.
+--
+-- Usage: psql -X -v nsketches=1000 -f bench/entropy.sql <db>
+--
+-- Builds nsketches dense sketches of 100000 hashes for each of the
+-- log2m=11 and log2m=14 shapes, stores each as versions 1 and 4, and
+-- for each version prints their total size and times their
+-- hll_cardinality, an hll_add to them, which unpacks the sketch and
+-- packs the result in the same version, and their hll_union_agg.
+-- Subtract the time of the first query of each group, which only
+-- reads the sketches.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+SELECT hll_set_output_version(1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT 1 AS vers, log2m,
+       hll_add_agg(hll_hash_bigint(gs), log2m, 5, 0, 0) AS sketch
+  FROM (VALUES (11), (14)) AS shapes(log2m),
+       generate_series(1, :nsketches * 100000::bigint) AS gs
+ GROUP BY log2m, gs % :nsketches;
+
+SELECT hll_set_output_version(4);
+
+INSERT INTO bench_sketches
+SELECT 4, log2m, hll_union(sketch, sketch)
+  FROM bench_sketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SELECT hll_set_output_version(1);
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 1 AND log2m = 11;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 1 AND log2m = 11;
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 1 AND log2m = 11;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE vers = 1 AND log2m = 11;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 1 AND log2m = 14;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 1 AND log2m = 14;
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 1 AND log2m = 14;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE vers = 1 AND log2m = 14;
+
+SELECT hll_set_output_version(4);
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 4 AND log2m = 11;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 4 AND log2m = 11;
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 4 AND log2m = 11;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE vers = 4 AND log2m = 11;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE vers = 4 AND log2m = 14;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE vers = 4 AND log2m = 14;
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE vers = 4 AND log2m = 14;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE vers = 4 AND log2m = 14;
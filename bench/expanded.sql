@@ -0,0 +1,52 @@
+-- ----------------------------------------------------------------
+-- Repeated adds to one hll, which stays unpacked between them.
+--
+-- Usage: psql -X -v nadds=100000 -f bench/expanded.sql <db>
+--
+-- For log2m 11, 14 and 16 times a PL/pgSQL loop that adds nadds
+-- hashes to an hll variable, then a chain of 10 || adds to a stored
+-- sketch of a million hashes, nadds / 10 times.  Before expanded
+-- hlls each add unpacked the sketch and packed the result.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SELECT hll_set_output_version(1);
+
+CREATE OR REPLACE FUNCTION bench_expanded_loop(log2m integer, nadds integer)
+RETURNS double precision AS $$
+DECLARE
+    h hll := hll_empty(log2m, 5, -1, 1);
+BEGIN
+    FOR i IN 1 .. nadds LOOP
+        h := h || hll_hash_integer(i);
+    END LOOP;
+    RETURN #h;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT log2m, hll_add_agg(hll_hash_integer(gs), log2m, 5, -1, 1) AS sketch
+  FROM (VALUES (11), (14), (16)) AS ls(log2m),
+       generate_series(1, 1000000) AS gs
+ GROUP BY log2m;
+
+\timing on
+
+SELECT bench_expanded_loop(11, :nadds);
+SELECT bench_expanded_loop(14, :nadds);
+SELECT bench_expanded_loop(16, :nadds);
+
+SELECT log2m, sum(length((sketch
+       || hll_hash_integer(gs * 100 + 1) || hll_hash_integer(gs * 100 + 2)
+       || hll_hash_integer(gs * 100 + 3) || hll_hash_integer(gs * 100 + 4)
+       || hll_hash_integer(gs * 100 + 5) || hll_hash_integer(gs * 100 + 6)
+       || hll_hash_integer(gs * 100 + 7) || hll_hash_integer(gs * 100 + 8)
+       || hll_hash_integer(gs * 100 + 9) || hll_hash_integer(gs * 100 + 10))::bytea))
+  FROM bench_sketches, generate_series(1, :nadds / 10) AS gs
+ GROUP BY log2m
+ ORDER BY log2m;
+
+\timing off
+
+DROP FUNCTION bench_expanded_loop(integer, integer);
@@ -0,0 +1,48 @@
+-- ----------------------------------------------------------------
+-- Updates of stored sketches with adds that change nothing.
+--
+-- Usage: psql -X -v nrows=1000 -f bench/noop.sql <db>
+--
+-- Builds nrows dense log2m=14 sketches of 20000 values each, which
+-- are TOASTed, and times an UPDATE of every row with a value it has
+-- already counted, the same UPDATE skipping the rows with
+-- hll_add_would_change, and one with new values.  Prints the WAL
+-- written and the size of the table after each.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SELECT hll_set_output_version(1);
+
+DROP TABLE IF EXISTS bench_rollup;
+
+CREATE TABLE bench_rollup AS
+SELECT id, hll_add_agg(hll_hash_bigint(id * 100000 + v), 14, 5, 0, 0) AS users
+  FROM generate_series(1, :nrows) AS id,
+       generate_series(1, 20000) AS v
+ GROUP BY id;
+VACUUM ANALYZE bench_rollup;
+
+SELECT pg_size_pretty(pg_total_relation_size('bench_rollup')) AS size;
+
+\timing on
+
+SELECT pg_current_wal_lsn() AS lsn \gset
+UPDATE bench_rollup SET users = users || hll_hash_bigint(id * 100000 + 1);
+SELECT pg_size_pretty(pg_current_wal_lsn() - :'lsn') AS wal,
+       pg_size_pretty(pg_total_relation_size('bench_rollup')) AS size;
+
+SELECT pg_current_wal_lsn() AS lsn \gset
+UPDATE bench_rollup SET users = users || hll_hash_bigint(id * 100000 + 2)
+ WHERE hll_add_would_change(users, hll_hash_bigint(id * 100000 + 2));
+SELECT pg_size_pretty(pg_current_wal_lsn() - :'lsn') AS wal,
+       pg_size_pretty(pg_total_relation_size('bench_rollup')) AS size;
+
+SELECT pg_current_wal_lsn() AS lsn \gset
+UPDATE bench_rollup SET users = users || hll_hash_bigint(id * 100000 + 20001);
+SELECT pg_size_pretty(pg_current_wal_lsn() - :'lsn') AS wal,
+       pg_size_pretty(pg_total_relation_size('bench_rollup')) AS size;
+
+\timing off
+
+DROP TABLE bench_rollup;
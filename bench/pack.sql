@@ -0,0 +1,45 @@
+-- ----------------------------------------------------------------
+-- Packing of stored sketches for each register width.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/pack.sql <db>
+--
+-- Builds nsketches dense log2m=14 sketches per regwidth from 4 to 6,
+-- and as many sparse ones, and times an hll_add to each of them,
+-- which unpacks the sketch and packs the result.  Subtract the time
+-- of the first query of each pair, which only reads the sketches.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+SELECT hll_set_max_sparse(-1);
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT regwidth, 'dense' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, regwidth, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs,
+       generate_series(4, 6) AS regwidth
+ GROUP BY regwidth, gs % :nsketches
+UNION ALL
+SELECT regwidth, 'sparse' AS kind,
+       hll_add_agg(hll_hash_bigint(gs), 14, regwidth, 0, 1) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs,
+       generate_series(4, 6) AS regwidth
+ GROUP BY regwidth, gs % :nsketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE regwidth = 4 AND kind = 'dense';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE regwidth = 4 AND kind = 'dense';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE regwidth = 5 AND kind = 'dense';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE regwidth = 5 AND kind = 'dense';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE regwidth = 6 AND kind = 'dense';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE regwidth = 6 AND kind = 'dense';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE regwidth = 4 AND kind = 'sparse';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE regwidth = 4 AND kind = 'sparse';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE regwidth = 5 AND kind = 'sparse';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE regwidth = 5 AND kind = 'sparse';
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE regwidth = 6 AND kind = 'sparse';
+SELECT sum(length(hll_add(sketch, hll_hash_integer(0))::bytea)) FROM bench_sketches WHERE regwidth = 6 AND kind = 'sparse';
@@ -0,0 +1,37 @@
+-- ----------------------------------------------------------------
+-- Per-group transition state cost of a high-cardinality rollup.
+--
+-- Usage: psql -X -v ngroups=10000000 -f bench/rollup.sql <db>
+--
+-- Compare the execution times and the HashAggregate "Memory Usage"
+-- (or "Peak Memory Usage") lines between builds.  For total RSS
+-- watch the reported backend pid with ps/top while it runs.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+\timing on
+
+-- Keep every group in a single in-memory hash table.
+SET work_mem = '8GB';
+SET max_parallel_workers_per_gather = 0;
+SET enable_sort = off;
+
+SELECT pg_backend_pid();
+
+-- One value per group: setup cost dominates.
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF)
+SELECT gs, hll_add_agg(hll_hash_integer(gs))
+  FROM generate_series(1, :ngroups) AS gs
+ GROUP BY gs;
+
+-- One small sketch per group.
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF)
+SELECT gs, hll_union_agg(hll_add(hll_empty(), hll_hash_integer(gs)))
+  FROM generate_series(1, :ngroups) AS gs
+ GROUP BY gs;
+
+-- Ten values per group.
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF)
+SELECT gs % (:ngroups / 10), hll_add_agg(hll_hash_integer(gs))
+  FROM generate_series(1, :ngroups) AS gs
+ GROUP BY 1;
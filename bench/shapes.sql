@@ -0,0 +1,50 @@
+-- ----------------------------------------------------------------
+-- The hot paths for each of the common (log2m, regwidth) shapes.
+--
+-- Usage: psql -X -v nsketches=100000 -f bench/shapes.sql <db>
+--
+-- For each of (11, 5), (12, 5), (14, 5) and (14, 6), times an
+-- hll_add_agg of 20 * nsketches hashes into one group, then builds
+-- nsketches dense sketches and times their hll_cardinality and their
+-- hll_union_agg.  Subtract the time of the query before each
+-- cardinality, which only reads the sketches.
+-- ----------------------------------------------------------------
+
+\set ON_ERROR_STOP 1
+
+SET max_parallel_workers_per_gather = 0;
+
+CREATE TEMP TABLE bench_hashes AS
+SELECT hll_hash_bigint(gs) AS hashval
+  FROM generate_series(1, :nsketches * 20) AS gs;
+VACUUM ANALYZE bench_hashes;
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT log2m, regwidth,
+       hll_add_agg(hll_hash_bigint(gs), log2m, regwidth, 0, 0) AS sketch
+  FROM generate_series(1, :nsketches * 20) AS gs,
+       (VALUES (11, 5), (12, 5), (14, 5), (14, 6)) AS shapes(log2m, regwidth)
+ GROUP BY log2m, regwidth, gs % :nsketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SELECT hll_cardinality(hll_add_agg(hashval, 11, 5, 0, 0)) FROM bench_hashes;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 11 AND regwidth = 5;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 11 AND regwidth = 5;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE log2m = 11 AND regwidth = 5;
+
+SELECT hll_cardinality(hll_add_agg(hashval, 12, 5, 0, 0)) FROM bench_hashes;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 12 AND regwidth = 5;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 12 AND regwidth = 5;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE log2m = 12 AND regwidth = 5;
+
+SELECT hll_cardinality(hll_add_agg(hashval, 14, 5, 0, 0)) FROM bench_hashes;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 14 AND regwidth = 5;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 14 AND regwidth = 5;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE log2m = 14 AND regwidth = 5;
+
+SELECT hll_cardinality(hll_add_agg(hashval, 14, 6, 0, 0)) FROM bench_hashes;
+SELECT sum(length(sketch::bytea)) FROM bench_sketches WHERE log2m = 14 AND regwidth = 6;
+SELECT sum(hll_cardinality(sketch)) FROM bench_sketches WHERE log2m = 14 AND regwidth = 6;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches WHERE log2m = 14 AND regwidth = 6;
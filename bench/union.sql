@@ -0,0 +1,34 @@
+-- ----------------------------------------------------------------
+-- Dense register union kernels.
+--
+-- Usage: psql -X -v nsketches=1000000 -f bench/union.sql <db>
+--
+-- Unions nsketches dense log2m = 14 sketches with each register max
+-- kernel.  Kernels the CPU doesn't support fail to SET; the script
+-- carries on with the next one.
+-- ----------------------------------------------------------------
+
+SET max_parallel_workers_per_gather = 0;
+
+CREATE TEMP TABLE bench_sketches AS
+SELECT hll_add_agg(hll_hash_bigint(gs), 14, 5, 0, 1) AS sketch
+  FROM generate_series(1, :nsketches * 50) AS gs
+ GROUP BY gs % :nsketches;
+VACUUM ANALYZE bench_sketches;
+
+\timing on
+
+SET hll.union_kernel = scalar;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches;
+
+SET hll.union_kernel = sse2;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches;
+
+SET hll.union_kernel = avx2;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches;
+
+SET hll.union_kernel = avx512;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches;
+
+SET hll.union_kernel = auto;
+SELECT hll_cardinality(hll_union_agg(sketch)) FROM bench_sketches;
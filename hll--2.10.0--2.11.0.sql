@@ -0,0 +1,237 @@
+/* Copyright 2013 Aggregate Knowledge, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION hll UPDATE TO '2.11.0'" to load this file. \quit
+
+-- ----------------------------------------------------------------
+-- Parallel Safety
+-- ----------------------------------------------------------------
+
+ALTER FUNCTION hll_in(cstring, oid, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_out(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_recv(internal) PARALLEL SAFE;
+ALTER FUNCTION hll_send(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_typmod_in(cstring[]) PARALLEL SAFE;
+ALTER FUNCTION hll_typmod_out(integer) PARALLEL SAFE;
+ALTER FUNCTION hll(hll, integer, boolean) PARALLEL SAFE;
+
+ALTER FUNCTION hll_hashval_in(cstring, oid, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hashval_out(hll_hashval) PARALLEL SAFE;
+ALTER FUNCTION hll_hashval_eq(hll_hashval, hll_hashval) PARALLEL SAFE;
+ALTER FUNCTION hll_hashval_ne(hll_hashval, hll_hashval) PARALLEL SAFE;
+ALTER FUNCTION hll_hashval(bigint) PARALLEL SAFE;
+ALTER FUNCTION hll_hashval_int4(integer) PARALLEL SAFE;
+
+ALTER FUNCTION hll_eq(hll, hll) PARALLEL SAFE;
+ALTER FUNCTION hll_ne(hll, hll) PARALLEL SAFE;
+ALTER FUNCTION hll_cardinality(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_union(hll, hll) PARALLEL SAFE;
+ALTER FUNCTION hll_add(hll, hll_hashval) PARALLEL SAFE;
+ALTER FUNCTION hll_add_rev(hll_hashval, hll) PARALLEL SAFE;
+ALTER FUNCTION hll_print(hll) PARALLEL SAFE;
+
+ALTER FUNCTION hll_empty() PARALLEL SAFE;
+ALTER FUNCTION hll_empty(integer) PARALLEL SAFE;
+ALTER FUNCTION hll_empty(integer, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_empty(integer, integer, bigint) PARALLEL SAFE;
+ALTER FUNCTION hll_empty(integer, integer, bigint, integer) PARALLEL SAFE;
+
+ALTER FUNCTION hll_schema_version(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_type(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_log2m(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_regwidth(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_expthresh(hll) PARALLEL SAFE;
+ALTER FUNCTION hll_sparseon(hll) PARALLEL SAFE;
+
+ALTER FUNCTION hll_hash_boolean(boolean, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hash_smallint(smallint, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hash_integer(integer, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hash_bigint(bigint, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hash_bytea(bytea, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hash_text(text, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_hash_any(anyelement, integer) PARALLEL SAFE;
+
+ALTER FUNCTION hll_union_trans(internal, hll) PARALLEL SAFE;
+ALTER FUNCTION hll_add_trans4(internal, hll_hashval, integer, integer,
+                              bigint, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_add_trans3(internal, hll_hashval, integer, integer,
+                              bigint) PARALLEL SAFE;
+ALTER FUNCTION hll_add_trans2(internal, hll_hashval, integer, integer)
+    PARALLEL SAFE;
+ALTER FUNCTION hll_add_trans1(internal, hll_hashval, integer) PARALLEL SAFE;
+ALTER FUNCTION hll_add_trans0(internal, hll_hashval) PARALLEL SAFE;
+
+ALTER FUNCTION hll_pack(internal) PARALLEL SAFE;
+ALTER FUNCTION hll_card_unpacked(internal) PARALLEL SAFE;
+ALTER FUNCTION hll_floor_card_unpacked(internal) PARALLEL SAFE;
+ALTER FUNCTION hll_ceil_card_unpacked(internal) PARALLEL SAFE;
+
+-- ----------------------------------------------------------------
+-- New Functions
+-- ----------------------------------------------------------------
+
+-- Cardinality of a multiset with a named estimator, 'classic' or 'ertl'.
+--
+CREATE FUNCTION hll_cardinality(hll, text)
+     RETURNS double precision
+     AS 'MODULE_PATHNAME', 'hll_cardinality_estimator'
+     LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- Would adding an integer hash change a multiset?
+--
+CREATE FUNCTION hll_add_would_change(hll, hll_hashval)
+     RETURNS boolean
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- Would the union with the second multiset change the first?
+--
+CREATE FUNCTION hll_union_would_change(hll, hll)
+     RETURNS boolean
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- Counters of this backend's cache of unpacked TOASTed hlls.
+--
+CREATE FUNCTION hll_decode_cache_stats(OUT hits bigint,
+                                       OUT misses bigint,
+                                       OUT entries bigint,
+                                       OUT bytes bigint)
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+
+-- Empty this backend's cache of unpacked TOASTed hlls.
+--
+CREATE FUNCTION hll_decode_cache_reset()
+     RETURNS void
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+
+-- Combines two internal data structures (parallel aggregation).
+--
+CREATE FUNCTION hll_union_internal(internal, internal)
+     RETURNS internal
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C PARALLEL SAFE;
+
+-- Serializes internal data structure (parallel aggregation).
+--
+CREATE FUNCTION hll_serialize(internal)
+     RETURNS bytea
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C STRICT PARALLEL SAFE;
+
+-- Deserializes internal data structure (parallel aggregation).
+--
+CREATE FUNCTION hll_deserialize(bytea, internal)
+     RETURNS internal
+     AS 'MODULE_PATHNAME'
+     LANGUAGE C STRICT PARALLEL SAFE;
+
+-- ----------------------------------------------------------------
+-- Aggregates
+-- ----------------------------------------------------------------
+
+-- The combine, serialize and deserialize functions and the state size
+-- can only be given when an aggregate is created, so the aggregates
+-- are created anew.  This fails, leaving the extension at 2.10.0, if
+-- a view or other object depends on one of them; drop it first and
+-- create it again after the update.
+
+DROP AGGREGATE hll_union_agg (hll);
+DROP AGGREGATE hll_add_agg (hll_hashval);
+DROP AGGREGATE hll_add_agg (hll_hashval, integer);
+DROP AGGREGATE hll_add_agg (hll_hashval, integer, integer);
+DROP AGGREGATE hll_add_agg (hll_hashval, integer, integer, bigint);
+DROP AGGREGATE hll_add_agg (hll_hashval, integer, integer, bigint, integer);
+
+-- NOTE - The SSPACE of the aggregates below is the transition state
+-- size of a default (log2m = 11) multiset once it has promoted to
+-- registers: a small header plus 2 KB of registers and their 128
+-- byte histogram.  Smaller groups use less.
+
+-- Union aggregate function, returns hll.
+--
+CREATE AGGREGATE hll_union_agg (hll) (
+       SFUNC = hll_union_trans,
+       STYPE = internal,
+       SSPACE = 2280,
+       FINALFUNC = hll_pack,
+       COMBINEFUNC = hll_union_internal,
+       SERIALFUNC = hll_serialize,
+       DESERIALFUNC = hll_deserialize,
+       PARALLEL = SAFE
+);
+
+-- Add aggregate function, returns hll.
+CREATE AGGREGATE hll_add_agg (hll_hashval) (
+       SFUNC = hll_add_trans0,
+       STYPE = internal,
+       SSPACE = 2280,
+       FINALFUNC = hll_pack,
+       COMBINEFUNC = hll_union_internal,
+       SERIALFUNC = hll_serialize,
+       DESERIALFUNC = hll_deserialize,
+       PARALLEL = SAFE
+);
+
+-- Add aggregate function, returns hll.
+CREATE AGGREGATE hll_add_agg (hll_hashval, integer) (
+       SFUNC = hll_add_trans1,
+       STYPE = internal,
+       SSPACE = 2280,
+       FINALFUNC = hll_pack,
+       COMBINEFUNC = hll_union_internal,
+       SERIALFUNC = hll_serialize,
+       DESERIALFUNC = hll_deserialize,
+       PARALLEL = SAFE
+);
+
+-- Add aggregate function, returns hll.
+CREATE AGGREGATE hll_add_agg (hll_hashval, integer, integer) (
+       SFUNC = hll_add_trans2,
+       STYPE = internal,
+       SSPACE = 2280,
+       FINALFUNC = hll_pack,
+       COMBINEFUNC = hll_union_internal,
+       SERIALFUNC = hll_serialize,
+       DESERIALFUNC = hll_deserialize,
+       PARALLEL = SAFE
+);
+
+-- Add aggregate function, returns hll.
+CREATE AGGREGATE hll_add_agg (hll_hashval, integer, integer, bigint) (
+       SFUNC = hll_add_trans3,
+       STYPE = internal,
+       SSPACE = 2280,
+       FINALFUNC = hll_pack,
+       COMBINEFUNC = hll_union_internal,
+       SERIALFUNC = hll_serialize,
+       DESERIALFUNC = hll_deserialize,
+       PARALLEL = SAFE
+);
+
+-- Add aggregate function, returns hll.
+CREATE AGGREGATE hll_add_agg (hll_hashval, integer, integer, bigint, integer) (
+       SFUNC = hll_add_trans4,
+       STYPE = internal,
+       SSPACE = 2280,
+       FINALFUNC = hll_pack,
+       COMBINEFUNC = hll_union_internal,
+       SERIALFUNC = hll_serialize,
+       DESERIALFUNC = hll_deserialize,
+       PARALLEL = SAFE
+);
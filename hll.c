@@ -17,25 +17,58 @@
 
 #if defined(__APPLE__)
 #include <libkern/OSByteOrder.h>
+#define bswap_32 OSSwapInt32
 #define bswap_64 OSSwapInt64
 #else
 #include <byteswap.h>
 #endif
 
+// Bitstreams are big-endian, and register arrays are read and written
+// several registers to a word, the first in the lowest byte; loads and
+// stores of either convert between that and the host order with these.
+#ifdef WORDS_BIGENDIAN
+#define hll_be32(x) (x)
+#define hll_be64(x) (x)
+#define hll_le32(x) bswap_32(x)
+#define hll_le64(x) bswap_64(x)
+#else
+#define hll_be32(x) bswap_32(x)
+#define hll_be64(x) bswap_64(x)
+#define hll_le32(x) (x)
+#define hll_le64(x) (x)
+#endif
+
 #include <funcapi.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_X86_64_KERNELS 1
+#include <immintrin.h>
+#endif
+
 #include "utils/array.h"
+#include "utils/builtins.h"
 #include "utils/bytea.h"
+#include "utils/expandeddatum.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
 #include "utils/int8.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "catalog/pg_type.h"
+#include "lib/ilist.h"
 #include "lib/stringinfo.h"
 #include "libpq/pqformat.h"
 
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h"
+#else
+#include "access/tuptoaster.h"
+#endif
+
 #include "MurmurHash3.h"
 
 #ifdef PG_MODULE_MAGIC
@@ -47,7 +80,10 @@ PG_MODULE_MAGIC;
 // ----------------------------------------------------------------
 
 // Set the default output schema.
-static uint8_t g_output_version = 1;
+static int g_output_version = 1;
+
+// Most recent schema version.
+#define MS_MAXVERSION	5
 
 // ----------------------------------------------------------------
 // Type Modifiers
@@ -192,1819 +228,6386 @@ expthresh_value(int64 expthresh, size_t nbits, size_t nregs)
 //
 static int g_max_sparse = -1;
 
-
 // ----------------------------------------------------------------
-// Aggregating Data Structure
+// Register Max Kernels
 // ----------------------------------------------------------------
 
-typedef struct
-{
-    size_t		mse_nelem;
-    uint64_t	mse_elems[0];
+// The union of two sets of dense registers is a bytewise unsigned
+// max.  On x86_64 there are SSE2, AVX2 and AVX-512 versions; the best
+// one the CPU supports is picked when the library is loaded.  The
+// hll.union_kernel setting can force one for benchmarking.
+//
+typedef void (*register_max_fn)(uint8_t * o_regp,
+                                uint8_t const * i_regp,
+                                size_t i_nregs);
 
-} ms_explicit_t;
+static void
+register_max_scalar(uint8_t * o_regp, uint8_t const * i_regp, size_t i_nregs)
+{
+    for (size_t ii = 0; ii < i_nregs; ++ii)
+    {
+        if (o_regp[ii] < i_regp[ii])
+            o_regp[ii] = i_regp[ii];
+    }
+}
 
-// Defines the *unpacked* register.
-typedef uint8_t compreg_t;
+#ifdef HAVE_X86_64_KERNELS
 
-typedef struct
+// SSE2 is part of the x86_64 baseline.
+static void
+register_max_sse2(uint8_t * o_regp, uint8_t const * i_regp, size_t i_nregs)
 {
-    compreg_t	msc_regs[0];
+    size_t ii = 0;
 
-} ms_compressed_t;
+    for (; ii + 16 <= i_nregs; ii += 16)
+    {
+        __m128i aa = _mm_loadu_si128((__m128i const *) &o_regp[ii]);
+        __m128i bb = _mm_loadu_si128((__m128i const *) &i_regp[ii]);
+        _mm_storeu_si128((__m128i *) &o_regp[ii], _mm_max_epu8(aa, bb));
+    }
 
-// Size of the compressed or explicit data.
-#define MS_MAXDATA		(128 * 1024)
+    register_max_scalar(&o_regp[ii], &i_regp[ii], i_nregs - ii);
+}
 
-typedef struct
+__attribute__((target("avx2")))
+static void
+register_max_avx2(uint8_t * o_regp, uint8_t const * i_regp, size_t i_nregs)
 {
-    size_t		ms_nbits;
-    size_t		ms_nregs;
-    size_t		ms_log2nregs;
-    int64		ms_expthresh;
-    bool		ms_sparseon;
-
-	uint64_t	ms_type;	// size is only for alignment.
+    size_t ii = 0;
 
-    union
+    for (; ii + 32 <= i_nregs; ii += 32)
     {
-        // MST_EMPTY and MST_UNDEFINED don't need data.
-        // MST_SPARSE is only used in the packed format.
-        //
-        ms_explicit_t	as_expl;	// MST_EXPLICIT
-        ms_compressed_t	as_comp;	// MST_COMPRESSED
-        uint8_t			as_size[MS_MAXDATA];	// sizes the union.
-
-    }		ms_data;
+        __m256i aa = _mm256_loadu_si256((__m256i const *) &o_regp[ii]);
+        __m256i bb = _mm256_loadu_si256((__m256i const *) &i_regp[ii]);
+        _mm256_storeu_si256((__m256i *) &o_regp[ii], _mm256_max_epu8(aa, bb));
+    }
 
-} multiset_t;
+    register_max_scalar(&o_regp[ii], &i_regp[ii], i_nregs - ii);
+}
 
-typedef struct
+__attribute__((target("avx512bw")))
+static void
+register_max_avx512(uint8_t * o_regp, uint8_t const * i_regp, size_t i_nregs)
 {
-    size_t			brc_nbits;	// Read size.
-    uint32_t		brc_mask;	// Read mask.
-    uint8_t const *	brc_curp;	// Current byte.
-    size_t			brc_used;	// Used bits.
+    size_t ii = 0;
 
-} bitstream_read_cursor_t;
+    for (; ii + 64 <= i_nregs; ii += 64)
+    {
+        __m512i aa = _mm512_loadu_si512((void const *) &o_regp[ii]);
+        __m512i bb = _mm512_loadu_si512((void const *) &i_regp[ii]);
+        _mm512_storeu_si512((void *) &o_regp[ii], _mm512_max_epu8(aa, bb));
+    }
 
-static uint32_t
-bitstream_unpack(bitstream_read_cursor_t * brcp)
-{
-    uint32_t retval;
+    register_max_scalar(&o_regp[ii], &i_regp[ii], i_nregs - ii);
+}
 
-    // Fetch the quadword containing our data.
-    uint64_t qw = * (uint64_t const *) brcp->brc_curp;
+#endif // HAVE_X86_64_KERNELS
 
-    // Swap the bytes.
-    qw = bswap_64(qw);
+typedef enum
+{
+    REGISTER_MAX_AUTO,
+    REGISTER_MAX_SCALAR,
+    REGISTER_MAX_SSE2,
+    REGISTER_MAX_AVX2,
+    REGISTER_MAX_AVX512
+
+} register_max_kernel_t;
 
-    // Shift the bits we want into place.
-    qw >>= 64 - brcp->brc_nbits - brcp->brc_used;
+static const struct config_enum_entry register_max_options[] =
+{
+    {"auto", REGISTER_MAX_AUTO, false},
+    {"scalar", REGISTER_MAX_SCALAR, false},
+    {"sse2", REGISTER_MAX_SSE2, false},
+    {"avx2", REGISTER_MAX_AVX2, false},
+    {"avx512", REGISTER_MAX_AVX512, false},
+    {NULL, 0, false}
+};
 
-    // Mask the bits we want.
-    retval = (uint32_t) (qw & 0xffffffff) & brcp->brc_mask;
+static int g_register_max_kernel = REGISTER_MAX_AUTO;
 
-    // We've used some more bits now.
-    brcp->brc_used += brcp->brc_nbits;
+static register_max_fn register_max = register_max_scalar;
 
-    // Normalize the cursor.
-    while (brcp->brc_used >= 8)
+// Can this CPU run the kernel?
+//
+static bool
+register_max_supported(int kernel)
+{
+    switch (kernel)
     {
-        brcp->brc_used -= 8;
-        brcp->brc_curp += 1;
+    case REGISTER_MAX_AUTO:
+    case REGISTER_MAX_SCALAR:
+        return true;
+#ifdef HAVE_X86_64_KERNELS
+    case REGISTER_MAX_SSE2:
+        return true;
+    case REGISTER_MAX_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case REGISTER_MAX_AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return false;
     }
+}
 
-    return retval;
+static bool
+check_register_max_kernel(int * newval, void ** extra, GucSource source)
+{
+    if (!register_max_supported(*newval))
+    {
+        GUC_check_errdetail("This CPU does not support the %s kernel.",
+                            register_max_options[*newval].name);
+        return false;
+    }
+    return true;
 }
 
 static void
-compressed_unpack(compreg_t * i_regp,
-                  size_t i_width,
-                  size_t i_nregs,
-                  uint8_t const * i_bitp,
-                  size_t i_size,
-                  uint8_t i_vers)
+assign_register_max_kernel(int newval, void * extra)
 {
-    size_t bitsz;
-    size_t padsz;
+    // Pick the best kernel for auto.
+    if (newval == REGISTER_MAX_AUTO)
+    {
+        if (register_max_supported(REGISTER_MAX_AVX512))
+            newval = REGISTER_MAX_AVX512;
+        else if (register_max_supported(REGISTER_MAX_AVX2))
+            newval = REGISTER_MAX_AVX2;
+        else if (register_max_supported(REGISTER_MAX_SSE2))
+            newval = REGISTER_MAX_SSE2;
+        else
+            newval = REGISTER_MAX_SCALAR;
+    }
 
-    bitstream_read_cursor_t brc;
+    switch (newval)
+    {
+#ifdef HAVE_X86_64_KERNELS
+    case REGISTER_MAX_SSE2:
+        register_max = register_max_sse2;
+        break;
+    case REGISTER_MAX_AVX2:
+        register_max = register_max_avx2;
+        break;
+    case REGISTER_MAX_AVX512:
+        register_max = register_max_avx512;
+        break;
+#endif
+    default:
+        register_max = register_max_scalar;
+        break;
+    }
+}
 
-    bitsz = i_width * i_nregs;
+// ----------------------------------------------------------------
+// Base64 Text Format
+// ----------------------------------------------------------------
 
-    // Fail fast if the compressed array isn't big enough.
-    if (i_size * 8 < bitsz)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("compressed hll argument not large enough")));
+// hll_out writes bytea's hex format ("\x...") by default.  With
+// hll.output_format set to base64 it writes "\b" followed by the
+// standard padded base64 of the packed bytes instead, which is a
+// third smaller.  hll_in always reads both.  byteain rejects a
+// backslash followed by "b", so the two can't be confused.
+//
+typedef enum
+{
+    OUTPUT_FORMAT_HEX,
+    OUTPUT_FORMAT_BASE64
 
-    padsz = i_size * 8 - bitsz;
+} output_format_t;
 
-    // Fail fast if the pad size doesn't make sense.
-    if (padsz >= 8)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("inconsistent padding in compressed hll argument")));
+static const struct config_enum_entry output_format_options[] =
+{
+    {"hex", OUTPUT_FORMAT_HEX, false},
+    {"base64", OUTPUT_FORMAT_BASE64, false},
+    {NULL, 0, false}
+};
 
-    brc.brc_nbits = i_width;
-    brc.brc_mask = (1 << i_width) - 1;
-    brc.brc_curp = i_bitp;
-    brc.brc_used = 0;
+static int g_output_format = OUTPUT_FORMAT_HEX;
 
-    for (ssize_t ndx = 0; ndx < i_nregs; ++ndx)
-    {
-        uint32_t val = bitstream_unpack(&brc);
-        i_regp[ndx] = val;
-    }
-}
+static char const base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-static void
-sparse_unpack(compreg_t * i_regp,
-              size_t i_width,
-              size_t i_log2nregs,
-              size_t i_nfilled,
-              uint8_t const * i_bitp,
-              size_t i_size)
+// Each 3 bytes, or part of them at the end, take 4 characters.
+#define BASE64_ENCODED_SIZE(nbytes)	(((nbytes) + 2) / 3 * 4)
+
+// The AVX2 decoder writes a whole vector for 24 bytes of output.
+#define BASE64_DECODE_SLOP	8
+
+static size_t
+base64_encode_scalar(char * o_dst, uint8_t const * i_src, size_t i_size)
 {
-    size_t bitsz;
-    size_t padsz;
-    size_t chunksz;
-    uint32_t regmask;
+    char * dst = o_dst;
+    size_t ii = 0;
 
-    bitstream_read_cursor_t brc;
+    for (; ii + 3 <= i_size; ii += 3)
+    {
+        uint32_t val = ((uint32_t) i_src[ii] << 16) |
+            ((uint32_t) i_src[ii + 1] << 8) | i_src[ii + 2];
 
-    chunksz = i_log2nregs + i_width;
-    bitsz = chunksz * i_nfilled;
-    padsz = i_size * 8 - bitsz;
+        *dst++ = base64_chars[val >> 18];
+        *dst++ = base64_chars[(val >> 12) & 0x3f];
+        *dst++ = base64_chars[(val >> 6) & 0x3f];
+        *dst++ = base64_chars[val & 0x3f];
+    }
 
-    // Fail fast if the pad size doesn't make sense.
-    if (padsz >= 8)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("inconsistent padding in sparse hll argument")));
+    if (ii < i_size)
+    {
+        uint32_t val = (uint32_t) i_src[ii] << 16;
 
-    regmask = (1 << i_width) - 1;
+        if (ii + 1 < i_size)
+            val |= (uint32_t) i_src[ii + 1] << 8;
 
-    brc.brc_nbits = chunksz;
-    brc.brc_mask = (1 << chunksz) - 1;
-    brc.brc_curp = i_bitp;
-    brc.brc_used = 0;
+        *dst++ = base64_chars[val >> 18];
+        *dst++ = base64_chars[(val >> 12) & 0x3f];
+        *dst++ = ii + 1 < i_size ? base64_chars[(val >> 6) & 0x3f] : '=';
+        *dst++ = '=';
+    }
+
+    return dst - o_dst;
+}
 
-    for (ssize_t ii = 0; ii < i_nfilled; ++ii)
+// Decode whole groups of 4 characters, none of them padding, into
+// groups of 3 bytes.  Returns how many groups were decoded, which is
+// short of i_ngroups if one has a character outside the alphabet.
+//
+static size_t
+base64_decode_scalar(uint8_t * o_dst, char const * i_src, size_t i_ngroups)
+{
+    static int8_t const values[256] =
     {
-        uint32_t buffer = bitstream_unpack(&brc);
-        uint32_t val = buffer & regmask;
-        uint32_t ndx = buffer >> i_width;
-        i_regp[ndx] = val;
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+        -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+        -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    };
+
+    for (size_t gg = 0; gg < i_ngroups; ++gg)
+    {
+        uint8_t const * src = (uint8_t const *) &i_src[gg * 4];
+        int32_t aa = values[src[0]];
+        int32_t bb = values[src[1]];
+        int32_t cc = values[src[2]];
+        int32_t dd = values[src[3]];
+        uint32_t val;
+
+        // Any -1 sets the sign bit.
+        if ((aa | bb | cc | dd) < 0)
+            return gg;
+
+        val = (aa << 18) | (bb << 12) | (cc << 6) | dd;
+        o_dst[gg * 3] = val >> 16;
+        o_dst[gg * 3 + 1] = val >> 8;
+        o_dst[gg * 3 + 2] = val;
     }
+
+    return i_ngroups;
 }
 
-typedef struct
+#ifdef HAVE_X86_64_KERNELS
+
+// Is the AVX2 codec usable?  -1 until we've looked.
+static int g_use_base64_avx2 = -1;
+
+static bool
+use_base64_avx2(void)
 {
-    size_t			bwc_nbits;	// Write size.
-    uint8_t *		bwc_curp;	// Current byte.
-    size_t			bwc_used;	// Used bits.
+    if (g_use_base64_avx2 < 0)
+    {
+        __builtin_cpu_init();
+        g_use_base64_avx2 = __builtin_cpu_supports("avx2");
+    }
 
-} bitstream_write_cursor_t;
+    return g_use_base64_avx2;
+}
 
-static void
-bitstream_pack(bitstream_write_cursor_t * bwcp, uint32_t val)
+// The AVX2 codec is Muła and Lemire's ("Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions", 2018).  Each vector holds 24
+// bytes or 32 characters, 12 and 16 in each 128-bit lane.
+//
+// Spread each 3 bytes of a lane, which the encoder wants at offset 4
+// in the low lane and 0 in the high one, over 4 bytes of 6 bits.
+//
+__attribute__((target("avx2")))
+static inline __m256i
+base64_encode_split(__m256i in)
 {
-    size_t bits_left_in_first_byte = 8 - bwcp->bwc_used;
-    size_t bits_to_write_after_first_byte = bwcp->bwc_nbits - bits_left_in_first_byte;
-    size_t full_bytes_to_write = bits_to_write_after_first_byte / 8;
-    size_t remainder_bits_after_full_bytes = bits_to_write_after_first_byte % 8;
+    __m256i t0;
+    __m256i t1;
+    __m256i t2;
+    __m256i t3;
+
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10,
+                                                  7, 8, 6, 7,
+                                                  4, 5, 3, 4,
+                                                  1, 2, 0, 1,
+                                                  14, 15, 13, 14,
+                                                  11, 12, 10, 11,
+                                                  8, 9, 7, 8,
+                                                  5, 6, 4, 5));
+
+    t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+
+    return _mm256_or_si256(t1, t3);
+}
 
-    // write is small enough that it fits in current byte's remaining space with
-    // room to spare, so pad the bottom of the byte by left-shifting
-    if (bwcp->bwc_nbits < bits_left_in_first_byte)
-    {
-        * bwcp->bwc_curp = (* bwcp->bwc_curp) | ((uint8_t)(val << (bits_left_in_first_byte - bwcp->bwc_nbits)));
+// Map 6-bit values to the alphabet by adding the offset of the range
+// each one falls in: A-Z, a-z, 0-9, + and /.
+//
+__attribute__((target("avx2")))
+static inline __m256i
+base64_encode_chars(__m256i in)
+{
+    __m256i const offsets =
+        _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+                         -4, -4, -4, -4, -19, -16, 0, 0,
+                         65, 71, -4, -4, -4, -4, -4, -4,
+                         -4, -4, -4, -4, -19, -16, 0, 0);
 
-        // consume part of the byte and exit
-        bwcp->bwc_used += bwcp->bwc_nbits;
-        return;
-    }
+    // 0 for A-Z, 1 for a-z, 2-11 for 0-9, 12 and 13 for + and /.
+    __m256i ndx = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+    ndx = _mm256_sub_epi8(ndx, _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25)));
 
-    // write fits exactly in current byte's remaining space, so just OR it in to
-    // the bottom bits of the byte
-    if (bwcp->bwc_nbits == bits_left_in_first_byte)
-    {
-        * bwcp->bwc_curp = (* bwcp->bwc_curp) | (uint8_t)(val);
+    return _mm256_add_epi8(in, _mm256_shuffle_epi8(offsets, ndx));
+}
 
-        // consume remainder of byte and exit
-        bwcp->bwc_used = 0;
-        bwcp->bwc_curp += 1;
-        return;
-    }
+// Encode as many whole 24-byte blocks as can be loaded without
+// reading past the end.  Returns the number of bytes encoded.
+//
+__attribute__((target("avx2")))
+static size_t
+base64_encode_avx2(char * o_dst, uint8_t const * i_src, size_t i_size)
+{
+    size_t ii = 0;
+    __m256i in;
 
-    // write DOES NOT fit into current byte, so shift off all but the topmost
-    // bits from the value and OR those into the bottom bits of the byte
-    /* bwcp->bwc_nbits > bits_left_in_first_byte */
-    * bwcp->bwc_curp = (* bwcp->bwc_curp) | ((uint8_t)(val >> (bwcp->bwc_nbits - bits_left_in_first_byte)));
+    if (i_size < 32)
+        return 0;
 
-    // consume remainder of byte
-    bwcp->bwc_used = 0;
-    bwcp->bwc_curp += 1;
+    // The first block can't be loaded from 4 bytes back, so move its
+    // dwords up instead.
+    in = _mm256_loadu_si256((__m256i const *) i_src);
+    in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 0, 1, 2,
+                                                           3, 4, 5, 6));
+    in = base64_encode_chars(base64_encode_split(in));
+    _mm256_storeu_si256((__m256i *) o_dst, in);
 
-    // if there are 8 or more bits of the value left to write, write them in one
-    // byte chunks, higher chunks first
-    if (full_bytes_to_write > 0)
+    for (ii = 24; ii + 28 <= i_size; ii += 24)
     {
-        for (size_t i = 0; i < full_bytes_to_write; ++i)
-        {
-            size_t bits_to_keep = bits_left_in_first_byte + (8 * (i + 1));
-            size_t right_shift = (bwcp->bwc_nbits - bits_to_keep);
+        in = _mm256_loadu_si256((__m256i const *) &i_src[ii - 4]);
+        in = base64_encode_chars(base64_encode_split(in));
+        _mm256_storeu_si256((__m256i *) &o_dst[ii / 3 * 4], in);
+    }
 
-            // no OR here because byte is guaranteed to be completely unused
-            // see above, before conditional
-            * bwcp->bwc_curp = (uint8_t)(val >> right_shift);
+    return ii;
+}
 
-            // consume entire byte
-            bwcp->bwc_used = 0;
-            bwcp->bwc_curp += 1;
-        }
-    }
-    if (remainder_bits_after_full_bytes > 0)
+// Decode whole 32-character blocks, stopping short of i_ngroups / 8
+// blocks at the first one with a character outside the alphabet.
+// Writes 8 bytes past each block.  Returns the number of 4-character
+// groups decoded.
+//
+__attribute__((target("avx2")))
+static size_t
+base64_decode_avx2(uint8_t * o_dst, char const * i_src, size_t i_ngroups)
+{
+    // Bits of the low and high nibbles of each character; a valid
+    // character has none in common.
+    __m256i const lut_lo =
+        _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                         0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    __m256i const lut_hi =
+        _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                         0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    // What to add to a character to get its value, by high nibble,
+    // with '/' moved to slot 1.
+    __m256i const lut_roll =
+        _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                         0, 0, 0, 0, 0, 0, 0, 0,
+                         0, 16, 19, 4, -65, -65, -71, -71,
+                         0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i const mask_2f = _mm256_set1_epi8(0x2f);
+    size_t gg = 0;
+
+    for (; gg + 8 <= i_ngroups; gg += 8)
     {
-        uint8_t mask = (1 << remainder_bits_after_full_bytes) - 1;
-        // no OR here because byte is guaranteed to be completely unused
-        * bwcp->bwc_curp = ((uint8_t)val & mask) << (8 - remainder_bits_after_full_bytes);
+        __m256i in = _mm256_loadu_si256((__m256i const *) &i_src[gg * 4]);
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+                                              mask_2f);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo,
+                                         _mm256_and_si256(in, mask_2f));
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i roll;
+
+        if (!_mm256_testz_si256(lo, hi))
+            break;
 
-        // consume part of the byte
-        bwcp->bwc_used = remainder_bits_after_full_bytes;
+        roll = _mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f), hi_nibbles);
+        roll = _mm256_shuffle_epi8(lut_roll, roll);
+        in = _mm256_add_epi8(in, roll);
+
+        // Merge each 4 values of 6 bits into 3 bytes, big-endian,
+        // then pack the 12 bytes of each lane together.
+        in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+        in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+        in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(2, 1, 0, 6, 5, 4,
+                                                      10, 9, 8, 14, 13, 12,
+                                                      -1, -1, -1, -1,
+                                                      2, 1, 0, 6, 5, 4,
+                                                      10, 9, 8, 14, 13, 12,
+                                                      -1, -1, -1, -1));
+        in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2, 4,
+                                                               5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i *) &o_dst[gg * 3], in);
     }
+
+    return gg;
 }
 
-static void
-compressed_pack(compreg_t const * i_regp,
-                size_t i_width,
-                size_t i_nregs,
-                uint8_t * o_bitp,
-                size_t i_size,
-                uint8_t i_vers)
-{
-    size_t bitsz;
-    size_t padsz;
+#endif // HAVE_X86_64_KERNELS
 
-    bitstream_write_cursor_t bwc;
+// Encode i_size bytes into BASE64_ENCODED_SIZE(i_size) characters.
+//
+static size_t
+base64_encode(char * o_dst, uint8_t const * i_src, size_t i_size)
+{
+    size_t ndone = 0;
 
-    // We need to zero the output array because we use
-    // an bitwise-or-accumulator below.
-    memset(o_bitp, '\0', i_size);
+#ifdef HAVE_X86_64_KERNELS
+    if (use_base64_avx2())
+        ndone = base64_encode_avx2(o_dst, i_src, i_size);
+#endif
 
-    bitsz = i_width * i_nregs;
+    return ndone / 3 * 4 +
+        base64_encode_scalar(&o_dst[ndone / 3 * 4], &i_src[ndone],
+                             i_size - ndone);
+}
 
-    // Fail fast if the compressed array isn't big enough.
-    if (i_size * 8 < bitsz)
+// Decode base64 text into a newly allocated bytea.
+//
+static bytea *
+base64_decode(char const * i_src)
+{
+    size_t len = strlen(i_src);
+    size_t ngroups = len / 4;
+    size_t npad = 0;
+    size_t ndone = 0;
+    size_t size;
+    bytea * bp;
+    uint8_t * dst;
+
+    if (len % 4 != 0)
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("compressed output buffer not large enough")));
+                 errmsg("invalid base64 hll input")));
 
-    padsz = i_size * 8 - bitsz;
+    if (len > 0 && i_src[len - 1] == '=')
+        npad = i_src[len - 2] == '=' ? 2 : 1;
 
-    // Fail fast if the pad size doesn't make sense.
-    if (padsz >= 8)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("inconsistent compressed output pad size")));
+    size = ngroups * 3 - npad;
+    bp = (bytea *) palloc(VARHDRSZ + ngroups * 3 + BASE64_DECODE_SLOP);
+    SET_VARSIZE(bp, VARHDRSZ + size);
+    dst = (uint8_t *) VARDATA(bp);
 
-    bwc.bwc_nbits = i_width;
-    bwc.bwc_curp = o_bitp;
-    bwc.bwc_used = 0;
+    // Leave the group with the padding to the end.
+    if (npad > 0)
+        --ngroups;
 
-    for (ssize_t ndx = 0; ndx < i_nregs; ++ndx)
-        bitstream_pack(&bwc, i_regp[ndx]);
-}
+#ifdef HAVE_X86_64_KERNELS
+    if (use_base64_avx2())
+        ndone = base64_decode_avx2(dst, i_src, ngroups);
+#endif
 
-static void
-sparse_pack(compreg_t const * i_regp,
-            size_t i_width,
-            size_t i_nregs,
-            size_t i_log2nregs,
-            size_t i_nfilled,
-            uint8_t * o_bitp,
-            size_t i_size)
-{
-    size_t bitsz;
-    size_t padsz;
+    ndone += base64_decode_scalar(&dst[ndone * 3], &i_src[ndone * 4],
+                                  ngroups - ndone);
+    if (ndone < ngroups)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("invalid base64 hll input")));
 
-    bitstream_write_cursor_t bwc;
+    if (npad > 0)
+    {
+        char last[4];
+        uint8_t bytes[3];
 
-    // We need to zero the output array because we use
-    // an bitwise-or-accumulator below.
-    memset(o_bitp, '\0', i_size);
+        memcpy(last, &i_src[ngroups * 4], 4);
+        last[3] = 'A';
+        if (npad == 2)
+            last[2] = 'A';
 
-    bitsz = i_nfilled * (i_log2nregs + i_width);
+        if (base64_decode_scalar(bytes, last, 1) != 1)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("invalid base64 hll input")));
 
-    // Fail fast if the compressed array isn't big enough.
-    if (i_size * 8 < bitsz)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("sparse output buffer not large enough")));
+        memcpy(&dst[ngroups * 3], bytes, 3 - npad);
+    }
 
-    padsz = i_size * 8 - bitsz;
+    return bp;
+}
 
-    // Fail fast if the pad size doesn't make sense.
-    if (padsz >= 8)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("inconsistent sparse output pad size")));
+// ----------------------------------------------------------------
+// Session Settings
+// ----------------------------------------------------------------
+
+// The output version, max sparse and type modifier defaults are
+// backed by GUC variables so that parallel workers run with the same
+// settings as the leader.  The hll_set_* functions assign them with
+// PGC_S_OVERRIDE, which keeps their established non-transactional
+// behavior.  Users can't SET them directly since that would stack
+// transactional values on top.
+//
+// expthresh doesn't fit in an integer GUC so it is carried in a
+// real-valued one and mirrored into g_default_expthresh.
+//
+static double g_default_expthresh_guc = DEFAULT_EXPTHRESH;
 
-    bwc.bwc_nbits = i_log2nregs + i_width;
-    bwc.bwc_curp = o_bitp;
-    bwc.bwc_used = 0;
+static bool
+check_default_expthresh(double * newval, void ** extra, GucSource source)
+{
+    int64 expthresh = (int64) *newval;
 
-    for (ssize_t ndx = 0; ndx < i_nregs; ++ndx)
+    if ((double) expthresh != *newval ||
+        (expthresh > 0 && (1LL << integer_log2(expthresh)) != expthresh))
     {
-        if (i_regp[ndx] != 0)
-        {
-            uint32_t buffer = (ndx << i_width) | i_regp[ndx];
-            bitstream_pack(&bwc, buffer);
-        }
+        GUC_check_errdetail("expthresh must be -1, 0 or a power of 2.");
+        return false;
     }
+    return true;
 }
 
 static void
-check_metadata(multiset_t const * i_omp, multiset_t const * i_imp)
+assign_default_expthresh(double newval, void * extra)
 {
-    if (i_omp->ms_nbits != i_imp->ms_nbits)
-    {
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("register width does not match: "
-                        "source uses %ld and dest uses %ld",
-                        i_imp->ms_nbits, i_omp->ms_nbits)));
-    }
-
-    if (i_omp->ms_nregs != i_imp->ms_nregs)
-    {
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("register count does not match: "
-                        "source uses %ld and dest uses %ld",
-                        i_imp->ms_nregs, i_omp->ms_nregs)));
-    }
-
-    // Don't need to compare log2nregs because we compared nregs ...
+    g_default_expthresh = (int64) newval;
+}
 
-    if (i_omp->ms_expthresh != i_imp->ms_expthresh)
-    {
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("explicit threshold does not match: "
-                        "source uses %ld and dest uses %ld",
-                        i_imp->ms_expthresh, i_omp->ms_expthresh)));
-    }
+// Memory cap of the decode cache in kB, 0 when it is off.  See
+// Decode Cache below.
+//
+static int g_decode_cache_size = 0;
 
-    if (i_omp->ms_sparseon != i_imp->ms_sparseon)
-    {
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("sparse enable does not match: "
-                        "source uses %d and dest uses %d",
-                        i_imp->ms_sparseon, i_omp->ms_sparseon)));
-    }
+void		_PG_init(void);
+void
+_PG_init(void)
+{
+    DefineCustomIntVariable("hll.output_version",
+                            "Schema version of packed hll output.",
+                            "Set with hll_set_output_version().",
+                            &g_output_version,
+                            1, 1, MS_MAXVERSION,
+                            PGC_SUSET, GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("hll.max_sparse",
+                            "Sparse to full compressed threshold.",
+                            "Set with hll_set_max_sparse().",
+                            &g_max_sparse,
+                            -1, -1, INT_MAX,
+                            PGC_SUSET, GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("hll.default_log2m",
+                            "Default log2m type modifier.",
+                            "Set with hll_set_defaults().",
+                            &g_default_log2m,
+                            DEFAULT_LOG2M, 0, MAX_BITVAL(LOG2M_BITS),
+                            PGC_SUSET, GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("hll.default_regwidth",
+                            "Default regwidth type modifier.",
+                            "Set with hll_set_defaults().",
+                            &g_default_regwidth,
+                            DEFAULT_REGWIDTH, 0, MAX_BITVAL(REGWIDTH_BITS),
+                            PGC_SUSET, GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE,
+                            NULL, NULL, NULL);
+
+    DefineCustomRealVariable("hll.default_expthresh",
+                             "Default expthresh type modifier.",
+                             "Set with hll_set_defaults().",
+                             &g_default_expthresh_guc,
+                             DEFAULT_EXPTHRESH, -1, 4294967296.0,
+                             PGC_SUSET, GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE,
+                             check_default_expthresh,
+                             assign_default_expthresh,
+                             NULL);
+
+    DefineCustomIntVariable("hll.default_sparseon",
+                            "Default sparseon type modifier.",
+                            "Set with hll_set_defaults().",
+                            &g_default_sparseon,
+                            DEFAULT_SPARSEON, 0, MAX_BITVAL(SPARSEON_BITS),
+                            PGC_SUSET, GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE,
+                            NULL, NULL, NULL);
+
+    DefineCustomEnumVariable("hll.union_kernel",
+                             "Implementation of the dense register union.",
+                             "The default picks the fastest one this CPU "
+                             "supports.",
+                             &g_register_max_kernel,
+                             REGISTER_MAX_AUTO, register_max_options,
+                             PGC_USERSET, GUC_NOT_IN_SAMPLE,
+                             check_register_max_kernel,
+                             assign_register_max_kernel,
+                             NULL);
+
+    DefineCustomEnumVariable("hll.output_format",
+                             "Text format of hll output.",
+                             "Input accepts either format.",
+                             &g_output_format,
+                             OUTPUT_FORMAT_HEX, output_format_options,
+                             PGC_USERSET, GUC_NOT_IN_SAMPLE,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("hll.decode_cache_size",
+                            "Memory for unpacked hlls stored out of line.",
+                            "0 turns the cache off.",
+                            &g_decode_cache_size,
+                            0, 0, MAX_KILOBYTES,
+                            PGC_USERSET, GUC_UNIT_KB | GUC_NOT_IN_SAMPLE,
+                            NULL, NULL, NULL);
 }
 
+// Assign one of the settings above without making it transactional.
+//
 static void
-copy_metadata(multiset_t * o_msp, multiset_t const * i_msp)
+set_session_option(char const * name, int64 value)
 {
-    o_msp->ms_nbits = i_msp->ms_nbits;
-    o_msp->ms_nregs = i_msp->ms_nregs;
-    o_msp->ms_log2nregs = i_msp->ms_log2nregs;
-    o_msp->ms_expthresh = i_msp->ms_expthresh;
-    o_msp->ms_sparseon = i_msp->ms_sparseon;
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), INT64_FORMAT, value);
+    SetConfigOption(name, buf, PGC_SUSET, PGC_S_OVERRIDE);
 }
 
-static void
-compressed_add(multiset_t * o_msp, uint64_t elem)
+
+// ----------------------------------------------------------------
+// Aggregating Data Structure
+// ----------------------------------------------------------------
+
+// Explicit elements are a sorted run followed by an unsorted tail of
+// recent additions.  The tail may hold duplicates of its own elements
+// (but never of the sorted run) until it is folded into the run.
+//
+typedef struct
 {
-    size_t nbits = o_msp->ms_nbits;
-    size_t nregs = o_msp->ms_nregs;
-    size_t log2nregs = o_msp->ms_log2nregs;
+    uint64_t *	mse_elems;
+    size_t		mse_nelem;
+    size_t		mse_nsorted;
 
-    ms_compressed_t * mscp = &o_msp->ms_data.as_comp;
+} ms_explicit_t;
 
-    uint64_t mask = nregs - 1;
+// Defines the *unpacked* register.
+typedef uint8_t compreg_t;
 
-    size_t maxregval = (1 << nbits) - 1;
+typedef struct
+{
+    compreg_t *	msc_regs;
 
-    size_t ndx = elem & mask;
+    // Whether the histogram after the registers is current, see
+    // compressed_histogram.
+    bool		msc_histok;
 
-    uint64_t ss_val = elem >> log2nregs;
+} ms_compressed_t;
 
-    size_t p_w = ss_val == 0 ? 0 : __builtin_ctzll(ss_val) + 1;
+typedef struct
+{
+    uint32_t *	mss_slots;
+    size_t		mss_nslots;
+    size_t		mss_nfilled;
 
-    if (p_w > maxregval)
-        p_w = maxregval;
+} ms_sparse_t;
 
-    if (mscp->msc_regs[ndx] < p_w)
-        mscp->msc_regs[ndx] = p_w;
-}
+// Maximum size of the compressed or explicit data.
+#define MS_MAXDATA		(128 * 1024)
 
-static void
-compressed_explicit_union(multiset_t * o_msp, multiset_t const * i_msp)
-{
-    ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
-    for (size_t ii = 0; ii < msep->mse_nelem; ++ii)
-        compressed_add(o_msp, msep->mse_elems[ii]);
-}
+// Maximum number of explicit elements held before we are forced to
+// promote to compressed, regardless of the explicit threshold.
+#define MS_MAXEXPLICIT	(MS_MAXDATA / sizeof(uint64_t))
 
-static void
-explicit_to_compressed(multiset_t * msp)
+// Initial number of explicit elements allocated.
+#define MS_MINEXPLICIT	8
+
+// Number of distinct register values.
+#define MS_NREGVALS		256
+
+typedef struct
 {
-    // Make a copy of the explicit multiset.
-    multiset_t ms;
-    memcpy(&ms, msp, sizeof(ms));
+    size_t		ms_nbits;
+    size_t		ms_nregs;
+    size_t		ms_log2nregs;
+    int64		ms_expthresh;
+    bool		ms_sparseon;
 
-    // Clear the multiset.
-    memset(msp, '\0', sizeof(*msp));
+	uint64_t	ms_type;	// size is only for alignment.
 
-    // Restore the metadata.
-    copy_metadata(msp, &ms);
+    // The explicit elements or registers live in a separately
+    // allocated buffer which is sized to the contents and grown on
+    // demand.  It is (re)allocated in ms_mcxt.
+    //
+    // NOTE - Everything before ms_mcxt is the flat header that
+    // hll_serialize ships.
+    //
+    MemoryContext	ms_mcxt;
+    size_t			ms_bufsz;
 
-    // Make it MST_COMPRESSED.
-    msp->ms_type = MST_COMPRESSED;
+    union
+    {
+        // MST_EMPTY and MST_UNDEFINED don't need data.
+        //
+        // Each member leads with the buffer pointer so as_buf is
+        // valid whatever the type.
+        //
+        void *			as_buf;
+        ms_explicit_t	as_expl;	// MST_EXPLICIT
+        ms_sparse_t		as_sprs;	// MST_SPARSE
+        ms_compressed_t	as_comp;	// MST_COMPRESSED
 
-    // Add all the elements back into the compressed multiset.
-    compressed_explicit_union(msp, &ms);
-}
+    }		ms_data;
 
-static int
-element_compare(void const * ptr1, void const * ptr2)
-{
-    // We used signed integer comparison to be compatible
-    // with the java code.
+    // Elements waiting to be applied to large MST_COMPRESSED
+    // registers in a batch, see multiset_add_pending.
+    //
+    uint64_t *		ms_pending;
+    size_t			ms_npending;
 
-    int64_t v1 = * (int64_t const *) ptr1;
-    int64_t v2 = * (int64_t const *) ptr2;
+} multiset_t;
 
-    return (v1 < v2) ? -1 : (v1 > v2) ? 1 : 0;
+// Size of the flat multiset header.
+#define MS_HDRSZ		__builtin_offsetof(multiset_t, ms_mcxt)
+
+// Prepare a multiset whose data will be allocated in i_mcxt.
+//
+static void
+multiset_init(multiset_t * o_msp, MemoryContext i_mcxt)
+{
+    memset(o_msp, '\0', sizeof(*o_msp));
+    o_msp->ms_mcxt = i_mcxt;
 }
 
-static size_t numfilled(multiset_t const * i_msp)
+// Make sure the data buffer of a multiset holds at least i_size bytes.
+//
+static void
+multiset_reserve(multiset_t * o_msp, size_t i_size)
 {
-    ms_compressed_t const * mscp = &i_msp->ms_data.as_comp;
-    size_t nfilled = 0;
-    size_t nregs = i_msp->ms_nregs;
-    for (size_t ii = 0; ii < nregs; ++ii)
-        if (mscp->msc_regs[ii] > 0)
-            ++nfilled;
+    if (o_msp->ms_bufsz >= i_size)
+        return;
 
-    return nfilled;
+    if (o_msp->ms_data.as_buf == NULL)
+        o_msp->ms_data.as_buf = MemoryContextAlloc(o_msp->ms_mcxt, i_size);
+    else
+        o_msp->ms_data.as_buf = repalloc(o_msp->ms_data.as_buf, i_size);
+
+    o_msp->ms_bufsz = i_size;
 }
 
-static char *
-multiset_tostring(multiset_t const * i_msp)
+// Release the data buffer of a multiset.
+//
+static void
+multiset_release(multiset_t * o_msp)
 {
-    char expbuf[256];
-    char * retstr;
-    size_t len;
-    size_t used;
-    size_t nbits = i_msp->ms_nbits;
-    size_t nregs = i_msp->ms_nregs;
-    int64 expthresh = i_msp->ms_expthresh;
-    size_t sparseon = i_msp->ms_sparseon;
+    if (o_msp->ms_data.as_buf != NULL)
+        pfree(o_msp->ms_data.as_buf);
 
-    size_t expval = expthresh_value(expthresh, nbits, nregs);
+    o_msp->ms_data.as_buf = NULL;
+    o_msp->ms_bufsz = 0;
+}
 
-    // If the expthresh is set to -1 (auto) augment the value
-    // with the automatically determined value.
-    //
-    if (expthresh == -1)
-        snprintf(expbuf, sizeof(expbuf), "%ld(%ld)", expthresh, expval);
-    else
-        snprintf(expbuf, sizeof(expbuf), "%ld", expthresh);
+#ifdef __GNUC__
+#define HLL_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define HLL_ALWAYS_INLINE inline
+#endif
 
-    // Allocate an initial return buffer.
-    len = 1024;
-    retstr = (char *) palloc(len);
-    memset(retstr, '\0', len);
+// Values decoded per call of bitstream_decode by the batching loops;
+// a multiple of 8 so every batch starts on a byte boundary.
+#define MS_DECODE_BATCH		256
 
-    // We haven't used any return buffer yet.
-    used = 0;
+// Fetch the big-endian quadword at i_bitp.  When i_guard is set
+// anything at or past i_endp reads as zeros instead.
+//
+static HLL_ALWAYS_INLINE uint64_t
+bitstream_fetch(uint8_t const * i_bitp, uint8_t const * i_endp, bool i_guard)
+{
+    uint64_t qw;
 
-    // Print in a type-dependent way.
-    switch (i_msp->ms_type)
+    if (!i_guard || i_endp - i_bitp >= 8)
     {
-    case MST_EMPTY:
-        used += snprintf(retstr, len, "EMPTY, "
-                         "nregs=%ld, nbits=%ld, expthresh=%s, sparseon=%ld",
-                         nregs, nbits, expbuf, sparseon);
-        break;
-    case MST_EXPLICIT:
-        {
-            ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
-            size_t size = msep->mse_nelem;
-            char linebuf[1024];
-            ssize_t rv;
+        memcpy(&qw, i_bitp, sizeof(qw));
+        return hll_be64(qw);
+    }
 
-            used += snprintf(retstr, len, "EXPLICIT, %ld elements, "
-                             "nregs=%ld, nbits=%ld, "
-                             "expthresh=%s, sparseon=%ld:",
-                             size, nregs, nbits, expbuf, sparseon);
-            for (size_t ii = 0; ii < size; ++ii)
-            {
-                int64_t val = * (int64_t const *) & msep->mse_elems[ii];
-                rv = snprintf(linebuf, sizeof(linebuf),
-                              "\n%ld: %20" PRIi64 " ",
-                              ii, val);
-                // Do we need to reallocate the return buffer?
-                if (rv + used > len - 1)
-                {
-                    len += 1024;
-                    retstr = (char *) repalloc(retstr, len);
-                }
-                strncpy(&retstr[used], linebuf, len - used);
-                used += rv;
-            }
-        }
-        break;
-    case MST_COMPRESSED:
-        {
-            ms_compressed_t const * mscp = &i_msp->ms_data.as_comp;
+    qw = 0;
+    for (size_t kk = 0; kk < 8; ++kk)
+        qw = (qw << 8) | (&i_bitp[kk] < i_endp ? i_bitp[kk] : 0);
+    return qw;
+}
 
-            char linebuf[1024];
+// Decode the group of eight i_nbits values that starts at i_bitp.
+// Eight values always take exactly i_nbits bytes, so every shift
+// below is a constant once i_nbits is.  The eight values are spelled
+// out because compilers won't reliably unroll the loop at -O2.
+//
+static HLL_ALWAYS_INLINE void
+bitstream_decode_group(uint32_t * o_vals,
+                       uint8_t const * i_bitp,
+                       uint8_t const * i_endp,
+                       size_t i_nbits,
+                       bool i_guard)
+{
+    if (i_nbits <= 8)
+    {
+        // The whole group fits in one quadword.
+        uint64_t qw = bitstream_fetch(i_bitp, i_endp, i_guard);
+
+#define BITSTREAM_GROUP_VAL(KK)												\
+        o_vals[KK] = (uint32_t) ((qw << ((KK) * i_nbits)) >> (64 - i_nbits))
+
+        BITSTREAM_GROUP_VAL(0);
+        BITSTREAM_GROUP_VAL(1);
+        BITSTREAM_GROUP_VAL(2);
+        BITSTREAM_GROUP_VAL(3);
+        BITSTREAM_GROUP_VAL(4);
+        BITSTREAM_GROUP_VAL(5);
+        BITSTREAM_GROUP_VAL(6);
+        BITSTREAM_GROUP_VAL(7);
+
+#undef BITSTREAM_GROUP_VAL
+    }
+    else
+    {
+#define BITSTREAM_GROUP_VAL(KK)												\
+        o_vals[KK] = (uint32_t)												\
+            ((bitstream_fetch(&i_bitp[(KK) * i_nbits / 8], i_endp, i_guard)	\
+              << ((KK) * i_nbits % 8)) >> (64 - i_nbits))
+
+        BITSTREAM_GROUP_VAL(0);
+        BITSTREAM_GROUP_VAL(1);
+        BITSTREAM_GROUP_VAL(2);
+        BITSTREAM_GROUP_VAL(3);
+        BITSTREAM_GROUP_VAL(4);
+        BITSTREAM_GROUP_VAL(5);
+        BITSTREAM_GROUP_VAL(6);
+        BITSTREAM_GROUP_VAL(7);
+
+#undef BITSTREAM_GROUP_VAL
+    }
+}
 
-            size_t rowsz = 32;
-            size_t nrows = nregs / rowsz;
-            size_t ndx = 0;
+static HLL_ALWAYS_INLINE void
+bitstream_decode_width(uint32_t * o_vals,
+                       size_t i_nvals,
+                       uint8_t const * i_bitp,
+                       size_t i_size,
+                       size_t i_nbits)
+{
+    uint8_t const * endp = &i_bitp[i_size];
+    size_t ngroups = i_nvals / 8;
+    size_t nrest = i_nvals % 8;
+    size_t nfast;
+    size_t gg;
+
+    // A group reads at most i_nbits + 8 bytes from its start; only
+    // the groups near the end of the stream need to be careful.
+    nfast = i_size >= i_nbits + 8 ? (i_size - 8) / i_nbits : 0;
+    nfast = Min(nfast, ngroups);
+
+    for (gg = 0; gg < nfast; ++gg)
+        bitstream_decode_group(&o_vals[gg * 8], &i_bitp[gg * i_nbits],
+                               endp, i_nbits, false);
+
+    for (; gg < ngroups; ++gg)
+        bitstream_decode_group(&o_vals[gg * 8], &i_bitp[gg * i_nbits],
+                               endp, i_nbits, true);
+
+    if (nrest != 0)
+    {
+        uint32_t vals[8];
 
-            used += snprintf(retstr, len,
-                             "COMPRESSED, %ld filled "
-                             "nregs=%ld, nbits=%ld, expthresh=%s, "
-                             "sparseon=%ld:",
-                             numfilled(i_msp),
-                             nregs, nbits, expbuf, sparseon);
+        bitstream_decode_group(vals, &i_bitp[ngroups * i_nbits],
+                               endp, i_nbits, true);
+        memcpy(&o_vals[ngroups * 8], vals, nrest * sizeof(uint32_t));
+    }
+}
 
-            for (size_t rr = 0; rr < nrows; ++rr)
-            {
-                size_t pos = 0;
-                pos = snprintf(linebuf, sizeof(linebuf), "\n%4ld: ", ndx);
-                for (size_t cc = 0; cc < rowsz; ++cc)
-                {
-                    pos += snprintf(&linebuf[pos], sizeof(linebuf) - pos,
-                                    "%2d ", mscp->msc_regs[ndx]);
-                    ++ndx;
-                }
+// Decode i_nvals values of i_nbits bits each (1 to 32) from the front
+// of an MSB first bitstream of i_size bytes.  Each width gets its own
+// straight-line decoder; bits past the end of the stream read as
+// zeros.
+//
+static void
+bitstream_decode(uint32_t * o_vals,
+                 size_t i_nvals,
+                 uint8_t const * i_bitp,
+                 size_t i_size,
+                 size_t i_nbits)
+{
+#define BITSTREAM_DECODE_CASE(NBITS)							\
+    case NBITS:													\
+        bitstream_decode_width(o_vals, i_nvals, i_bitp, i_size, NBITS); \
+        break
+
+    switch (i_nbits)
+    {
+        BITSTREAM_DECODE_CASE(1);
+        BITSTREAM_DECODE_CASE(2);
+        BITSTREAM_DECODE_CASE(3);
+        BITSTREAM_DECODE_CASE(4);
+        BITSTREAM_DECODE_CASE(5);
+        BITSTREAM_DECODE_CASE(6);
+        BITSTREAM_DECODE_CASE(7);
+        BITSTREAM_DECODE_CASE(8);
+        BITSTREAM_DECODE_CASE(9);
+        BITSTREAM_DECODE_CASE(10);
+        BITSTREAM_DECODE_CASE(11);
+        BITSTREAM_DECODE_CASE(12);
+        BITSTREAM_DECODE_CASE(13);
+        BITSTREAM_DECODE_CASE(14);
+        BITSTREAM_DECODE_CASE(15);
+        BITSTREAM_DECODE_CASE(16);
+        BITSTREAM_DECODE_CASE(17);
+        BITSTREAM_DECODE_CASE(18);
+        BITSTREAM_DECODE_CASE(19);
+        BITSTREAM_DECODE_CASE(20);
+        BITSTREAM_DECODE_CASE(21);
+        BITSTREAM_DECODE_CASE(22);
+        BITSTREAM_DECODE_CASE(23);
+        BITSTREAM_DECODE_CASE(24);
+        BITSTREAM_DECODE_CASE(25);
+        BITSTREAM_DECODE_CASE(26);
+        BITSTREAM_DECODE_CASE(27);
+        BITSTREAM_DECODE_CASE(28);
+        BITSTREAM_DECODE_CASE(29);
+        BITSTREAM_DECODE_CASE(30);
+        BITSTREAM_DECODE_CASE(31);
+        BITSTREAM_DECODE_CASE(32);
 
-                // Do we need to reallocate the return buffer?
-                if (pos + used > len - 1)
-                {
-                    len += 1024;
-                    retstr = (char *) repalloc(retstr, len);
-                }
-                strncpy(&retstr[used], linebuf, len - used);
-                used += pos;
-            }
-        }
-        break;
-    case MST_UNDEFINED:
-        used += snprintf(retstr, len, "UNDEFINED "
-                         "nregs=%ld, nbits=%ld, expthresh=%s, sparseon=%ld",
-                         nregs, nbits, expbuf, sparseon);
-        break;
     default:
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("unexpected multiset type value")));
+                 errmsg("unsupported bitstream width %d", (int) i_nbits)));
         break;
     }
 
-    return retstr;
+#undef BITSTREAM_DECODE_CASE
 }
 
-static void
-explicit_validate(multiset_t const * i_msp, ms_explicit_t const * i_msep)
+static HLL_ALWAYS_INLINE void
+compressed_decode_width(compreg_t * o_regp,
+                        size_t i_nregs,
+                        uint8_t const * i_bitp,
+                        size_t i_size,
+                        size_t i_width)
 {
-    // Allow explicit multisets with no elements.
-    if (i_msep->mse_nelem == 0)
-        return;
+    uint8_t const * endp = &i_bitp[i_size];
+    size_t ngroups = i_nregs / 8;
+    size_t nfast;
+    uint32_t vals[8];
+    size_t gg;
 
-    // Confirm that all elements are ascending with no duplicates.
-    for (int ii = 0; ii < i_msep->mse_nelem - 1; ++ii)
+    nfast = i_size >= i_width + 8 ? (i_size - 8) / i_width : 0;
+    nfast = Min(nfast, ngroups);
+
+    for (gg = 0; gg < nfast; ++gg)
     {
-        if (element_compare(&i_msep->mse_elems[ii],
-                            &i_msep->mse_elems[ii + 1]) != -1)
-        {
-            char * buf = multiset_tostring(i_msp);
+        uint64_t regs;
+
+        // Assemble the eight registers and store them at once.
+        bitstream_decode_group(vals, &i_bitp[gg * i_width], endp, i_width,
+                               false);
+        regs = ((uint64_t) vals[0] <<  0) | ((uint64_t) vals[1] <<  8) |
+            ((uint64_t) vals[2] << 16) | ((uint64_t) vals[3] << 24) |
+            ((uint64_t) vals[4] << 32) | ((uint64_t) vals[5] << 40) |
+            ((uint64_t) vals[6] << 48) | ((uint64_t) vals[7] << 56);
+        regs = hll_le64(regs);
+        memcpy(&o_regp[gg * 8], &regs, sizeof(regs));
+    }
 
-            ereport(ERROR,
-                    (errcode(ERRCODE_DATA_EXCEPTION),
-                     errmsg("duplicate or descending explicit elements: %s",
-                            buf)));
+    for (; gg * 8 < i_nregs; ++gg)
+    {
+        bitstream_decode_group(vals, &i_bitp[gg * i_width], endp, i_width,
+                               true);
+        for (size_t kk = 0; kk < 8 && gg * 8 + kk < i_nregs; ++kk)
+            o_regp[gg * 8 + kk] = vals[kk];
+    }
+}
 
-            pfree(buf);
-        }
+#ifdef HAVE_X86_64_KERNELS
+
+// Are the BMI2 coders worth using?  -1 until we've looked.
+static int g_use_bmi2 = -1;
+
+// PDEP and PEXT are microcoded, and much slower than the plain
+// coders, on AMD processors before Zen 3; only trust them on Intel.
+//
+static bool
+use_bmi2(void)
+{
+    if (g_use_bmi2 < 0)
+    {
+        __builtin_cpu_init();
+        g_use_bmi2 = __builtin_cpu_supports("bmi2") &&
+            __builtin_cpu_is("intel");
     }
+
+    return g_use_bmi2;
 }
 
-static void
-multiset_add(multiset_t * o_msp, uint64_t element)
+// With BMI2 a single PDEP spreads a group of eight registers into
+// eight bytes, whatever the width.  Only the groups that can be
+// fetched without reading past the end are decoded; returns how many
+// registers that was.
+//
+__attribute__((target("bmi2")))
+static size_t
+compressed_decode_pdep(compreg_t * o_regp,
+                       size_t i_nregs,
+                       uint8_t const * i_bitp,
+                       size_t i_size,
+                       size_t i_width)
 {
-    // WARNING!  This routine can change the type of the multiset!
+    uint64_t mask = ((1ULL << i_width) - 1) * 0x0101010101010101ULL;
+    size_t nfast;
 
-    size_t expval = expthresh_value(o_msp->ms_expthresh,
-                                    o_msp->ms_nbits,
-                                    o_msp->ms_nregs);
+    nfast = i_size >= i_width + 8 ? (i_size - 8) / i_width : 0;
+    nfast = Min(nfast, i_nregs / 8);
 
-    switch (o_msp->ms_type)
+    for (size_t gg = 0; gg < nfast; ++gg)
     {
-    case MST_EMPTY:
-        // Are we forcing compressed?
-        if (expval == 0)
-        {
-            // Now we're explicit with no elements.
-            o_msp->ms_type = MST_EXPLICIT;
-            o_msp->ms_data.as_expl.mse_nelem = 0;
+        uint64_t qw = bitstream_fetch(&i_bitp[gg * i_width], NULL, false);
 
-            // Convert it to compressed.
-            explicit_to_compressed(o_msp);
+        // The first register is in the high bits, so it comes out in
+        // the high byte and the quadword is stored big-endian.
+        uint64_t regs = hll_be64(_pdep_u64(qw >> (64 - 8 * i_width), mask));
+        memcpy(&o_regp[gg * 8], &regs, sizeof(regs));
+    }
 
-            // Add the element in compressed format.
-            compressed_add(o_msp, element);
-        }
-        else
-        {
-            // Now we're explicit with one element.
-            o_msp->ms_type = MST_EXPLICIT;
-            o_msp->ms_data.as_expl.mse_nelem = 1;
-            o_msp->ms_data.as_expl.mse_elems[0] = element;
-        }
-        break;
+    return nfast * 8;
+}
 
-    case MST_EXPLICIT:
-        {
-            ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+#endif // HAVE_X86_64_KERNELS
 
-            // If the element is already in the set we're done.
-            if (bsearch(&element,
-                        msep->mse_elems,
-                        msep->mse_nelem,
-                        sizeof(uint64_t),
-                        element_compare))
-                return;
+// Decode i_nregs registers of i_width bits each (1 to 8) from the
+// front of a compressed bitstream of i_size bytes.  This is
+// bitstream_decode writing registers instead of 32-bit values.
+//
+static void
+compressed_decode(compreg_t * o_regp,
+                  size_t i_nregs,
+                  uint8_t const * i_bitp,
+                  size_t i_size,
+                  size_t i_width)
+{
+    // Eight bit registers are the bytes themselves.
+    if (i_width == 8)
+    {
+        size_t ncopy = Min(i_nregs, i_size);
 
-            // Is the explicit multiset full?
-            if (msep->mse_nelem == expval)
-            {
-                // Convert it to compressed.
-                explicit_to_compressed(o_msp);
+        memcpy(o_regp, i_bitp, ncopy);
+        memset(&o_regp[ncopy], '\0', i_nregs - ncopy);
+        return;
+    }
 
-                // Add the element in compressed format.
-                compressed_add(o_msp, element);
-            }
-            else
-            {
-                // Add the element at the end.
-                msep->mse_elems[msep->mse_nelem++] = element;
-
-                // Resort the elements.
-                qsort(msep->mse_elems,
-                      msep->mse_nelem,
-                      sizeof(uint64_t),
-                      element_compare);
-            }
-        }
-        break;
+#ifdef HAVE_X86_64_KERNELS
+    if (use_bmi2() && i_width >= 1 && i_width <= 8)
+    {
+        size_t ndone = compressed_decode_pdep(o_regp, i_nregs,
+                                              i_bitp, i_size, i_width);
+        size_t offset = ndone / 8 * i_width;
+
+        o_regp += ndone;
+        i_nregs -= ndone;
+        i_bitp += offset;
+        i_size -= offset;
+    }
+#endif
 
-    case MST_COMPRESSED:
-        compressed_add(o_msp, element);
-        break;
+#define COMPRESSED_DECODE_CASE(WIDTH)							\
+    case WIDTH:													\
+        compressed_decode_width(o_regp, i_nregs, i_bitp, i_size, WIDTH); \
+        break
 
-    case MST_UNDEFINED:
-        // Result is unchanged.
-        break;
+    switch (i_width)
+    {
+        COMPRESSED_DECODE_CASE(1);
+        COMPRESSED_DECODE_CASE(2);
+        COMPRESSED_DECODE_CASE(3);
+        COMPRESSED_DECODE_CASE(4);
+        COMPRESSED_DECODE_CASE(5);
+        COMPRESSED_DECODE_CASE(6);
+        COMPRESSED_DECODE_CASE(7);
+        COMPRESSED_DECODE_CASE(8);
 
     default:
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type value #1")));
+                 errmsg("unsupported register width %d", (int) i_width)));
         break;
     }
+
+#undef COMPRESSED_DECODE_CASE
 }
 
 static void
-explicit_union(multiset_t * o_msp, ms_explicit_t const * i_msep)
+compressed_unpack(compreg_t * i_regp,
+                  size_t i_width,
+                  size_t i_nregs,
+                  uint8_t const * i_bitp,
+                  size_t i_size,
+                  uint8_t i_vers)
 {
-    // NOTE - This routine is optimized to add a batch of elements;
-    // it doesn't resort until they are all added ...
-    //
-    // WARNING!  This routine can change the type of the target multiset!
-
-    size_t expval = expthresh_value(o_msp->ms_expthresh,
-                                    o_msp->ms_nbits,
-                                    o_msp->ms_nregs);
-
-    ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+    size_t bitsz;
+    size_t padsz;
 
-    // Note the starting size of the target set.
-    size_t orig_nelem = msep->mse_nelem;
+    bitsz = i_width * i_nregs;
 
-    for (size_t ii = 0; ii < i_msep->mse_nelem; ++ii)
-    {
-        uint64_t element = i_msep->mse_elems[ii];
+    // Fail fast if the compressed array isn't big enough.
+    if (i_size * 8 < bitsz)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("compressed hll argument not large enough")));
 
-        switch (o_msp->ms_type)
-        {
-        case MST_EXPLICIT:
-            if (bsearch(&element,
-                        msep->mse_elems,
-                        orig_nelem,
-                        sizeof(uint64_t),
-                        element_compare))
-                continue;
+    padsz = i_size * 8 - bitsz;
 
-            if (msep->mse_nelem < expval)
-            {
-                // Add the element at the end.
-                msep->mse_elems[msep->mse_nelem++] = element;
-            }
-            else
-            {
-                // Convert it to compressed.
-                explicit_to_compressed(o_msp);
+    // Fail fast if the pad size doesn't make sense.
+    if (padsz >= 8)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistent padding in compressed hll argument")));
 
-                // Add the element in compressed format.
-                compressed_add(o_msp, element);
-            }
-            break;
+    compressed_decode(i_regp, i_nregs, i_bitp, i_size, i_width);
+}
 
-        case MST_COMPRESSED:
-            compressed_add(o_msp, element);
-            break;
-        }
+// Like compressed_unpack, but raises each register to the decoded
+// value instead of overwriting it.  The caller has already checked
+// the size of the bitstream.
+//
+static void
+compressed_unpack_max(compreg_t * o_regp,
+                      size_t i_width,
+                      size_t i_nregs,
+                      uint8_t const * i_bitp,
+                      size_t i_size)
+{
+    // Byte wide registers are raised straight from the bitstream.
+    if (i_width == 8)
+    {
+        register_max(o_regp, i_bitp, i_nregs);
+        return;
     }
 
-    // If the target multiset is still explicit it needs to be
-    // resorted.
-    if (o_msp->ms_type == MST_EXPLICIT)
+    for (size_t ndx = 0; ndx < i_nregs; ndx += MS_DECODE_BATCH)
     {
-        // Resort the elements.
-        qsort(msep->mse_elems,
-              msep->mse_nelem,
-              sizeof(uint64_t),
-              element_compare);
+        size_t nvals = Min(MS_DECODE_BATCH, i_nregs - ndx);
+        size_t offset = ndx / 8 * i_width;
+        compreg_t regs[MS_DECODE_BATCH];
+
+        compressed_decode(regs, nvals, &i_bitp[offset], i_size - offset,
+                          i_width);
+        register_max(&o_regp[ndx], regs, nvals);
     }
 }
 
-static void unpack_header(multiset_t * o_msp,
-                          uint8_t const * i_bitp,
-                          uint8_t vers,
-                          uint8_t type)
+static void
+sparse_unpack(compreg_t * i_regp,
+              size_t i_width,
+              size_t i_log2nregs,
+              size_t i_nfilled,
+              uint8_t const * i_bitp,
+              size_t i_size)
 {
-    o_msp->ms_nbits = (i_bitp[1] >> 5) + 1;
-    o_msp->ms_log2nregs = i_bitp[1] & 0x1f;
-    o_msp->ms_nregs = 1 <<  o_msp->ms_log2nregs;
-    o_msp->ms_expthresh = decode_expthresh(i_bitp[2] & 0x3f);
-    o_msp->ms_sparseon = (i_bitp[2] >> 6) & 0x1;
-}
+    size_t bitsz;
+    size_t padsz;
+    size_t chunksz;
+    uint32_t regmask;
 
-static uint8_t
-multiset_unpack(multiset_t * o_msp,
-                uint8_t const * i_bitp,
-                size_t i_size,
-                uint8_t * o_encoded_type)
-{
-    // First byte is the version and type header.
-    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
-    uint8_t type = i_bitp[0] & 0xf;
+    chunksz = i_log2nregs + i_width;
+    bitsz = chunksz * i_nfilled;
+    padsz = i_size * 8 - bitsz;
 
-    if (vers != 1)
+    // Fail fast if the pad size doesn't make sense.
+    if (padsz >= 8)
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("unknown schema version %d", (int) vers)));
-
-    if (o_encoded_type != NULL)
-        *o_encoded_type = type;
+                 errmsg("inconsistent padding in sparse hll argument")));
 
-    // Set the type. NOTE - MST_SPARSE are converted to MST_COMPRESSED.
-    o_msp->ms_type = (type == MST_SPARSE) ? MST_COMPRESSED : type;
+    regmask = (1 << i_width) - 1;
 
-    switch (type)
+    for (size_t ii = 0; ii < i_nfilled; ii += MS_DECODE_BATCH)
     {
-    case MST_EMPTY:
-        if (vers == 1)
-        {
-            size_t hdrsz = 3;
-
-            // Make sure the size is consistent.
-            if (i_size != hdrsz)
-            {
-                ereport(ERROR,
-                        (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("inconsistently sized empty multiset")));
-            }
+        size_t nvals = Min(MS_DECODE_BATCH, i_nfilled - ii);
+        size_t offset = ii / 8 * chunksz;
+        uint32_t chunks[MS_DECODE_BATCH];
 
-            unpack_header(o_msp, i_bitp, vers, type);
-        }
-        else
+        bitstream_decode(chunks, nvals, &i_bitp[offset], i_size - offset,
+                         chunksz);
+        for (size_t jj = 0; jj < nvals; ++jj)
         {
-            ereport(ERROR,
-                    (errcode(ERRCODE_DATA_EXCEPTION),
-                     errmsg("unsupported empty version %d",
-                            (int) vers)));
-        }
+            uint32_t val = chunks[jj] & regmask;
+            uint32_t ndx = chunks[jj] >> i_width;
 
-        break;
+            // With chunks narrower than a byte the padding can hold a
+            // whole chunk of zeros, which must not clear register 0.
+            if (val != 0)
+                i_regp[ndx] = val;
+        }
+    }
+}
 
-    case MST_EXPLICIT:
-        if (vers == 1)
-        {
-            ms_explicit_t * msep = &o_msp->ms_data.as_expl;
-            size_t hdrsz = 3;
-            size_t nelem = (i_size - hdrsz) / 8;
-            size_t ndx = hdrsz;
+typedef struct
+{
+    size_t			bwc_nbits;	// Write size.
+    uint8_t *		bwc_curp;	// Next byte.
+    uint64_t		bwc_acc;	// Bits not yet written ...
+    size_t			bwc_used;	// ... and how many there are.
 
-            // Make sure the size is consistent.
-            if (((i_size - hdrsz) % 8) != 0)
-            {
-                ereport(ERROR,
-                        (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("inconsistently sized explicit multiset")));
-            }
+} bitstream_write_cursor_t;
 
-            // Make sure the explicit array fits in memory.
-            if ((i_size - hdrsz) > MS_MAXDATA)
-            {
-                ereport(ERROR,
-                        (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("explicit multiset too large")));
-            }
+// Append a value to the bitstream.  Values collect in a quadword
+// and go out 32 bits at a time; bitstream_flush writes the rest.
+//
+static HLL_ALWAYS_INLINE void
+bitstream_pack(bitstream_write_cursor_t * bwcp, uint32_t val)
+{
+    bwcp->bwc_acc = (bwcp->bwc_acc << bwcp->bwc_nbits) | val;
+    bwcp->bwc_used += bwcp->bwc_nbits;
 
-            unpack_header(o_msp, i_bitp, vers, type);
+    if (bwcp->bwc_used >= 32)
+    {
+        uint32_t word;
 
-            msep->mse_nelem = nelem;
-            for (size_t ii = 0; ii < nelem; ++ii)
-            {
-                uint64_t val = 0;
-                val |= ((uint64_t) i_bitp[ndx++] << 56);
-                val |= ((uint64_t) i_bitp[ndx++] << 48);
-                val |= ((uint64_t) i_bitp[ndx++] << 40);
-                val |= ((uint64_t) i_bitp[ndx++] << 32);
-                val |= ((uint64_t) i_bitp[ndx++] << 24);
-                val |= ((uint64_t) i_bitp[ndx++] << 16);
-                val |= ((uint64_t) i_bitp[ndx++] <<  8);
-                val |= ((uint64_t) i_bitp[ndx++] <<  0);
-                msep->mse_elems[ii] = val;
-            }
+        bwcp->bwc_used -= 32;
+        word = hll_be32((uint32_t) (bwcp->bwc_acc >> bwcp->bwc_used));
+        memcpy(bwcp->bwc_curp, &word, sizeof(word));
+        bwcp->bwc_curp += 4;
+    }
+}
 
-            explicit_validate(o_msp, msep);
-        }
-        else
-        {
-            ereport(ERROR,
-                    (errcode(ERRCODE_DATA_EXCEPTION),
-                     errmsg("unsupported explicit version %d",
-                            (int) vers)));
-        }
-        break;
+// Write whatever bitstream_pack has left over, padding the last
+// byte with zeros.
+//
+static void
+bitstream_flush(bitstream_write_cursor_t * bwcp)
+{
+    while (bwcp->bwc_used >= 8)
+    {
+        bwcp->bwc_used -= 8;
+        *bwcp->bwc_curp++ = (uint8_t) (bwcp->bwc_acc >> bwcp->bwc_used);
+    }
 
-    case MST_COMPRESSED:
-        if (vers == 1)
-        {
+    if (bwcp->bwc_used > 0)
+    {
+        *bwcp->bwc_curp++ = (uint8_t) (bwcp->bwc_acc << (8 - bwcp->bwc_used));
+        bwcp->bwc_used = 0;
+    }
+}
+
+static void
+bitstream_write_init(bitstream_write_cursor_t * bwcp,
+                     uint8_t * o_bitp,
+                     size_t i_nbits)
+{
+    bwcp->bwc_nbits = i_nbits;
+    bwcp->bwc_curp = o_bitp;
+    bwcp->bwc_acc = 0;
+    bwcp->bwc_used = 0;
+}
+
+// Encode each group of eight registers into exactly i_width bytes,
+// the inverse of compressed_decode_width.  The registers that don't
+// make up a whole group go through bitstream_pack.
+//
+static HLL_ALWAYS_INLINE void
+compressed_encode_width(uint8_t * o_bitp,
+                        compreg_t const * i_regp,
+                        size_t i_nregs,
+                        size_t i_width)
+{
+    size_t ngroups = i_nregs / 8;
+    bitstream_write_cursor_t bwc;
+
+    for (size_t gg = 0; gg < ngroups; ++gg)
+    {
+        compreg_t const * regp = &i_regp[gg * 8];
+        uint64_t qw;
+
+        qw = ((uint64_t) regp[0] << (64 - 1 * i_width)) |
+            ((uint64_t) regp[1] << (64 - 2 * i_width)) |
+            ((uint64_t) regp[2] << (64 - 3 * i_width)) |
+            ((uint64_t) regp[3] << (64 - 4 * i_width)) |
+            ((uint64_t) regp[4] << (64 - 5 * i_width)) |
+            ((uint64_t) regp[5] << (64 - 6 * i_width)) |
+            ((uint64_t) regp[6] << (64 - 7 * i_width)) |
+            ((uint64_t) regp[7] << (64 - 8 * i_width));
+        qw = hll_be64(qw);
+        memcpy(&o_bitp[gg * i_width], &qw, i_width);
+    }
+
+    bitstream_write_init(&bwc, &o_bitp[ngroups * i_width], i_width);
+    for (size_t ndx = ngroups * 8; ndx < i_nregs; ++ndx)
+        bitstream_pack(&bwc, i_regp[ndx]);
+    bitstream_flush(&bwc);
+}
+
+#ifdef HAVE_X86_64_KERNELS
+
+// With BMI2 a single PEXT gathers the eight registers of a group out
+// of their bytes.  Only the groups with room for a whole quadword
+// store after them are encoded; returns how many registers that was.
+//
+__attribute__((target("bmi2")))
+static size_t
+compressed_encode_pext(uint8_t * o_bitp,
+                       compreg_t const * i_regp,
+                       size_t i_nregs,
+                       size_t i_size,
+                       size_t i_width)
+{
+    uint64_t mask = ((1ULL << i_width) - 1) * 0x0101010101010101ULL;
+    size_t nfast;
+
+    nfast = i_size >= 8 ? (i_size - 8) / i_width : 0;
+    nfast = Min(nfast, i_nregs / 8);
+
+    for (size_t gg = 0; gg < nfast; ++gg)
+    {
+        uint64_t regs;
+        uint64_t qw;
+
+        // Put the first register in the high byte so it comes out
+        // in the high bits.
+        memcpy(&regs, &i_regp[gg * 8], sizeof(regs));
+        qw = _pext_u64(hll_be64(regs), mask) << (64 - 8 * i_width);
+
+        // The bytes after this group's are rewritten by the next.
+        qw = hll_be64(qw);
+        memcpy(&o_bitp[gg * i_width], &qw, sizeof(qw));
+    }
+
+    return nfast * 8;
+}
+
+#endif // HAVE_X86_64_KERNELS
+
+// Encode i_nregs registers of i_width bits each (1 to 8) into the
+// i_size bytes at o_bitp, the inverse of compressed_decode.
+//
+static void
+compressed_encode(uint8_t * o_bitp,
+                  compreg_t const * i_regp,
+                  size_t i_nregs,
+                  size_t i_size,
+                  size_t i_width)
+{
+    // Eight bit registers are stored as the bytes themselves.
+    if (i_width == 8)
+    {
+        memcpy(o_bitp, i_regp, i_nregs);
+        return;
+    }
+
+#ifdef HAVE_X86_64_KERNELS
+    if (use_bmi2() && i_width >= 1 && i_width <= 8)
+    {
+        size_t ndone = compressed_encode_pext(o_bitp, i_regp, i_nregs,
+                                              i_size, i_width);
+        size_t offset = ndone / 8 * i_width;
+
+        o_bitp += offset;
+        i_regp += ndone;
+        i_nregs -= ndone;
+    }
+#endif
+
+#define COMPRESSED_ENCODE_CASE(WIDTH)							\
+    case WIDTH:													\
+        compressed_encode_width(o_bitp, i_regp, i_nregs, WIDTH);	\
+        break
+
+    switch (i_width)
+    {
+        COMPRESSED_ENCODE_CASE(1);
+        COMPRESSED_ENCODE_CASE(2);
+        COMPRESSED_ENCODE_CASE(3);
+        COMPRESSED_ENCODE_CASE(4);
+        COMPRESSED_ENCODE_CASE(5);
+        COMPRESSED_ENCODE_CASE(6);
+        COMPRESSED_ENCODE_CASE(7);
+        COMPRESSED_ENCODE_CASE(8);
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("unsupported register width %d", (int) i_width)));
+        break;
+    }
+
+#undef COMPRESSED_ENCODE_CASE
+}
+
+static void
+compressed_pack(compreg_t const * i_regp,
+                size_t i_width,
+                size_t i_nregs,
+                uint8_t * o_bitp,
+                size_t i_size,
+                uint8_t i_vers)
+{
+    size_t bitsz;
+    size_t padsz;
+
+    bitsz = i_width * i_nregs;
+
+    // Fail fast if the compressed array isn't big enough.
+    if (i_size * 8 < bitsz)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("compressed output buffer not large enough")));
+
+    padsz = i_size * 8 - bitsz;
+
+    // Fail fast if the pad size doesn't make sense.
+    if (padsz >= 8)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistent compressed output pad size")));
+
+    compressed_encode(o_bitp, i_regp, i_nregs, i_size, i_width);
+}
+
+static void
+sparse_pack(compreg_t const * i_regp,
+            size_t i_width,
+            size_t i_nregs,
+            size_t i_log2nregs,
+            size_t i_nfilled,
+            uint8_t * o_bitp,
+            size_t i_size)
+{
+    size_t bitsz;
+    size_t padsz;
+    size_t ndx;
+
+    bitstream_write_cursor_t bwc;
+
+    bitsz = i_nfilled * (i_log2nregs + i_width);
+
+    // Fail fast if the compressed array isn't big enough.
+    if (i_size * 8 < bitsz)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("sparse output buffer not large enough")));
+
+    padsz = i_size * 8 - bitsz;
+
+    // Fail fast if the pad size doesn't make sense.
+    if (padsz >= 8)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistent sparse output pad size")));
+
+    bitstream_write_init(&bwc, o_bitp, i_log2nregs + i_width);
+
+    // Look at the registers eight at a time and visit only the
+    // non-zero ones, lowest index (byte) first.
+    for (ndx = 0; ndx + 8 <= i_nregs; ndx += 8)
+    {
+        uint64_t regs;
+
+        memcpy(&regs, &i_regp[ndx], sizeof(regs));
+        regs = hll_le64(regs);
+        while (regs != 0)
+        {
+            size_t kk = __builtin_ctzll(regs) / 8;
+
+            bitstream_pack(&bwc, ((ndx + kk) << i_width) | i_regp[ndx + kk]);
+            regs &= ~(0xffULL << (kk * 8));
+        }
+    }
+
+    for (; ndx < i_nregs; ++ndx)
+    {
+        if (i_regp[ndx] != 0)
+        {
+            uint32_t buffer = (ndx << i_width) | i_regp[ndx];
+            bitstream_pack(&bwc, buffer);
+        }
+    }
+
+    bitstream_flush(&bwc);
+}
+
+static void
+check_metadata(multiset_t const * i_omp, multiset_t const * i_imp)
+{
+    if (i_omp->ms_nbits != i_imp->ms_nbits)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("register width does not match: "
+                        "source uses %ld and dest uses %ld",
+                        i_imp->ms_nbits, i_omp->ms_nbits)));
+    }
+
+    if (i_omp->ms_nregs != i_imp->ms_nregs)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("register count does not match: "
+                        "source uses %ld and dest uses %ld",
+                        i_imp->ms_nregs, i_omp->ms_nregs)));
+    }
+
+    // Don't need to compare log2nregs because we compared nregs ...
+
+    if (i_omp->ms_expthresh != i_imp->ms_expthresh)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("explicit threshold does not match: "
+                        "source uses %ld and dest uses %ld",
+                        i_imp->ms_expthresh, i_omp->ms_expthresh)));
+    }
+
+    if (i_omp->ms_sparseon != i_imp->ms_sparseon)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("sparse enable does not match: "
+                        "source uses %d and dest uses %d",
+                        i_imp->ms_sparseon, i_omp->ms_sparseon)));
+    }
+}
+
+static void
+copy_metadata(multiset_t * o_msp, multiset_t const * i_msp)
+{
+    o_msp->ms_nbits = i_msp->ms_nbits;
+    o_msp->ms_nregs = i_msp->ms_nregs;
+    o_msp->ms_log2nregs = i_msp->ms_log2nregs;
+    o_msp->ms_expthresh = i_msp->ms_expthresh;
+    o_msp->ms_sparseon = i_msp->ms_sparseon;
+}
+
+// Map an element to its register index and value.
+//
+static inline compreg_t
+element_register(multiset_t const * i_msp, uint64_t elem, size_t * o_ndx)
+{
+    size_t nbits = i_msp->ms_nbits;
+    size_t nregs = i_msp->ms_nregs;
+    size_t log2nregs = i_msp->ms_log2nregs;
+
+    uint64_t mask = nregs - 1;
+
+    size_t maxregval = (1 << nbits) - 1;
+
+    uint64_t ss_val = elem >> log2nregs;
+
+    size_t p_w = ss_val == 0 ? 0 : __builtin_ctzll(ss_val) + 1;
+
+    if (p_w > maxregval)
+        p_w = maxregval;
+
+    *o_ndx = elem & mask;
+
+    return p_w;
+}
+
+// The registers of an MST_COMPRESSED multiset are followed in their
+// buffer by a histogram of (1 << nbits) counters, the number of
+// registers holding each value.  It gives the filled register count
+// and the estimators' sums without a pass over the registers.
+//
+// Raising one register at a time keeps the histogram current.  The
+// bulk merges and unpacking clear msc_histok instead, and the next
+// reader recounts.
+//
+#define MS_HISTOFF(nregs)	MAXALIGN((nregs) * sizeof(compreg_t))
+
+// Size of the buffer of an MST_COMPRESSED multiset.
+//
+static size_t
+compressed_bufsz(multiset_t const * i_msp)
+{
+    return MS_HISTOFF(i_msp->ms_nregs) +
+        ((size_t) 1 << i_msp->ms_nbits) * sizeof(uint32_t);
+}
+
+static inline uint32_t *
+compressed_hist(multiset_t const * i_msp)
+{
+    return (uint32_t *) ((char *) i_msp->ms_data.as_comp.msc_regs +
+                         MS_HISTOFF(i_msp->ms_nregs));
+}
+
+// The register histogram of an MST_COMPRESSED multiset, recounted
+// first if it isn't current.
+//
+// NOTE - The histogram is a cache, so this refreshes it even through
+// a const multiset.  Instances of the recount with nregs and regwidth
+// as constants were tried and ran no faster; the loop is bound by the
+// counter increments, not by its bounds.
+//
+static uint32_t const *
+compressed_histogram(multiset_t const * i_msp)
+{
+    ms_compressed_t * mscp = (ms_compressed_t *) &i_msp->ms_data.as_comp;
+    uint32_t * hist = compressed_hist(i_msp);
+
+    if (!mscp->msc_histok)
+    {
+        compreg_t const * regp = mscp->msc_regs;
+        size_t nregs = i_msp->ms_nregs;
+        size_t nvals = (size_t) 1 << i_msp->ms_nbits;
+        size_t ii = 0;
+
+        // Interleave four histograms so that runs of equal registers
+        // don't serialize on a single counter.
+        uint32_t hists[4][MS_NREGVALS];
+        memset(hists, '\0', sizeof(hists));
+
+        for (; ii + 4 <= nregs; ii += 4)
+        {
+            hists[0][regp[ii + 0]]++;
+            hists[1][regp[ii + 1]]++;
+            hists[2][regp[ii + 2]]++;
+            hists[3][regp[ii + 3]]++;
+        }
+        for (; ii < nregs; ++ii)
+            hists[0][regp[ii]]++;
+
+        for (size_t kk = 0; kk < nvals; ++kk)
+            hist[kk] = hists[0][kk] + hists[1][kk] +
+                hists[2][kk] + hists[3][kk];
+
+        mscp->msc_histok = true;
+    }
+
+    return hist;
+}
+
+// Raise a register of an MST_COMPRESSED multiset to at least val.
+//
+// The histogram is updated even when it isn't current; the recount
+// overwrites it anyway.
+//
+static inline void
+compressed_raise(multiset_t * o_msp, size_t ndx, compreg_t val)
+{
+    compreg_t * regp = &o_msp->ms_data.as_comp.msc_regs[ndx];
+
+    if (*regp < val)
+    {
+        uint32_t * hist = compressed_hist(o_msp);
+
+        hist[*regp]--;
+        hist[val]++;
+        *regp = val;
+    }
+}
+
+static void
+compressed_add(multiset_t * o_msp, uint64_t elem)
+{
+    size_t ndx;
+    compreg_t p_w = element_register(o_msp, elem, &ndx);
+
+    compressed_raise(o_msp, ndx, p_w);
+}
+
+// Give a multiset a zeroed register array, returns the prior data
+// buffer which the caller must pfree once done with it.
+//
+static void *
+compressed_alloc(multiset_t * o_msp)
+{
+    void * oldbuf = o_msp->ms_data.as_buf;
+    size_t regsz = o_msp->ms_nregs * sizeof(compreg_t);
+
+    // Make sure the compressed array fits in memory.
+    if (regsz > MS_MAXDATA)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("compressed multiset too large")));
+
+    o_msp->ms_bufsz = compressed_bufsz(o_msp);
+    o_msp->ms_data.as_comp.msc_regs =
+        (compreg_t *) MemoryContextAllocZero(o_msp->ms_mcxt, o_msp->ms_bufsz);
+
+    // All the registers are zero.
+    compressed_hist(o_msp)[0] = o_msp->ms_nregs;
+    o_msp->ms_data.as_comp.msc_histok = true;
+
+    return oldbuf;
+}
+
+// In memory MST_SPARSE multisets keep only the filled registers in an
+// open-addressed (linear probing) table of (index << 8 | value)
+// slots.  Registers are never zero so an empty slot is zero.  The
+// table is used as long as it is smaller than the register array.
+//
+#define SPARSE_SLOT(ndx, val)	(((uint32_t) (ndx) << 8) | (val))
+#define SPARSE_NDX(slot)		((slot) >> 8)
+#define SPARSE_VAL(slot)		((compreg_t) ((slot) & 0xff))
+
+// Smallest table we allocate.
+#define MS_MINSPARSE	16
+
+// Number of slots needed for nfilled registers at 3/4 load.
+//
+static size_t
+sparse_nslots(size_t i_nfilled)
+{
+    size_t nslots = MS_MINSPARSE;
+    while (nslots * 3 < i_nfilled * 4)
+        nslots *= 2;
+    return nslots;
+}
+
+// Is a table of i_nslots smaller than the register array?  Multisets
+// whose registers wouldn't fit in memory can't be sparse either.
+//
+static bool
+sparse_fits(multiset_t const * i_msp, size_t i_nslots)
+{
+    size_t regsz = i_msp->ms_nregs * sizeof(compreg_t);
+
+    return regsz <= MS_MAXDATA && i_nslots * sizeof(uint32_t) < regsz;
+}
+
+// Give a multiset an empty sparse table, returns the prior data
+// buffer which the caller must pfree once done with it.
+//
+static void *
+sparse_alloc(multiset_t * o_msp, size_t i_nslots)
+{
+    ms_sparse_t * mssp = &o_msp->ms_data.as_sprs;
+    void * oldbuf = o_msp->ms_data.as_buf;
+    size_t slotsz = i_nslots * sizeof(uint32_t);
+
+    mssp->mss_slots =
+        (uint32_t *) MemoryContextAllocZero(o_msp->ms_mcxt, slotsz);
+    mssp->mss_nslots = i_nslots;
+    mssp->mss_nfilled = 0;
+    o_msp->ms_bufsz = slotsz;
+
+    return oldbuf;
+}
+
+// Densify a sparse table into a zeroed register array.
+//
+static void
+sparse_expand(compreg_t * o_regp, uint32_t const * i_slots, size_t i_nslots)
+{
+    for (size_t ii = 0; ii < i_nslots; ++ii)
+        if (i_slots[ii] != 0)
+            o_regp[SPARSE_NDX(i_slots[ii])] = SPARSE_VAL(i_slots[ii]);
+}
+
+static void
+sparse_to_compressed(multiset_t * msp)
+{
+    // Hang on to the table.
+    ms_sparse_t mss = msp->ms_data.as_sprs;
+
+    // Switch to a fresh set of registers.
+    void * oldbuf = compressed_alloc(msp);
+
+    msp->ms_type = MST_COMPRESSED;
+
+    for (size_t ii = 0; ii < mss.mss_nslots; ++ii)
+        if (mss.mss_slots[ii] != 0)
+            compressed_raise(msp, SPARSE_NDX(mss.mss_slots[ii]),
+                             SPARSE_VAL(mss.mss_slots[ii]));
+
+    if (oldbuf != NULL)
+        pfree(oldbuf);
+}
+
+static void sparse_set(multiset_t * o_msp, size_t ndx, compreg_t val);
+
+// Double the size of a sparse table, or go dense if the table would
+// no longer be smaller than the registers.
+//
+static void
+sparse_grow(multiset_t * o_msp)
+{
+    ms_sparse_t mss = o_msp->ms_data.as_sprs;
+    size_t nslots = mss.mss_nslots * 2;
+    void * oldbuf;
+
+    if (!sparse_fits(o_msp, nslots))
+    {
+        sparse_to_compressed(o_msp);
+        return;
+    }
+
+    oldbuf = sparse_alloc(o_msp, nslots);
+
+    for (size_t ii = 0; ii < mss.mss_nslots; ++ii)
+        if (mss.mss_slots[ii] != 0)
+            sparse_set(o_msp,
+                       SPARSE_NDX(mss.mss_slots[ii]),
+                       SPARSE_VAL(mss.mss_slots[ii]));
+
+    if (oldbuf != NULL)
+        pfree(oldbuf);
+}
+
+// Raise a register of a sparse multiset to at least val.
+//
+// WARNING!  This routine can change the type of the multiset!
+//
+static void
+sparse_set(multiset_t * o_msp, size_t ndx, compreg_t val)
+{
+    ms_sparse_t * mssp = &o_msp->ms_data.as_sprs;
+    size_t mask = mssp->mss_nslots - 1;
+    size_t slot = ndx & mask;
+
+    if (val == 0)
+        return;
+
+    while (mssp->mss_slots[slot] != 0)
+    {
+        uint32_t cur = mssp->mss_slots[slot];
+
+        if (SPARSE_NDX(cur) == ndx)
+        {
+            if (SPARSE_VAL(cur) < val)
+                mssp->mss_slots[slot] = SPARSE_SLOT(ndx, val);
+            return;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    // It's a new register, is the table full?
+    if ((mssp->mss_nfilled + 1) * 4 > mssp->mss_nslots * 3)
+    {
+        sparse_grow(o_msp);
+
+        if (o_msp->ms_type == MST_COMPRESSED)
+            compressed_raise(o_msp, ndx, val);
+        else
+            sparse_set(o_msp, ndx, val);
+        return;
+    }
+
+    mssp->mss_slots[slot] = SPARSE_SLOT(ndx, val);
+    mssp->mss_nfilled++;
+}
+
+static void
+sparse_add(multiset_t * o_msp, uint64_t elem)
+{
+    size_t ndx;
+    compreg_t p_w = element_register(o_msp, elem, &ndx);
+
+    sparse_set(o_msp, ndx, p_w);
+}
+
+static int
+sparse_slot_compare(void const * ptr1, void const * ptr2)
+{
+    uint32_t v1 = * (uint32_t const *) ptr1;
+    uint32_t v2 = * (uint32_t const *) ptr2;
+
+    return (v1 < v2) ? -1 : (v1 > v2) ? 1 : 0;
+}
+
+// Returns the filled slots of a sparse multiset in register order.
+//
+static uint32_t *
+sparse_sorted(multiset_t const * i_msp)
+{
+    ms_sparse_t const * mssp = &i_msp->ms_data.as_sprs;
+    uint32_t * slots = (uint32_t *) palloc(Max(mssp->mss_nfilled, 1) *
+                                           sizeof(uint32_t));
+    size_t nn = 0;
+
+    for (size_t ii = 0; ii < mssp->mss_nslots; ++ii)
+        if (mssp->mss_slots[ii] != 0)
+            slots[nn++] = mssp->mss_slots[ii];
+
+    qsort(slots, nn, sizeof(uint32_t), sparse_slot_compare);
+
+    return slots;
+}
+
+// Marshal a sparse table in the packed MST_SPARSE format.
+//
+static void
+sparse_pack_slots(multiset_t const * i_msp, uint8_t * o_bitp, size_t i_size)
+{
+    size_t width = i_msp->ms_nbits;
+    size_t nfilled = i_msp->ms_data.as_sprs.mss_nfilled;
+    size_t bitsz = nfilled * (i_msp->ms_log2nregs + width);
+    uint32_t * slots;
+
+    bitstream_write_cursor_t bwc;
+
+    // Fail fast if the output buffer doesn't match.
+    if (i_size * 8 < bitsz || i_size * 8 - bitsz >= 8)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("sparse output buffer not large enough")));
+
+    bitstream_write_init(&bwc, o_bitp, i_msp->ms_log2nregs + width);
+
+    slots = sparse_sorted(i_msp);
+
+    for (size_t ii = 0; ii < nfilled; ++ii)
+        bitstream_pack(&bwc,
+                       (SPARSE_NDX(slots[ii]) << width) |
+                       SPARSE_VAL(slots[ii]));
+
+    bitstream_flush(&bwc);
+
+    pfree(slots);
+}
+
+// Add an element to a sparse or compressed multiset.
+//
+// WARNING!  This routine can change the type of the multiset!
+//
+static void
+register_add(multiset_t * o_msp, uint64_t elem)
+{
+    if (o_msp->ms_type == MST_SPARSE)
+        sparse_add(o_msp, elem);
+    else
+        compressed_add(o_msp, elem);
+}
+
+// Raise a register of a sparse or compressed multiset to at least val.
+//
+// WARNING!  This routine can change the type of the multiset!
+//
+static void
+register_set(multiset_t * o_msp, size_t ndx, compreg_t val)
+{
+    if (o_msp->ms_type == MST_SPARSE)
+        sparse_set(o_msp, ndx, val);
+    else
+        compressed_raise(o_msp, ndx, val);
+}
+
+// The value of a register of a sparse or compressed multiset.
+//
+static compreg_t
+register_get(multiset_t const * i_msp, size_t ndx)
+{
+    if (i_msp->ms_type == MST_SPARSE)
+    {
+        ms_sparse_t const * mssp = &i_msp->ms_data.as_sprs;
+        size_t mask = mssp->mss_nslots - 1;
+        size_t slot = ndx & mask;
+
+        // The table is never full so the probe ends.
+        while (mssp->mss_slots[slot] != 0)
+        {
+            if (SPARSE_NDX(mssp->mss_slots[slot]) == ndx)
+                return SPARSE_VAL(mssp->mss_slots[slot]);
+
+            slot = (slot + 1) & mask;
+        }
+
+        return 0;
+    }
+
+    return i_msp->ms_data.as_comp.msc_regs[ndx];
+}
+
+// Unpack a sparse bitstream straight into a sparse table.  Returns
+// false, leaving the multiset without data, if the bitstream isn't
+// in the canonical ascending form or wouldn't fit in a table smaller
+// than the registers.
+//
+static bool
+sparse_unpack_slots(multiset_t * o_msp,
+                    size_t i_nfilled,
+                    uint8_t const * i_bitp,
+                    size_t i_size)
+{
+    size_t width = o_msp->ms_nbits;
+    size_t chunksz = o_msp->ms_log2nregs + width;
+    size_t nslots = sparse_nslots(i_nfilled);
+    uint32_t regmask = (1 << width) - 1;
+    int64 prevndx = -1;
+    void * oldbuf;
+
+    if (!sparse_fits(o_msp, nslots))
+        return false;
+
+    oldbuf = sparse_alloc(o_msp, nslots);
+    if (oldbuf != NULL)
+        pfree(oldbuf);
+
+    for (size_t ii = 0; ii < i_nfilled; ii += MS_DECODE_BATCH)
+    {
+        size_t nvals = Min(MS_DECODE_BATCH, i_nfilled - ii);
+        size_t offset = ii / 8 * chunksz;
+        uint32_t chunks[MS_DECODE_BATCH];
+
+        bitstream_decode(chunks, nvals, &i_bitp[offset], i_size - offset,
+                         chunksz);
+
+        for (size_t jj = 0; jj < nvals; ++jj)
+        {
+            uint32_t val = chunks[jj] & regmask;
+            uint32_t ndx = chunks[jj] >> width;
+
+            // Repeated indexes and zero registers have to go the long
+            // way.
+            if (val == 0 || (int64) ndx <= prevndx)
+            {
+                multiset_release(o_msp);
+                return false;
+            }
+
+            sparse_set(o_msp, ndx, val);
+            prevndx = ndx;
+        }
+    }
+
+    return true;
+}
+
+static void
+compressed_explicit_union(multiset_t * o_msp, multiset_t const * i_msp)
+{
+    ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+    for (size_t ii = 0; ii < msep->mse_nelem; ++ii)
+        register_add(o_msp, msep->mse_elems[ii]);
+}
+
+// Promote an explicit multiset to registers.  The result is
+// MST_SPARSE if that's smaller, otherwise MST_COMPRESSED.
+//
+static void
+explicit_promote(multiset_t * msp)
+{
+    // Hang on to the explicit elements.
+    ms_explicit_t mse = msp->ms_data.as_expl;
+    size_t nslots = sparse_nslots(mse.mse_nelem);
+    void * oldbuf;
+
+    // Switch to a fresh set of registers.
+    if (sparse_fits(msp, nslots))
+    {
+        oldbuf = sparse_alloc(msp, nslots);
+        msp->ms_type = MST_SPARSE;
+    }
+    else
+    {
+        oldbuf = compressed_alloc(msp);
+        msp->ms_type = MST_COMPRESSED;
+    }
+
+    // Add all the elements back into the promoted multiset.
+    for (size_t ii = 0; ii < mse.mse_nelem; ++ii)
+        register_add(msp, mse.mse_elems[ii]);
+
+    if (oldbuf != NULL)
+        pfree(oldbuf);
+}
+
+// Aggregation states with registers bigger than this buffer their
+// additions instead of taking a likely cache miss on each one.
+//
+#define MS_PENDING_MINREGS	(32 * 1024)
+
+// How many additions are buffered before they're applied.
+#define MS_NPENDING		512
+
+// How far ahead of the register update we prefetch.
+#define MS_PREFETCH		8
+
+// Apply the buffered additions of an MST_COMPRESSED multiset.  All
+// the register indexes are computed up front so each update can
+// prefetch the register of one a few slots ahead.
+//
+// NOTE - Bucketing the updates by register index first was tried;
+// the extra pass cost more than the locality gained.  So was compiling
+// this for constant (log2m, regwidth) shapes, which gained nothing.
+//
+static void
+compressed_flush(multiset_t * o_msp)
+{
+    compreg_t * regp = o_msp->ms_data.as_comp.msc_regs;
+    uint32_t * hist = compressed_hist(o_msp);
+    size_t npending = o_msp->ms_npending;
+
+    // Updates use the same (index << 8 | value) layout as sparse slots.
+    uint32_t updates[MS_NPENDING];
+
+    for (size_t ii = 0; ii < npending; ++ii)
+    {
+        size_t ndx;
+        compreg_t p_w = element_register(o_msp, o_msp->ms_pending[ii], &ndx);
+
+        updates[ii] = SPARSE_SLOT(ndx, p_w);
+    }
+
+    for (size_t ii = 0; ii < npending; ++ii)
+    {
+        size_t ndx = SPARSE_NDX(updates[ii]);
+        compreg_t p_w = SPARSE_VAL(updates[ii]);
+
+        if (ii + MS_PREFETCH < npending)
+            __builtin_prefetch(&regp[SPARSE_NDX(updates[ii + MS_PREFETCH])], 1);
+
+        if (regp[ndx] < p_w)
+        {
+            hist[regp[ndx]]--;
+            hist[p_w]++;
+            regp[ndx] = p_w;
+        }
+    }
+
+    o_msp->ms_npending = 0;
+}
+
+// Make sure an explicit multiset has room for i_nelem elements.
+//
+// The element array grows geometrically from a small initial size
+// but never past the explicit threshold, where we'd promote instead.
+//
+static void
+explicit_reserve(multiset_t * o_msp, size_t i_nelem)
+{
+    size_t nalloc = o_msp->ms_bufsz / sizeof(uint64_t);
+    size_t expval;
+
+    if (i_nelem <= nalloc)
+        return;
+
+    expval = expthresh_value(o_msp->ms_expthresh,
+                             o_msp->ms_nbits,
+                             o_msp->ms_nregs);
+
+    nalloc = Max(nalloc * 2, MS_MINEXPLICIT);
+    nalloc = Min(nalloc, Min(expval, MS_MAXEXPLICIT));
+    nalloc = Max(nalloc, i_nelem);
+
+    multiset_reserve(o_msp, nalloc * sizeof(uint64_t));
+}
+
+static int
+element_compare(void const * ptr1, void const * ptr2)
+{
+    // We used signed integer comparison to be compatible
+    // with the java code.
+
+    int64_t v1 = * (int64_t const *) ptr1;
+    int64_t v2 = * (int64_t const *) ptr2;
+
+    return (v1 < v2) ? -1 : (v1 > v2) ? 1 : 0;
+}
+
+// Fold the unsorted tail of an explicit multiset into its sorted run.
+// This is a no-op for other multiset types.
+//
+static void
+explicit_settle(multiset_t * o_msp)
+{
+    ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+    uint64_t * tailp;
+    size_t ntail;
+    size_t nn;
+    ssize_t aa;
+    ssize_t bb;
+    ssize_t ww;
+
+    if (o_msp->ms_type != MST_EXPLICIT ||
+        msep->mse_nsorted == msep->mse_nelem)
+        return;
+
+    // Sort and dedup the tail.
+    tailp = &msep->mse_elems[msep->mse_nsorted];
+    ntail = msep->mse_nelem - msep->mse_nsorted;
+
+    qsort(tailp, ntail, sizeof(uint64_t), element_compare);
+
+    nn = 1;
+    for (size_t ii = 1; ii < ntail; ++ii)
+        if (tailp[ii] != tailp[nn - 1])
+            tailp[nn++] = tailp[ii];
+    ntail = nn;
+
+    // Merge from the back; the tail is disjoint from the run.
+    if (msep->mse_nsorted > 0)
+    {
+        uint64_t * tmp = (uint64_t *) palloc(ntail * sizeof(uint64_t));
+        memcpy(tmp, tailp, ntail * sizeof(uint64_t));
+
+        aa = msep->mse_nsorted - 1;
+        bb = ntail - 1;
+        ww = msep->mse_nsorted + ntail - 1;
+
+        while (bb >= 0)
+        {
+            if (aa >= 0 &&
+                element_compare(&msep->mse_elems[aa], &tmp[bb]) > 0)
+                msep->mse_elems[ww--] = msep->mse_elems[aa--];
+            else
+                msep->mse_elems[ww--] = tmp[bb--];
+        }
+
+        pfree(tmp);
+    }
+
+    msep->mse_nelem = msep->mse_nsorted + ntail;
+    msep->mse_nsorted = msep->mse_nelem;
+}
+
+static size_t numfilled(multiset_t const * i_msp)
+{
+    if (i_msp->ms_type == MST_SPARSE)
+        return i_msp->ms_data.as_sprs.mss_nfilled;
+
+    return i_msp->ms_nregs - compressed_histogram(i_msp)[0];
+}
+
+static char *
+multiset_tostring(multiset_t const * i_msp)
+{
+    char expbuf[256];
+    char * retstr;
+    size_t len;
+    size_t used;
+    size_t nbits = i_msp->ms_nbits;
+    size_t nregs = i_msp->ms_nregs;
+    int64 expthresh = i_msp->ms_expthresh;
+    size_t sparseon = i_msp->ms_sparseon;
+
+    size_t expval = expthresh_value(expthresh, nbits, nregs);
+
+    // If the expthresh is set to -1 (auto) augment the value
+    // with the automatically determined value.
+    //
+    if (expthresh == -1)
+        snprintf(expbuf, sizeof(expbuf), "%ld(%ld)", expthresh, expval);
+    else
+        snprintf(expbuf, sizeof(expbuf), "%ld", expthresh);
+
+    // Allocate an initial return buffer.
+    len = 1024;
+    retstr = (char *) palloc(len);
+    memset(retstr, '\0', len);
+
+    // We haven't used any return buffer yet.
+    used = 0;
+
+    // Print in a type-dependent way.
+    switch (i_msp->ms_type)
+    {
+    case MST_EMPTY:
+        used += snprintf(retstr, len, "EMPTY, "
+                         "nregs=%ld, nbits=%ld, expthresh=%s, sparseon=%ld",
+                         nregs, nbits, expbuf, sparseon);
+        break;
+    case MST_EXPLICIT:
+        {
+            ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+            size_t size = msep->mse_nelem;
+            char linebuf[1024];
+            ssize_t rv;
+
+            used += snprintf(retstr, len, "EXPLICIT, %ld elements, "
+                             "nregs=%ld, nbits=%ld, "
+                             "expthresh=%s, sparseon=%ld:",
+                             size, nregs, nbits, expbuf, sparseon);
+            for (size_t ii = 0; ii < size; ++ii)
+            {
+                int64_t val = * (int64_t const *) & msep->mse_elems[ii];
+                rv = snprintf(linebuf, sizeof(linebuf),
+                              "\n%ld: %20" PRIi64 " ",
+                              ii, val);
+                // Do we need to reallocate the return buffer?
+                if (rv + used > len - 1)
+                {
+                    len += 1024;
+                    retstr = (char *) repalloc(retstr, len);
+                }
+                strncpy(&retstr[used], linebuf, len - used);
+                used += rv;
+            }
+        }
+        break;
+    case MST_SPARSE:
+    case MST_COMPRESSED:
+        {
+            compreg_t const * regp = i_msp->ms_data.as_comp.msc_regs;
+
+            char linebuf[1024];
+
+            size_t rowsz = 32;
+            size_t nrows = nregs / rowsz;
+            size_t ndx = 0;
+
+            used += snprintf(retstr, len,
+                             "COMPRESSED, %ld filled "
+                             "nregs=%ld, nbits=%ld, expthresh=%s, "
+                             "sparseon=%ld:",
+                             numfilled(i_msp),
+                             nregs, nbits, expbuf, sparseon);
+
+            // Sparse registers print the same as compressed ones.
+            if (i_msp->ms_type == MST_SPARSE)
+            {
+                ms_sparse_t const * mssp = &i_msp->ms_data.as_sprs;
+                compreg_t * regs = (compreg_t *) palloc0(nregs);
+                sparse_expand(regs, mssp->mss_slots, mssp->mss_nslots);
+                regp = regs;
+            }
+
+            for (size_t rr = 0; rr < nrows; ++rr)
+            {
+                size_t pos = 0;
+                pos = snprintf(linebuf, sizeof(linebuf), "\n%4ld: ", ndx);
+                for (size_t cc = 0; cc < rowsz; ++cc)
+                {
+                    pos += snprintf(&linebuf[pos], sizeof(linebuf) - pos,
+                                    "%2d ", regp[ndx]);
+                    ++ndx;
+                }
+
+                // Do we need to reallocate the return buffer?
+                if (pos + used > len - 1)
+                {
+                    len += 1024;
+                    retstr = (char *) repalloc(retstr, len);
+                }
+                strncpy(&retstr[used], linebuf, len - used);
+                used += pos;
+            }
+        }
+        break;
+    case MST_UNDEFINED:
+        used += snprintf(retstr, len, "UNDEFINED "
+                         "nregs=%ld, nbits=%ld, expthresh=%s, sparseon=%ld",
+                         nregs, nbits, expbuf, sparseon);
+        break;
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("unexpected multiset type value")));
+        break;
+    }
+
+    return retstr;
+}
+
+static void
+explicit_validate(multiset_t const * i_msp, ms_explicit_t const * i_msep)
+{
+    // Allow explicit multisets with no elements.
+    if (i_msep->mse_nelem == 0)
+        return;
+
+    // Confirm that all elements are ascending with no duplicates.
+    for (int ii = 0; ii < i_msep->mse_nelem - 1; ++ii)
+    {
+        if (element_compare(&i_msep->mse_elems[ii],
+                            &i_msep->mse_elems[ii + 1]) != -1)
+        {
+            char * buf = multiset_tostring(i_msp);
+
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("duplicate or descending explicit elements: %s",
+                            buf)));
+
+            pfree(buf);
+        }
+    }
+}
+
+static void
+multiset_add(multiset_t * o_msp, uint64_t element)
+{
+    // WARNING!  This routine can change the type of the multiset!
+
+    size_t expval = expthresh_value(o_msp->ms_expthresh,
+                                    o_msp->ms_nbits,
+                                    o_msp->ms_nregs);
+
+    switch (o_msp->ms_type)
+    {
+    case MST_EMPTY:
+        // Are we forcing compressed?
+        if (expval == 0)
+        {
+            // Now we're explicit with no elements.
+            o_msp->ms_type = MST_EXPLICIT;
+            o_msp->ms_data.as_expl.mse_nelem = 0;
+            o_msp->ms_data.as_expl.mse_nsorted = 0;
+
+            // Promote it to registers.
+            explicit_promote(o_msp);
+
+            // Add the element to the registers.
+            register_add(o_msp, element);
+        }
+        else
+        {
+            // Now we're explicit with one element.
+            o_msp->ms_type = MST_EXPLICIT;
+            explicit_reserve(o_msp, 1);
+            o_msp->ms_data.as_expl.mse_nelem = 1;
+            o_msp->ms_data.as_expl.mse_nsorted = 1;
+            o_msp->ms_data.as_expl.mse_elems[0] = element;
+        }
+        break;
+
+    case MST_EXPLICIT:
+        {
+            ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+
+            // If the element is already in the sorted run we're done.
+            if (bsearch(&element,
+                        msep->mse_elems,
+                        msep->mse_nsorted,
+                        sizeof(uint64_t),
+                        element_compare))
+                return;
+
+            // Is the explicit multiset full?  The tail may be holding
+            // duplicates so settle it and check again.
+            if (msep->mse_nelem == expval ||
+                msep->mse_nelem == MS_MAXEXPLICIT)
+            {
+                explicit_settle(o_msp);
+
+                if (bsearch(&element,
+                            msep->mse_elems,
+                            msep->mse_nelem,
+                            sizeof(uint64_t),
+                            element_compare))
+                    return;
+
+                if (msep->mse_nelem == expval ||
+                    msep->mse_nelem == MS_MAXEXPLICIT)
+                {
+                    // Promote it to registers.
+                    explicit_promote(o_msp);
+
+                    // Add the element to the registers.
+                    register_add(o_msp, element);
+                    break;
+                }
+            }
+
+            // Add the element to the tail.
+            explicit_reserve(o_msp, msep->mse_nelem + 1);
+            msep->mse_elems[msep->mse_nelem++] = element;
+
+            // Fold the tail in once it's as long as the sorted run.
+            if (msep->mse_nelem - msep->mse_nsorted >
+                Max(msep->mse_nsorted, MS_MINEXPLICIT))
+                explicit_settle(o_msp);
+        }
+        break;
+
+    case MST_SPARSE:
+    case MST_COMPRESSED:
+        register_add(o_msp, element);
+        break;
+
+    case MST_UNDEFINED:
+        // Result is unchanged.
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type value #1")));
+        break;
+    }
+}
+
+// Is the element in an explicit multiset?  The unsorted tail is
+// searched too.
+//
+static bool
+explicit_contains(multiset_t const * i_msp, uint64_t element)
+{
+    ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+
+    if (bsearch(&element,
+                msep->mse_elems,
+                msep->mse_nsorted,
+                sizeof(uint64_t),
+                element_compare))
+        return true;
+
+    for (size_t ii = msep->mse_nsorted; ii < msep->mse_nelem; ++ii)
+        if (msep->mse_elems[ii] == element)
+            return true;
+
+    return false;
+}
+
+// Would multiset_add of the element change the multiset?  A change of
+// type alone, say from MST_EMPTY, counts.
+//
+static bool
+multiset_add_changes(multiset_t const * i_msp, uint64_t element)
+{
+    bool retval = true;
+
+    switch (i_msp->ms_type)
+    {
+    case MST_EMPTY:
+        break;
+
+    case MST_EXPLICIT:
+        // A new element is either added or promotes the multiset.
+        retval = !explicit_contains(i_msp, element);
+        break;
+
+    case MST_SPARSE:
+    case MST_COMPRESSED:
+        {
+            size_t ndx;
+            compreg_t p_w = element_register(i_msp, element, &ndx);
+
+            retval = p_w > register_get(i_msp, ndx);
+        }
+        break;
+
+    case MST_UNDEFINED:
+        retval = false;
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type value #1")));
+        break;
+    }
+
+    return retval;
+}
+
+// Add an element to an aggregation state.  Large MST_COMPRESSED
+// states buffer the element; everything else adds it directly.
+//
+// NOTE - The state must be settled with multiset_settle before
+// anything reads its registers.
+//
+static void
+multiset_add_pending(multiset_t * o_msp, uint64_t element)
+{
+    if (o_msp->ms_type != MST_COMPRESSED ||
+        o_msp->ms_nregs < MS_PENDING_MINREGS)
+    {
+        multiset_add(o_msp, element);
+        return;
+    }
+
+    if (o_msp->ms_pending == NULL)
+        o_msp->ms_pending = (uint64_t *)
+            MemoryContextAlloc(o_msp->ms_mcxt, MS_NPENDING * sizeof(uint64_t));
+
+    o_msp->ms_pending[o_msp->ms_npending++] = element;
+
+    if (o_msp->ms_npending == MS_NPENDING)
+        compressed_flush(o_msp);
+}
+
+// Bring an aggregation state up to date: apply any buffered
+// additions and fold any unsorted explicit elements in.
+//
+static void
+multiset_settle(multiset_t * o_msp)
+{
+    if (o_msp->ms_npending > 0)
+        compressed_flush(o_msp);
+
+    explicit_settle(o_msp);
+}
+
+static void
+explicit_union(multiset_t * o_msp, ms_explicit_t const * i_msep)
+{
+    // NOTE - Both element arrays must be settled; this does a linear
+    // merge of the two sorted runs into a fresh buffer.
+    //
+    // WARNING!  This routine can change the type of the target multiset!
+
+    size_t expval = expthresh_value(o_msp->ms_expthresh,
+                                    o_msp->ms_nbits,
+                                    o_msp->ms_nregs);
+
+    ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+
+    size_t aa = 0;
+    size_t bb = 0;
+    size_t nn = 0;
+    size_t nalloc;
+    uint64_t * elems;
+
+    // We never hold more than this many elements, unless we already
+    // do; then any new element makes us promote.
+    expval = Min(expval, MS_MAXEXPLICIT);
+    expval = Max(expval, msep->mse_nelem);
+
+    nalloc = Min(expval, msep->mse_nelem + i_msep->mse_nelem);
+    nalloc = Max(nalloc, 1);
+    elems = (uint64_t *) MemoryContextAlloc(o_msp->ms_mcxt,
+                                            nalloc * sizeof(uint64_t));
+
+    while (aa < msep->mse_nelem || bb < i_msep->mse_nelem)
+    {
+        uint64_t element;
+
+        if (bb == i_msep->mse_nelem)
+            element = msep->mse_elems[aa++];
+        else if (aa == msep->mse_nelem)
+            element = i_msep->mse_elems[bb++];
+        else
+        {
+            int cmp = element_compare(&msep->mse_elems[aa],
+                                      &i_msep->mse_elems[bb]);
+            if (cmp < 0)
+                element = msep->mse_elems[aa++];
+            else if (cmp > 0)
+                element = i_msep->mse_elems[bb++];
+            else
+            {
+                element = msep->mse_elems[aa++];
+                ++bb;
+            }
+        }
+
+        // Would the union overflow the explicit multiset?
+        if (nn == expval)
+        {
+            pfree(elems);
+
+            // Promote it to registers.
+            explicit_promote(o_msp);
+
+            // Add the incoming elements to the registers.
+            for (size_t ii = 0; ii < i_msep->mse_nelem; ++ii)
+                register_add(o_msp, i_msep->mse_elems[ii]);
+            return;
+        }
+
+        elems[nn++] = element;
+    }
+
+    // Switch to the merged elements.
+    multiset_release(o_msp);
+    msep->mse_elems = elems;
+    msep->mse_nelem = nn;
+    msep->mse_nsorted = nn;
+    o_msp->ms_bufsz = nalloc * sizeof(uint64_t);
+}
+
+// Schema version 2 is packed the same as version 1, except that
+// sparse and compressed multisets may carry a summary after the three
+// header bytes, flagged by the otherwise unused top bit of the third:
+// the classic cardinality estimate as a big-endian IEEE 754 double,
+// then the number of filled registers as a big-endian 32-bit integer.
+//
+#define MS_SUMMARYFLAG	0x80
+#define MS_SUMMARYSZ	12
+
+// Size of the largest packed header, summary included.
+#define MS_MAXHDRSZ		(3 + MS_SUMMARYSZ)
+
+// Size of the header of a packed multiset, including any summary.
+// Values too small for a header are left to the caller to reject.
+//
+static size_t
+packed_hdrsz(uint8_t const * i_bitp, size_t i_size)
+{
+    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
+    uint8_t type = i_bitp[0] & 0xf;
+
+    if (vers == 2 && i_size >= 3 &&
+        (type == MST_SPARSE || type == MST_COMPRESSED) &&
+        (i_bitp[2] & MS_SUMMARYFLAG) != 0)
+        return MS_MAXHDRSZ;
+
+    return 3;
+}
+
+// Read the summary of a packed multiset.  Returns false if it has
+// none.
+//
+static bool
+packed_summary(uint8_t const * i_bitp,
+               size_t i_size,
+               double * o_card,
+               uint32_t * o_nfilled)
+{
+    uint64_t bits = 0;
+    uint32_t nfilled = 0;
+
+    if (i_size < MS_MAXHDRSZ || packed_hdrsz(i_bitp, i_size) != MS_MAXHDRSZ)
+        return false;
+
+    for (size_t ii = 3; ii < 11; ++ii)
+        bits = (bits << 8) | i_bitp[ii];
+    for (size_t ii = 11; ii < 15; ++ii)
+        nfilled = (nfilled << 8) | i_bitp[ii];
+
+    memcpy(o_card, &bits, sizeof(double));
+    if (o_nfilled != NULL)
+        *o_nfilled = nfilled;
+
+    return true;
+}
+
+static void unpack_header(multiset_t * o_msp,
+                          uint8_t const * i_bitp,
+                          uint8_t vers,
+                          uint8_t type)
+{
+    o_msp->ms_nbits = (i_bitp[1] >> 5) + 1;
+    o_msp->ms_log2nregs = i_bitp[1] & 0x1f;
+    o_msp->ms_nregs = 1 <<  o_msp->ms_log2nregs;
+    o_msp->ms_expthresh = decode_expthresh(i_bitp[2] & 0x3f);
+    o_msp->ms_sparseon = (i_bitp[2] >> 6) & 0x1;
+}
+
+// Schema version 3 is packed the same as version 1, except that the
+// bodies of explicit and sparse multisets may be delta coded, flagged
+// by the top bit of the third byte, when that's smaller.  They are
+// sorted, so they can be stored as the gaps between their keys: first
+// the number of entries as an unsigned LEB128 varint, then blocks of
+// up to MS_DELTABLOCK entries.  Each block is a byte holding the bit width
+// of its largest gap, the gaps packed MSB first in that width, then
+// the values of the entries packed in a fixed width; each of the two
+// is padded to a byte.
+//
+// For a sparse multiset the keys are the register indexes, which
+// strictly ascend, and each gap is one less than the difference from
+// the previous index (-1 for the first).  The values are the
+// registers, in regwidth bits.
+//
+// For an explicit multiset each element has its sign bit flipped, so
+// they ascend as unsigned integers; the keys are the top 32 bits and
+// each gap is the difference from the previous key (0 for the first).
+// The values are the low 32 bits.
+//
+// Compressed multisets are packed as in version 1, and there are no
+// summaries.
+//
+#define MS_DELTAFLAG	0x80
+#define MS_DELTABLOCK	32
+
+// Is the packed multiset a delta coded version 3 or 4 one?
+//
+static bool
+packed_delta(uint8_t const * i_bitp, size_t i_size)
+{
+    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
+    uint8_t type = i_bitp[0] & 0xf;
+
+    return (vers == 3 || vers == 4) && i_size >= 3 &&
+        (type == MST_EXPLICIT || type == MST_SPARSE) &&
+        (i_bitp[2] & MS_DELTAFLAG) != 0;
+}
+
+static size_t
+varint_pack(uint8_t * o_bitp, uint64_t val)
+{
+    size_t ndx = 0;
+
+    while (val >= 0x80)
+    {
+        if (o_bitp != NULL)
+            o_bitp[ndx] = (val & 0x7f) | 0x80;
+        ++ndx;
+        val >>= 7;
+    }
+
+    if (o_bitp != NULL)
+        o_bitp[ndx] = val;
+
+    return ndx + 1;
+}
+
+// Returns the size of the varint, or 0 if it runs past i_size bytes
+// or is longer than any count we store.
+//
+static size_t
+varint_unpack(uint8_t const * i_bitp, size_t i_size, uint64_t * o_val)
+{
+    uint64_t val = 0;
+
+    for (size_t ndx = 0; ndx < i_size && ndx < 5; ++ndx)
+    {
+        val |= (uint64_t) (i_bitp[ndx] & 0x7f) << (7 * ndx);
+        if ((i_bitp[ndx] & 0x80) == 0)
+        {
+            *o_val = val;
+            return ndx + 1;
+        }
+    }
+
+    return 0;
+}
+
+// Pack a block of i_nents entries whose keys follow i_prev, strictly
+// ascending if i_strict.  Returns the packed size; with a NULL o_bitp
+// that's all it does.
+//
+static size_t
+delta_block_pack(uint8_t * o_bitp,
+                 uint32_t const * i_keys,
+                 uint32_t const * i_vals,
+                 size_t i_nents,
+                 size_t i_valwidth,
+                 int64 i_prev,
+                 bool i_strict)
+{
+    uint32_t gaps[MS_DELTABLOCK];
+    uint32_t allbits = 0;
+    size_t width;
+    size_t keysz;
+    size_t valsz;
+
+    bitstream_write_cursor_t bwc;
+
+    for (size_t ii = 0; ii < i_nents; ++ii)
+    {
+        gaps[ii] = (uint32_t) (i_keys[ii] - i_prev - (i_strict ? 1 : 0));
+        allbits |= gaps[ii];
+        i_prev = i_keys[ii];
+    }
+
+    width = allbits == 0 ? 0 : 32 - __builtin_clz(allbits);
+    keysz = (i_nents * width + 7) / 8;
+    valsz = (i_nents * i_valwidth + 7) / 8;
+
+    if (o_bitp != NULL)
+    {
+        o_bitp[0] = width;
+
+        if (width > 0)
+        {
+            bitstream_write_init(&bwc, &o_bitp[1], width);
+            for (size_t ii = 0; ii < i_nents; ++ii)
+                bitstream_pack(&bwc, gaps[ii]);
+            bitstream_flush(&bwc);
+        }
+
+        bitstream_write_init(&bwc, &o_bitp[1 + keysz], i_valwidth);
+        for (size_t ii = 0; ii < i_nents; ++ii)
+            bitstream_pack(&bwc, i_vals[ii]);
+        bitstream_flush(&bwc);
+    }
+
+    return 1 + keysz + valsz;
+}
+
+// Turn the gaps of a block back into keys, adding i_step to each gap
+// and starting from i_base.  Nothing may overflow; the caller has
+// checked the last key.
+//
+static void
+delta_prefix_sum(uint32_t * io_keys,
+                 size_t i_nents,
+                 uint32_t i_base,
+                 uint32_t i_step)
+{
+    size_t ii = 0;
+
+#ifdef HAVE_X86_64_KERNELS
+    // Four at a time with SSE2: sum the lanes in two shifted adds,
+    // then add the last key of the previous four.
+    __m128i carry = _mm_set1_epi32(i_base);
+    __m128i step = _mm_set1_epi32(i_step);
+
+    for (; ii + 4 <= i_nents; ii += 4)
+    {
+        __m128i xx = _mm_loadu_si128((__m128i const *) &io_keys[ii]);
+
+        xx = _mm_add_epi32(xx, step);
+        xx = _mm_add_epi32(xx, _mm_slli_si128(xx, 4));
+        xx = _mm_add_epi32(xx, _mm_slli_si128(xx, 8));
+        xx = _mm_add_epi32(xx, carry);
+        _mm_storeu_si128((__m128i *) &io_keys[ii], xx);
+        carry = _mm_shuffle_epi32(xx, 0xff);
+    }
+
+    i_base = _mm_cvtsi128_si32(carry);
+#endif
+
+    for (; ii < i_nents; ++ii)
+    {
+        i_base += io_keys[ii] + i_step;
+        io_keys[ii] = i_base;
+    }
+}
+
+// Unpack a block of i_nents entries, the inverse of delta_block_pack.
+// *io_prev is the key before the block, and is updated to its last.
+// Returns the packed size, or 0 if the block runs past i_size bytes
+// or a key would be past i_maxkey.
+//
+static size_t
+delta_block_unpack(uint32_t * o_keys,
+                   uint32_t * o_vals,
+                   size_t i_nents,
+                   uint8_t const * i_bitp,
+                   size_t i_size,
+                   size_t i_valwidth,
+                   int64 i_maxkey,
+                   bool i_strict,
+                   int64 * io_prev)
+{
+    size_t width;
+    size_t keysz;
+    size_t valsz;
+    int64 last;
+
+    if (i_size < 1 || i_bitp[0] > 32)
+        return 0;
+
+    width = i_bitp[0];
+    keysz = (i_nents * width + 7) / 8;
+    valsz = (i_nents * i_valwidth + 7) / 8;
+    if (i_size - 1 < keysz + valsz)
+        return 0;
+
+    if (width == 0)
+        memset(o_keys, '\0', i_nents * sizeof(uint32_t));
+    else
+        bitstream_decode(o_keys, i_nents, &i_bitp[1], keysz, width);
+
+    bitstream_decode(o_vals, i_nents, &i_bitp[1 + keysz], valsz, i_valwidth);
+
+    // The last key is the largest.
+    last = *io_prev + (i_strict ? i_nents : 0);
+    for (size_t ii = 0; ii < i_nents; ++ii)
+        last += o_keys[ii];
+    if (last > i_maxkey)
+        return 0;
+
+    delta_prefix_sum(o_keys, i_nents, (uint32_t) *io_prev, i_strict ? 1 : 0);
+    *io_prev = last;
+
+    return 1 + keysz + valsz;
+}
+
+// The filled registers of a sparse or compressed multiset as sparse
+// slots, in register order.
+//
+static uint32_t *
+registers_sorted(multiset_t const * i_msp)
+{
+    compreg_t const * regp = i_msp->ms_data.as_comp.msc_regs;
+    uint32_t * slots;
+    size_t nn = 0;
+
+    if (i_msp->ms_type == MST_SPARSE)
+        return sparse_sorted(i_msp);
+
+    // One slot past the filled registers is written, without a branch.
+    slots = (uint32_t *) palloc((numfilled(i_msp) + 1) * sizeof(uint32_t));
+    for (size_t ndx = 0; ndx < i_msp->ms_nregs; ++ndx)
+    {
+        slots[nn] = SPARSE_SLOT(ndx, regp[ndx]);
+        nn += regp[ndx] != 0;
+    }
+
+    return slots;
+}
+
+// Pack the sorted slots of i_nfilled registers as a version 3 sparse
+// body.  Returns the packed size; with a NULL o_bitp that's all it
+// does.
+//
+static size_t
+sparse_delta_pack(uint32_t const * i_slots,
+                  size_t i_nfilled,
+                  size_t i_width,
+                  uint8_t * o_bitp)
+{
+    size_t ndx = varint_pack(o_bitp, i_nfilled);
+    int64 prev = -1;
+
+    for (size_t ii = 0; ii < i_nfilled; ii += MS_DELTABLOCK)
+    {
+        size_t nents = Min(MS_DELTABLOCK, i_nfilled - ii);
+        uint32_t keys[MS_DELTABLOCK];
+        uint32_t vals[MS_DELTABLOCK];
+
+        for (size_t jj = 0; jj < nents; ++jj)
+        {
+            keys[jj] = SPARSE_NDX(i_slots[ii + jj]);
+            vals[jj] = SPARSE_VAL(i_slots[ii + jj]);
+        }
+
+        ndx += delta_block_pack(o_bitp != NULL ? &o_bitp[ndx] : NULL,
+                                keys, vals, nents, i_width, prev, true);
+        prev = keys[nents - 1];
+    }
+
+    return ndx;
+}
+
+// Unpack a version 3 sparse body into a multiset with its header
+// set.  Like version 1 it stays sparse in memory if that's smaller.
+//
+static void
+sparse_delta_unpack(multiset_t * o_msp, uint8_t const * i_bitp, size_t i_size)
+{
+    uint64_t nfilled;
+    size_t ndx = varint_unpack(i_bitp, i_size, &nfilled);
+    int64 prev = -1;
+    size_t nslots;
+    compreg_t * regp = NULL;
+
+    if (ndx == 0 || nfilled > o_msp->ms_nregs)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistently sized sparse multiset")));
+
+    nslots = sparse_nslots(nfilled);
+    if (sparse_fits(o_msp, nslots))
+    {
+        void * oldbuf = sparse_alloc(o_msp, nslots);
+        if (oldbuf != NULL)
+            pfree(oldbuf);
+    }
+    else
+    {
+        o_msp->ms_type = MST_COMPRESSED;
+        multiset_reserve(o_msp, compressed_bufsz(o_msp));
+        regp = o_msp->ms_data.as_comp.msc_regs;
+        memset(regp, '\0', o_msp->ms_nregs);
+        o_msp->ms_data.as_comp.msc_histok = false;
+    }
+
+    for (size_t ii = 0; ii < nfilled; ii += MS_DELTABLOCK)
+    {
+        size_t nents = Min(MS_DELTABLOCK, nfilled - ii);
+        uint32_t keys[MS_DELTABLOCK];
+        uint32_t vals[MS_DELTABLOCK];
+        size_t blocksz = delta_block_unpack(keys, vals, nents,
+                                            &i_bitp[ndx], i_size - ndx,
+                                            o_msp->ms_nbits,
+                                            o_msp->ms_nregs - 1,
+                                            true, &prev);
+
+        if (blocksz == 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("invalid delta block in sparse hll argument")));
+        ndx += blocksz;
+
+        // The indexes are distinct, so the registers can be stored.
+        if (regp != NULL)
+        {
+            for (size_t jj = 0; jj < nents; ++jj)
+                regp[keys[jj]] = vals[jj];
+        }
+        else
+        {
+            for (size_t jj = 0; jj < nents; ++jj)
+                sparse_set(o_msp, keys[jj], vals[jj]);
+        }
+    }
+
+    if (ndx != i_size)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistently sized sparse multiset")));
+}
+
+// Count the registers of a version 3 sparse body into a histogram,
+// without unpacking it.  Returns false if it's malformed.
+//
+static bool
+sparse_delta_histogram(multiset_t const * i_msp,
+                       uint8_t const * i_bitp,
+                       size_t i_size,
+                       uint32_t * o_hist)
+{
+    uint64_t nfilled;
+    size_t ndx = varint_unpack(i_bitp, i_size, &nfilled);
+    int64 prev = -1;
+
+    if (ndx == 0 || nfilled > i_msp->ms_nregs ||
+        i_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+        return false;
+
+    memset(o_hist, '\0', MS_NREGVALS * sizeof(uint32_t));
+
+    for (size_t ii = 0; ii < nfilled; ii += MS_DELTABLOCK)
+    {
+        size_t nents = Min(MS_DELTABLOCK, nfilled - ii);
+        uint32_t keys[MS_DELTABLOCK];
+        uint32_t vals[MS_DELTABLOCK];
+        size_t blocksz = delta_block_unpack(keys, vals, nents,
+                                            &i_bitp[ndx], i_size - ndx,
+                                            i_msp->ms_nbits,
+                                            i_msp->ms_nregs - 1,
+                                            true, &prev);
+
+        if (blocksz == 0)
+            return false;
+        ndx += blocksz;
+
+        for (size_t jj = 0; jj < nents; ++jj)
+            o_hist[vals[jj]]++;
+    }
+
+    if (ndx != i_size)
+        return false;
+
+    o_hist[0] += i_msp->ms_nregs - nfilled;
+    return true;
+}
+
+// Pack the elements of an explicit multiset as a version 3 explicit
+// body.  Returns the packed size; with a NULL o_bitp that's all it
+// does.
+//
+static size_t
+explicit_delta_pack(ms_explicit_t const * i_msep, uint8_t * o_bitp)
+{
+    size_t nelem = i_msep->mse_nelem;
+    size_t ndx = varint_pack(o_bitp, nelem);
+    int64 prev = 0;
+
+    for (size_t ii = 0; ii < nelem; ii += MS_DELTABLOCK)
+    {
+        size_t nents = Min(MS_DELTABLOCK, nelem - ii);
+        uint32_t keys[MS_DELTABLOCK];
+        uint32_t vals[MS_DELTABLOCK];
+
+        for (size_t jj = 0; jj < nents; ++jj)
+        {
+            uint64_t elem = i_msep->mse_elems[ii + jj] ^ (1ULL << 63);
+
+            keys[jj] = elem >> 32;
+            vals[jj] = (uint32_t) elem;
+        }
+
+        ndx += delta_block_pack(o_bitp != NULL ? &o_bitp[ndx] : NULL,
+                                keys, vals, nents, 32, prev, false);
+        prev = keys[nents - 1];
+    }
+
+    return ndx;
+}
+
+// Unpack a version 3 explicit body into a multiset with its header
+// set.
+//
+static void
+explicit_delta_unpack(multiset_t * o_msp,
+                      uint8_t const * i_bitp,
+                      size_t i_size)
+{
+    ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+    uint64_t nelem;
+    size_t ndx = varint_unpack(i_bitp, i_size, &nelem);
+    int64 prev = 0;
+
+    if (ndx == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistently sized explicit multiset")));
+
+    // Make sure the explicit array fits in memory.
+    if (nelem * sizeof(uint64_t) > MS_MAXDATA)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("explicit multiset too large")));
+
+    multiset_reserve(o_msp, nelem * sizeof(uint64_t));
+
+    for (size_t ii = 0; ii < nelem; ii += MS_DELTABLOCK)
+    {
+        size_t nents = Min(MS_DELTABLOCK, nelem - ii);
+        uint32_t keys[MS_DELTABLOCK];
+        uint32_t vals[MS_DELTABLOCK];
+        size_t blocksz = delta_block_unpack(keys, vals, nents,
+                                            &i_bitp[ndx], i_size - ndx,
+                                            32, 0xffffffff, false, &prev);
+
+        if (blocksz == 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("invalid delta block in explicit hll argument")));
+        ndx += blocksz;
+
+        for (size_t jj = 0; jj < nents; ++jj)
+            msep->mse_elems[ii + jj] =
+                (((uint64_t) keys[jj] << 32) | vals[jj]) ^ (1ULL << 63);
+    }
+
+    if (ndx != i_size)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistently sized explicit multiset")));
+
+    msep->mse_nelem = nelem;
+    msep->mse_nsorted = nelem;
+
+    explicit_validate(o_msp, msep);
+}
+
+// Schema version 4 is packed the same as version 3, except that the
+// registers of a compressed multiset may be entropy coded, flagged by
+// the top bit of the third byte, when that's smaller.  Register values
+// are far from uniform, most of them sit within a few of log2(n / m),
+// so a Huffman code over them takes about 3 bits per register where
+// the fixed width takes regwidth.  The body is a byte holding the
+// largest register value, the number of registers holding each value
+// up to it as unsigned LEB128 varints, then the code of each register
+// in index order, MSB first, padded to a byte.
+//
+// The canonical code is rebuilt from the counts, which also give the
+// register histogram without decoding anything.  Codes are at most
+// MS_HUFFMAXLEN bits so the decoding table stays small; counts that
+// would give longer ones are halved until they don't.  If all the
+// registers hold the same value there are no codes at all.
+//
+#define MS_ENTROPYFLAG	0x80
+#define MS_HUFFMAXLEN	11
+
+typedef struct
+{
+    size_t		hc_nsyms;		// Values 0 to nsyms - 1 ...
+    size_t		hc_maxlen;		// ... their longest code ...
+    uint8_t		hc_lens[MS_NREGVALS];	// ... and each one's, 0 if unused.
+    uint32_t	hc_codes[MS_NREGVALS];
+
+} huffman_code_t;
+
+// Is the packed multiset an entropy coded version 4 one?
+//
+static bool
+packed_entropy(uint8_t const * i_bitp, size_t i_size)
+{
+    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
+    uint8_t type = i_bitp[0] & 0xf;
+
+    return vers == 4 && i_size >= 3 && type == MST_COMPRESSED &&
+        (i_bitp[2] & MS_ENTROPYFLAG) != 0;
+}
+
+// Huffman code lengths for the values with non-zero counts.  Leaves
+// and merged nodes are taken from two queues in ascending weight, a
+// leaf first on a tie, so the packer and the unpacker always build
+// the same code.  Returns the longest length, 0 if only one value is
+// used.
+//
+static size_t
+huffman_lengths(uint8_t * o_lens, uint32_t const * i_counts, size_t i_nsyms)
+{
+    uint16_t syms[MS_NREGVALS];
+    uint32_t weights[2 * MS_NREGVALS];
+    uint16_t parent[2 * MS_NREGVALS];
+    uint8_t depth[2 * MS_NREGVALS];
+    size_t nleaves = 0;
+    size_t root;
+    size_t maxlen;
+
+    memset(o_lens, '\0', i_nsyms);
+
+    for (size_t ss = 0; ss < i_nsyms; ++ss)
+        if (i_counts[ss] != 0)
+            syms[nleaves++] = ss;
+
+    if (nleaves <= 1)
+        return 0;
+
+    // Sort by count; the insertion sort is stable, so ties stay in
+    // value order.
+    for (size_t ii = 1; ii < nleaves; ++ii)
+    {
+        uint16_t sym = syms[ii];
+        size_t jj = ii;
+
+        for (; jj > 0 && i_counts[syms[jj - 1]] > i_counts[sym]; --jj)
+            syms[jj] = syms[jj - 1];
+        syms[jj] = sym;
+    }
+
+    for (size_t ii = 0; ii < nleaves; ++ii)
+        weights[ii] = i_counts[syms[ii]];
+
+    root = 2 * nleaves - 2;
+
+    for (;;)
+    {
+        size_t leaf = 0;
+        size_t node = nleaves;
+
+        for (size_t nn = nleaves; nn <= root; ++nn)
+        {
+            size_t kids[2];
+
+            for (size_t kk = 0; kk < 2; ++kk)
+            {
+                if (leaf < nleaves &&
+                    (node == nn || weights[leaf] <= weights[node]))
+                    kids[kk] = leaf++;
+                else
+                    kids[kk] = node++;
+            }
+
+            weights[nn] = weights[kids[0]] + weights[kids[1]];
+            parent[kids[0]] = nn;
+            parent[kids[1]] = nn;
+        }
+
+        // Parents come after their children.
+        depth[root] = 0;
+        maxlen = 0;
+        for (size_t nn = root; nn-- > 0; )
+        {
+            depth[nn] = depth[parent[nn]] + 1;
+            if (nn < nleaves)
+                maxlen = Max(maxlen, depth[nn]);
+        }
+
+        if (maxlen <= MS_HUFFMAXLEN)
+            break;
+
+        // Halving keeps the order of the leaves.
+        for (size_t ii = 0; ii < nleaves; ++ii)
+            weights[ii] = (weights[ii] + 1) / 2;
+    }
+
+    for (size_t ii = 0; ii < nleaves; ++ii)
+        o_lens[syms[ii]] = depth[ii];
+
+    return maxlen;
+}
+
+// Build the canonical Huffman code for values 0 to i_nsyms - 1 with
+// the given counts: shorter codes first, and in value order within a
+// length.
+//
+static void
+huffman_build(huffman_code_t * o_hcp, uint32_t const * i_counts,
+              size_t i_nsyms)
+{
+    uint32_t code = 0;
+
+    o_hcp->hc_nsyms = i_nsyms;
+    o_hcp->hc_maxlen = huffman_lengths(o_hcp->hc_lens, i_counts, i_nsyms);
+
+    for (size_t len = 1; len <= o_hcp->hc_maxlen; ++len)
+    {
+        for (size_t ss = 0; ss < i_nsyms; ++ss)
+            if (o_hcp->hc_lens[ss] == len)
+                o_hcp->hc_codes[ss] = code++;
+        code <<= 1;
+    }
+}
+
+// Pack i_nregs registers with the histogram i_hist, of i_nvals
+// counters, as a version 4 compressed body.  Returns the packed size;
+// with a NULL o_bitp that's all it does, and the registers aren't
+// read.
+//
+static size_t
+entropy_pack(compreg_t const * i_regp,
+             size_t i_nregs,
+             uint32_t const * i_hist,
+             size_t i_nvals,
+             uint8_t * o_bitp)
+{
+    huffman_code_t hc;
+    size_t nsyms = i_nvals;
+    size_t ndx = 1;
+    uint64_t bitsz = 0;
+
+    while (nsyms > 1 && i_hist[nsyms - 1] == 0)
+        --nsyms;
+
+    huffman_build(&hc, i_hist, nsyms);
+
+    if (o_bitp != NULL)
+        o_bitp[0] = nsyms - 1;
+
+    for (size_t ss = 0; ss < nsyms; ++ss)
+    {
+        ndx += varint_pack(o_bitp != NULL ? &o_bitp[ndx] : NULL, i_hist[ss]);
+        bitsz += (uint64_t) i_hist[ss] * hc.hc_lens[ss];
+    }
+
+    if (o_bitp != NULL && hc.hc_maxlen > 0)
+    {
+        bitstream_write_cursor_t bwc;
+
+        bitstream_write_init(&bwc, &o_bitp[ndx], 0);
+        for (size_t ii = 0; ii < i_nregs; ++ii)
+        {
+            bwc.bwc_nbits = hc.hc_lens[i_regp[ii]];
+            bitstream_pack(&bwc, hc.hc_codes[i_regp[ii]]);
+        }
+        bitstream_flush(&bwc);
+    }
+
+    return ndx + (bitsz + 7) / 8;
+}
+
+// Read the counts at the front of a version 4 compressed body into
+// o_hist, and build their code.  Returns the size of the counts and
+// sets *o_codesz to the size of the codes after them, or returns 0 if
+// the counts run past i_size bytes, count a value wider than the
+// registers or don't add up to the number of them.
+//
+static size_t
+entropy_counts(multiset_t const * i_msp,
+               uint8_t const * i_bitp,
+               size_t i_size,
+               uint32_t * o_hist,
+               huffman_code_t * o_hcp,
+               size_t * o_codesz)
+{
+    size_t nsyms;
+    size_t ndx = 1;
+    uint64_t total = 0;
+    uint64_t bitsz = 0;
+
+    if (i_size < 1)
+        return 0;
+
+    nsyms = (size_t) i_bitp[0] + 1;
+    if (nsyms > ((size_t) 1 << i_msp->ms_nbits))
+        return 0;
+
+    memset(o_hist, '\0', MS_NREGVALS * sizeof(uint32_t));
+
+    for (size_t ss = 0; ss < nsyms; ++ss)
+    {
+        uint64_t count;
+        size_t sz = varint_unpack(&i_bitp[ndx], i_size - ndx, &count);
+
+        if (sz == 0 || count > i_msp->ms_nregs)
+            return 0;
+
+        ndx += sz;
+        o_hist[ss] = count;
+        total += count;
+    }
+
+    if (total != i_msp->ms_nregs)
+        return 0;
+
+    huffman_build(o_hcp, o_hist, nsyms);
+
+    for (size_t ss = 0; ss < nsyms; ++ss)
+        bitsz += (uint64_t) o_hist[ss] * o_hcp->hc_lens[ss];
+
+    *o_codesz = (bitsz + 7) / 8;
+    return ndx;
+}
+
+// Decode i_nregs registers coded with i_hcp from the front of a
+// bitstream of i_size bytes; bits past the end read as zeros.
+//
+static void
+entropy_decode(compreg_t * o_regp,
+               size_t i_nregs,
+               huffman_code_t const * i_hcp,
+               uint8_t const * i_bitp,
+               size_t i_size)
+{
+    // Indexed by the next MS_HUFFMAXLEN bits, multi holds the values
+    // of up to three whole codes in them, their number and their
+    // total length.  Each code owns the range of patterns it starts,
+    // so filling the ranges of every code, then of every pair of codes
+    // inside those and of every triple inside those leaves the longest
+    // run in each entry.
+    uint32_t multi[1 << MS_HUFFMAXLEN];
+    uint8_t order[MS_NREGVALS];
+    size_t ncoded = 0;
+    uint8_t const * endp = &i_bitp[i_size];
+    size_t pos = 0;
+    size_t ii = 0;
+
+    for (size_t len = 1; len <= i_hcp->hc_maxlen; ++len)
+        for (size_t ss = 0; ss < i_hcp->hc_nsyms; ++ss)
+            if (i_hcp->hc_lens[ss] == len)
+                order[ncoded++] = ss;
+
+    for (size_t i1 = 0; i1 < ncoded; ++i1)
+    {
+        size_t s1 = order[i1];
+        size_t l1 = i_hcp->hc_lens[s1];
+        size_t b1 = (size_t) i_hcp->hc_codes[s1] << (MS_HUFFMAXLEN - l1);
+
+        for (size_t kk = 0; kk < ((size_t) 1 << (MS_HUFFMAXLEN - l1)); ++kk)
+            multi[b1 + kk] = s1 | (1 << 24) | (l1 << 26);
+
+        for (size_t i2 = 0; i2 < ncoded; ++i2)
+        {
+            size_t s2 = order[i2];
+            size_t l2 = l1 + i_hcp->hc_lens[s2];
+            size_t b2;
+
+            if (l2 > MS_HUFFMAXLEN)
+                break;
+
+            b2 = b1 | (size_t) i_hcp->hc_codes[s2] << (MS_HUFFMAXLEN - l2);
+            for (size_t kk = 0; kk < ((size_t) 1 << (MS_HUFFMAXLEN - l2)); ++kk)
+                multi[b2 + kk] = s1 | (s2 << 8) | (2 << 24) | (l2 << 26);
+
+            for (size_t i3 = 0; i3 < ncoded; ++i3)
+            {
+                size_t s3 = order[i3];
+                size_t l3 = l2 + i_hcp->hc_lens[s3];
+                size_t b3;
+
+                if (l3 > MS_HUFFMAXLEN)
+                    break;
+
+                b3 = b2 | (size_t) i_hcp->hc_codes[s3] << (MS_HUFFMAXLEN - l3);
+                for (size_t kk = 0; kk < ((size_t) 1 << (MS_HUFFMAXLEN - l3)); ++kk)
+                    multi[b3 + kk] =
+                        s1 | (s2 << 8) | (s3 << 16) | (3 << 24) | (l3 << 26);
+            }
+        }
+    }
+
+    // A fetch leaves at least 57 bits to read, five lookups' worth.
+    // Each lookup stores four bytes; the ones past its values are
+    // overwritten by the next.
+    while (ii + 16 <= i_nregs && pos / 8 + 8 <= i_size)
+    {
+        uint64_t qw = bitstream_fetch(&i_bitp[pos / 8], endp, false)
+            << (pos % 8);
+
+        for (size_t kk = 0; kk < 5; ++kk)
+        {
+            uint32_t ent = multi[qw >> (64 - MS_HUFFMAXLEN)];
+            uint32_t vals = hll_le32(ent);
+
+            // The values go out low byte first.
+            memcpy(&o_regp[ii], &vals, sizeof(vals));
+            ii += (ent >> 24) & 0x3;
+            qw <<= ent >> 26;
+            pos += ent >> 26;
+        }
+    }
+
+    while (ii < i_nregs)
+    {
+        uint64_t qw = pos / 8 < i_size ?
+            bitstream_fetch(&i_bitp[pos / 8], endp, true) << (pos % 8) : 0;
+        uint32_t ent = multi[qw >> (64 - MS_HUFFMAXLEN)];
+        size_t nn = Min((ent >> 24) & 0x3, i_nregs - ii);
+
+        for (size_t kk = 0; kk < nn; ++kk)
+            o_regp[ii++] = (ent >> (8 * kk)) & 0xff;
+        pos += ent >> 26;
+    }
+}
+
+// Unpack a version 4 compressed body into a multiset with its header
+// set.  The registers have to match the counts, which then are the
+// histogram.
+//
+static void
+entropy_unpack(multiset_t * o_msp, uint8_t const * i_bitp, size_t i_size)
+{
+    size_t nvals = (size_t) 1 << o_msp->ms_nbits;
+    uint32_t counts[MS_NREGVALS];
+    huffman_code_t hc;
+    size_t codesz;
+    size_t ndx = entropy_counts(o_msp, i_bitp, i_size, counts, &hc, &codesz);
+    compreg_t * regp;
+
+    if (ndx == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("invalid register counts in compressed hll argument")));
+
+    if (i_size - ndx != codesz)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("inconsistently sized compressed multiset")));
+
+    multiset_reserve(o_msp, compressed_bufsz(o_msp));
+    regp = o_msp->ms_data.as_comp.msc_regs;
+
+    if (hc.hc_maxlen == 0)
+    {
+        for (size_t ss = 0; ss < hc.hc_nsyms; ++ss)
+            if (counts[ss] != 0)
+                memset(regp, ss, o_msp->ms_nregs);
+    }
+    else
+    {
+        entropy_decode(regp, o_msp->ms_nregs, &hc,
+                       &i_bitp[ndx], i_size - ndx);
+    }
+
+    o_msp->ms_data.as_comp.msc_histok = false;
+    if (memcmp(compressed_histogram(o_msp), counts,
+               nvals * sizeof(uint32_t)) != 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("invalid register counts in compressed hll argument")));
+}
+
+// Schema version 5 is packed the same as version 1, except that the
+// registers of a compressed multiset are always packed 8 bits wide,
+// one to a byte, whatever regwidth is.  Unpacking them is a copy and
+// a union with them a register max straight off the bitstream, for
+// 8 / regwidth times the space.  Whether a multiset is packed sparse
+// or compressed is still decided by the version 1 sizes.  There are
+// no summaries and no delta or entropy coding.
+//
+// Width in bits of the packed registers of a compressed multiset.
+//
+static size_t
+packed_regwidth(uint8_t i_vers, size_t i_nbits)
+{
+    return i_vers == 5 ? 8 : i_nbits;
+}
+
+// Are all the registers less than 2^i_nbits?  Byte wide ones can
+// hold larger values.
+//
+static bool
+registers_fit(compreg_t const * i_regp, size_t i_nregs, size_t i_nbits)
+{
+    uint64_t bits = 0;
+    uint64_t high = 0x0101010101010101ULL * ((0xff << i_nbits) & 0xff);
+    size_t ii = 0;
+
+    // Eight registers at a time.
+    for (; ii + 8 <= i_nregs; ii += 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, &i_regp[ii], sizeof(word));
+        bits |= word;
+    }
+    for (; ii < i_nregs; ++ii)
+        bits |= i_regp[ii];
+
+    return (bits & high) == 0;
+}
+
+static uint8_t
+multiset_unpack(multiset_t * o_msp,
+                uint8_t const * i_bitp,
+                size_t i_size,
+                uint8_t * o_encoded_type)
+{
+    // First byte is the version and type header.
+    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
+    uint8_t type = i_bitp[0] & 0xf;
+
+    if (vers < 1 || vers > MS_MAXVERSION)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("unknown schema version %d", (int) vers)));
+
+    if (o_encoded_type != NULL)
+        *o_encoded_type = type;
+
+    // The data is allocated in the caller's memory context.
+    multiset_init(o_msp, CurrentMemoryContext);
+
+    // Set the type. NOTE - MST_SPARSE may be converted to MST_COMPRESSED.
+    o_msp->ms_type = type;
+
+    switch (type)
+    {
+    case MST_EMPTY:
+        if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
+            size_t hdrsz = 3;
+
+            // Make sure the size is consistent.
+            if (i_size != hdrsz)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("inconsistently sized empty multiset")));
+            }
+
+            unpack_header(o_msp, i_bitp, vers, type);
+        }
+        else
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("unsupported empty version %d",
+                            (int) vers)));
+        }
+
+        break;
+
+    case MST_EXPLICIT:
+        if (packed_delta(i_bitp, i_size))
+        {
+            unpack_header(o_msp, i_bitp, vers, type);
+
+            explicit_delta_unpack(o_msp, &i_bitp[3], i_size - 3);
+        }
+        else if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
+            ms_explicit_t * msep = &o_msp->ms_data.as_expl;
+            size_t hdrsz = 3;
+            size_t nelem = (i_size - hdrsz) / 8;
+            size_t ndx = hdrsz;
+
+            // Make sure the size is consistent.
+            if (((i_size - hdrsz) % 8) != 0)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("inconsistently sized explicit multiset")));
+            }
+
+            // Make sure the explicit array fits in memory.
+            if ((i_size - hdrsz) > MS_MAXDATA)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("explicit multiset too large")));
+            }
+
+            unpack_header(o_msp, i_bitp, vers, type);
+
+            multiset_reserve(o_msp, nelem * sizeof(uint64_t));
+
+            msep->mse_nelem = nelem;
+            msep->mse_nsorted = nelem;
+            for (size_t ii = 0; ii < nelem; ++ii)
+            {
+                uint64_t val = 0;
+                val |= ((uint64_t) i_bitp[ndx++] << 56);
+                val |= ((uint64_t) i_bitp[ndx++] << 48);
+                val |= ((uint64_t) i_bitp[ndx++] << 40);
+                val |= ((uint64_t) i_bitp[ndx++] << 32);
+                val |= ((uint64_t) i_bitp[ndx++] << 24);
+                val |= ((uint64_t) i_bitp[ndx++] << 16);
+                val |= ((uint64_t) i_bitp[ndx++] <<  8);
+                val |= ((uint64_t) i_bitp[ndx++] <<  0);
+                msep->mse_elems[ii] = val;
+            }
+
+            explicit_validate(o_msp, msep);
+        }
+        else
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("unsupported explicit version %d",
+                            (int) vers)));
+        }
+        break;
+
+    case MST_COMPRESSED:
+        if (packed_entropy(i_bitp, i_size))
+        {
+            unpack_header(o_msp, i_bitp, vers, type);
+
+            // Make sure the compressed array fits in memory.
+            if (o_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("compressed multiset too large")));
+            }
+
+            entropy_unpack(o_msp, &i_bitp[3], i_size - 3);
+        }
+        else if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
+            size_t hdrsz = packed_hdrsz(i_bitp, i_size);
+
+            // Decode the parameter byte.
+            uint8_t param = i_bitp[1];
+            size_t nbits = (param >> 5) + 1;
+            size_t log2nregs = param & 0x1f;
+            size_t nregs = 1 << log2nregs;
+            size_t width = packed_regwidth(vers, nbits);
+
+            // Make sure the size is consistent.
+            size_t bitsz = width * nregs;
+            size_t packedbytesz = (bitsz + 7) / 8;
+            if ((i_size - hdrsz) != packedbytesz)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("inconsistently sized "
+                                "compressed multiset")));
+            }
+
+            // Make sure the compressed array fits in memory.
+            if (nregs * sizeof(compreg_t) > MS_MAXDATA)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("compressed multiset too large")));
+            }
+
+            unpack_header(o_msp, i_bitp, vers, type);
+
+            multiset_reserve(o_msp, compressed_bufsz(o_msp));
+
+            // Fill the registers.
+            compressed_unpack(o_msp->ms_data.as_comp.msc_regs,
+                              width, nregs, &i_bitp[hdrsz], i_size - hdrsz,
+                              vers);
+            o_msp->ms_data.as_comp.msc_histok = false;
+
+            if (width != nbits &&
+                !registers_fit(o_msp->ms_data.as_comp.msc_regs, nregs, nbits))
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("invalid register value "
+                                "in compressed hll argument")));
+            }
+        }
+        else
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("unsupported compressed version %d",
+                            (int) vers)));
+        }
+        break;
+
+    case MST_UNDEFINED:
+        if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
+            size_t hdrsz = 3;
+
+            // Make sure the size is consistent.
+            if (i_size != hdrsz)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("undefined multiset value")));
+            }
+
+            unpack_header(o_msp, i_bitp, vers, type);
+        }
+        else
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("unsupported undefined version %d",
+                            (int) vers)));
+        }
+
+        break;
+
+    case MST_SPARSE:
+        if (packed_delta(i_bitp, i_size))
+        {
+            unpack_header(o_msp, i_bitp, vers, type);
+
+            // Make sure the compressed array fits in memory.
+            if (o_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("sparse multiset too large")));
+            }
+
+            sparse_delta_unpack(o_msp, &i_bitp[3], i_size - 3);
+        }
+        else if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
+            size_t hdrsz = packed_hdrsz(i_bitp, i_size);
+
+            ms_compressed_t * mscp;
+
+            if (i_size < hdrsz)
+            {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("sparse multiset too small")));
+            }
+            else
+            {
+                // Decode the parameter byte.
+                uint8_t param = i_bitp[1];
+                size_t nbits = (param >> 5) + 1;
+                size_t log2nregs = param & 0x1f;
+                size_t nregs = 1 << log2nregs;
+
+                // Figure out how many encoded registers are in the
+                // bitstream.  We depend on the log2nregs + nbits being
+                // greater then the pad size so we aren't left with
+                // ambiguity in the final pad byte.
+
+                size_t bitsz = (i_size - hdrsz) * 8;
+                size_t chunksz = log2nregs + nbits;
+                size_t nfilled = bitsz / chunksz;
+
+                // Make sure the compressed array fits in memory.
+                if (nregs * sizeof(compreg_t) > MS_MAXDATA)
+                {
+                    ereport(ERROR,
+                            (errcode(ERRCODE_DATA_EXCEPTION),
+                             errmsg("sparse multiset too large")));
+                }
+
+                unpack_header(o_msp, i_bitp, vers, type);
+
+                // Fail fast if the pad size doesn't make sense.
+                if (bitsz - chunksz * nfilled >= 8)
+                    ereport(ERROR,
+                            (errcode(ERRCODE_DATA_EXCEPTION),
+                             errmsg("inconsistent padding "
+                                    "in sparse hll argument")));
+
+                // Stay sparse in memory if we can.
+                if (sparse_unpack_slots(o_msp, nfilled,
+                                        &i_bitp[hdrsz], i_size - hdrsz))
+                    break;
+
+                o_msp->ms_type = MST_COMPRESSED;
+
+                multiset_reserve(o_msp, compressed_bufsz(o_msp));
+
+                mscp = &o_msp->ms_data.as_comp;
+                mscp->msc_histok = false;
+
+                // Pre-zero the registers since sparse only fills
+                // in occasional ones.
+                //
+                for (int ii = 0; ii < nregs; ++ii)
+                    mscp->msc_regs[ii] = 0;
+
+                // Fill the registers.
+                sparse_unpack(mscp->msc_regs,
+                              nbits, log2nregs, nfilled,
+                              &i_bitp[hdrsz], i_size - hdrsz);
+            }
+        }
+        else
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("unsupported sparse version %d",
+                            (int) vers)));
+        }
+        break;
+
+    default:
+        // This is always an error.
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type")));
+        break;
+    }
+
+    return vers;
+}
+
+// Unpack just the metadata of a packed multiset, for callers that need
+// nothing else.  Only the first i_size bytes, enough for the header
+// and any summary, need to be present; i_totsz is the size of the
+// whole value, which is checked against its type and parameters the
+// same as multiset_unpack does.  The registers are neither read nor
+// validated, and o_msp holds no data.  The size of a delta coded
+// explicit or sparse multiset depends on all of it, so only its entry
+// count is checked, and of an entropy coded compressed one only that
+// it fits in memory.
+//
+static uint8_t
+multiset_unpack_header(multiset_t * o_msp,
+                       uint8_t const * i_bitp,
+                       size_t i_size,
+                       size_t i_totsz,
+                       uint8_t * o_encoded_type)
+{
+    uint8_t vers;
+    uint8_t type;
+    size_t hdrsz;
+
+    if (i_size < 3)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("multiset header too small")));
+
+    vers = (i_bitp[0] >> 4) & 0xf;
+    type = i_bitp[0] & 0xf;
+
+    if (vers < 1 || vers > MS_MAXVERSION)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("unknown schema version %d", (int) vers)));
+
+    if (o_encoded_type != NULL)
+        *o_encoded_type = type;
+
+    multiset_init(o_msp, CurrentMemoryContext);
+    o_msp->ms_type = type;
+
+    unpack_header(o_msp, i_bitp, vers, type);
+
+    hdrsz = packed_hdrsz(i_bitp, i_size);
+
+    if (packed_delta(i_bitp, i_size))
+    {
+        uint64_t nents;
+        size_t cntsz = varint_unpack(&i_bitp[3], Min(i_size, i_totsz) - 3,
+                                     &nents);
+
+        // IMPORTANT - matching checks in explicit_delta_unpack and
+        // sparse_delta_unpack!
+        if (type == MST_EXPLICIT)
+        {
+            if (cntsz == 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("inconsistently sized explicit multiset")));
+
+            if (nents * sizeof(uint64_t) > MS_MAXDATA)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("explicit multiset too large")));
+        }
+        else
+        {
+            if (o_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("sparse multiset too large")));
+
+            if (cntsz == 0 || nents > o_msp->ms_nregs)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("inconsistently sized sparse multiset")));
+        }
+
+        return vers;
+    }
+
+    // IMPORTANT - matching check in multiset_unpack!
+    if (packed_entropy(i_bitp, i_size))
+    {
+        if (o_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("compressed multiset too large")));
+
+        return vers;
+    }
+
+    // IMPORTANT - matching checks in multiset_unpack!
+    switch (type)
+    {
+    case MST_EMPTY:
+        if (i_totsz != hdrsz)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("inconsistently sized empty multiset")));
+        break;
+
+    case MST_UNDEFINED:
+        if (i_totsz != hdrsz)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("undefined multiset value")));
+        break;
+
+    case MST_EXPLICIT:
+        if (((i_totsz - hdrsz) % 8) != 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("inconsistently sized explicit multiset")));
+
+        if ((i_totsz - hdrsz) > MS_MAXDATA)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("explicit multiset too large")));
+        break;
+
+    case MST_COMPRESSED:
+        if (i_totsz < hdrsz ||
+            (i_totsz - hdrsz) !=
+            (packed_regwidth(vers, o_msp->ms_nbits) * o_msp->ms_nregs + 7) / 8)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("inconsistently sized "
+                            "compressed multiset")));
+
+        if (o_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("compressed multiset too large")));
+        break;
+
+    case MST_SPARSE:
+        {
+            size_t bitsz;
+            size_t chunksz = o_msp->ms_log2nregs + o_msp->ms_nbits;
+
+            if (i_totsz < hdrsz)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("sparse multiset too small")));
+
+            if (o_msp->ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("sparse multiset too large")));
+
+            bitsz = (i_totsz - hdrsz) * 8;
+            if (bitsz % chunksz >= 8)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_EXCEPTION),
+                         errmsg("inconsistent padding "
+                                "in sparse hll argument")));
+        }
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type")));
+        break;
+    }
+
+    return vers;
+}
+
+static size_t
+pack_header(uint8_t * o_bitp,
+            uint8_t vers,
+            uint8_t type,
+            size_t nbits,
+            size_t log2nregs,
+            int64 expthresh,
+            size_t sparseon)
+{
+    size_t ndx = 0;
+
+    o_bitp[ndx++] = (vers << 4) | type;
+    o_bitp[ndx++] = ((nbits - 1) << 5) | log2nregs;
+    o_bitp[ndx++] = (sparseon << 6) | encode_expthresh(expthresh);
+
+    return ndx;
+}
+
+static double multiset_card(multiset_t const * i_msp);
+static void register_histogram(multiset_t const * i_msp, uint32_t * o_hist);
+
+// Write the version 2 summary of a sparse or compressed multiset after
+// its header, see packed_summary.
+//
+static size_t
+pack_summary(multiset_t const * i_msp, uint8_t * o_bitp, size_t i_ndx)
+{
+    double card = multiset_card(i_msp);
+    uint32_t nfilled = numfilled(i_msp);
+    uint64_t bits;
+
+    memcpy(&bits, &card, sizeof(double));
+
+    o_bitp[2] |= MS_SUMMARYFLAG;
+
+    for (int ii = 56; ii >= 0; ii -= 8)
+        o_bitp[i_ndx++] = (bits >> ii) & 0xff;
+    for (int ii = 24; ii >= 0; ii -= 8)
+        o_bitp[i_ndx++] = (nfilled >> ii) & 0xff;
+
+    return i_ndx;
+}
+
+static void
+multiset_pack(multiset_t const * i_msp, uint8_t * o_bitp, size_t i_size)
+{
+    uint8_t vers = g_output_version;
+
+    size_t nbits = i_msp->ms_nbits;
+    size_t log2nregs = i_msp->ms_log2nregs;
+    int64 expthresh = i_msp->ms_expthresh;
+    size_t sparseon = i_msp->ms_sparseon;
+
+    switch (i_msp->ms_type)
+    {
+    case MST_EMPTY:
+        pack_header(o_bitp, vers, MST_EMPTY,
+                    nbits, log2nregs, expthresh, sparseon);
+        break;
+
+    case MST_EXPLICIT:
+        {
+            ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+            size_t size = msep->mse_nelem;
+
+            size_t ndx = pack_header(o_bitp, vers, MST_EXPLICIT,
+                                     nbits, log2nregs, expthresh, sparseon);
+
+            // IMPORTANT - matching code in multiset_packed_size!
+            if ((vers == 3 || vers == 4) &&
+                explicit_delta_pack(msep, NULL) < 8 * size)
+            {
+                o_bitp[2] |= MS_DELTAFLAG;
+                explicit_delta_pack(msep, &o_bitp[ndx]);
+                break;
+            }
+
+            for (size_t ii = 0; ii < size; ++ii)
+            {
+                uint64_t val = msep->mse_elems[ii];
+
+                o_bitp[ndx++] = (val >> 56) & 0xff;
+                o_bitp[ndx++] = (val >> 48) & 0xff;
+                o_bitp[ndx++] = (val >> 40) & 0xff;
+                o_bitp[ndx++] = (val >> 32) & 0xff;
+                o_bitp[ndx++] = (val >> 24) & 0xff;
+                o_bitp[ndx++] = (val >> 16) & 0xff;
+                o_bitp[ndx++] = (val >>  8) & 0xff;
+                o_bitp[ndx++] = (val >>  0) & 0xff;
+            }
+        }
+        break;
+
+    case MST_SPARSE:
+    case MST_COMPRESSED:
+        {
+            compreg_t const * regp = i_msp->ms_data.as_comp.msc_regs;
+            size_t nregs = i_msp->ms_nregs;
+            size_t nfilled = numfilled(i_msp);
+            uint32_t * slots = NULL;
+            bool delta = false;
+            uint32_t hist[MS_NREGVALS];
+            bool entropy = false;
+
+            // Should we pack this as MST_SPARSE or MST_COMPRESSED?
+            // IMPORTANT - matching code in multiset_packed_size!
+            size_t sparsebitsz;
+            size_t cmprssbitsz;
+            sparsebitsz = nfilled * (log2nregs + nbits);
+            cmprssbitsz = nregs * nbits;
+
+            // Version 3 can delta code the sparse registers instead.
+            if ((vers == 3 || vers == 4) && sparseon)
+            {
+                size_t deltasz;
+
+                slots = registers_sorted(i_msp);
+                deltasz = sparse_delta_pack(slots, nfilled, nbits, NULL);
+                if (deltasz < (sparsebitsz + 7) / 8)
+                {
+                    sparsebitsz = deltasz * 8;
+                    delta = true;
+                }
+            }
+
+            // Version 4 can entropy code the compressed registers.
+            if (vers == 4)
+            {
+                size_t entropysz;
+
+                register_histogram(i_msp, hist);
+                entropysz = entropy_pack(NULL, nregs, hist,
+                                         (size_t) 1 << nbits, NULL);
+                if (entropysz < (cmprssbitsz + 7) / 8)
+                {
+                    cmprssbitsz = entropysz * 8;
+                    entropy = true;
+                }
+            }
+
+            // If the vector does not have sparse enabled use
+            // compressed.
+            //
+            // If the vector is smaller then the max sparse size use
+            // compressed.
+            //
+            // If the max sparse size is auto (-1) use if smaller then
+            // compressed.
+            //
+            if (sparseon &&
+                ((g_max_sparse != -1 && nfilled <= g_max_sparse) ||
+                 (g_max_sparse == -1 && sparsebitsz < cmprssbitsz)))
+            {
+                size_t ndx = pack_header(o_bitp, vers, MST_SPARSE,
+                                         nbits, log2nregs, expthresh, sparseon);
+
+                if (vers == 2)
+                    ndx = pack_summary(i_msp, o_bitp, ndx);
+
+                // Marshal the registers.
+                if (delta)
+                {
+                    o_bitp[2] |= MS_DELTAFLAG;
+                    sparse_delta_pack(slots, nfilled, nbits, &o_bitp[ndx]);
+                }
+                else if (i_msp->ms_type == MST_SPARSE)
+                    sparse_pack_slots(i_msp, &o_bitp[ndx], i_size - ndx);
+                else
+                    sparse_pack(regp,
+                                nbits, nregs, log2nregs, nfilled,
+                                &o_bitp[ndx], i_size - ndx);
+            }
+            else
+            {
+                size_t ndx = pack_header(o_bitp, vers, MST_COMPRESSED,
+                                         nbits, log2nregs, expthresh, sparseon);
+
+                if (vers == 2)
+                    ndx = pack_summary(i_msp, o_bitp, ndx);
+
+                // Sparse registers need to be expanded first.
+                if (i_msp->ms_type == MST_SPARSE)
+                {
+                    ms_sparse_t const * mssp = &i_msp->ms_data.as_sprs;
+                    compreg_t * regs = (compreg_t *) palloc0(nregs);
+                    sparse_expand(regs, mssp->mss_slots, mssp->mss_nslots);
+                    regp = regs;
+                }
+
+                // Marshal the registers.
+                if (entropy)
+                {
+                    o_bitp[2] |= MS_ENTROPYFLAG;
+                    entropy_pack(regp, nregs, hist, (size_t) 1 << nbits,
+                                 &o_bitp[ndx]);
+                }
+                else
+                    compressed_pack(regp, packed_regwidth(vers, nbits), nregs,
+                                    &o_bitp[ndx], i_size - ndx, vers);
+            }
+
+            if (slots != NULL)
+                pfree(slots);
+            break;
+        }
+
+    case MST_UNDEFINED:
+        pack_header(o_bitp, vers, MST_UNDEFINED,
+                    nbits, log2nregs, expthresh, sparseon);
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type value #2")));
+        break;
+    }
+}
+
+// Size of the data (explicit elements or registers) of a multiset.
+//
+static size_t
+multiset_copy_size(multiset_t const * i_msp)
+{
+    size_t retval = 0;
+
+    switch (i_msp->ms_type)
+    {
+    case MST_EMPTY:
+        retval = 0;
+        break;
+
+    case MST_EXPLICIT:
+        {
+            ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+            retval = msep->mse_nelem * sizeof(uint64_t);
+        }
+        break;
+
+    case MST_SPARSE:
+        {
+            ms_sparse_t const * mssp = &i_msp->ms_data.as_sprs;
+            retval = mssp->mss_nslots * sizeof(uint32_t);
+        }
+        break;
+
+    case MST_COMPRESSED:
+        {
+            retval = i_msp->ms_nregs * sizeof(compreg_t);
+        }
+        break;
+
+    case MST_UNDEFINED:
+    case MST_UNINIT:
+        retval = 0;
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type value #3")));
+        break;
+    }
+
+    return retval;
+}
+
+// Copy a multiset; the data is copied into o_msp's own buffer.
+//
+static void
+multiset_copy(multiset_t * o_msp, multiset_t const * i_msp)
+{
+    size_t datasz = multiset_copy_size(i_msp);
+
+    memcpy(o_msp, i_msp, MS_HDRSZ);
+
+    if (i_msp->ms_type == MST_EXPLICIT)
+    {
+        o_msp->ms_data.as_expl.mse_nelem = i_msp->ms_data.as_expl.mse_nelem;
+        o_msp->ms_data.as_expl.mse_nsorted =
+            i_msp->ms_data.as_expl.mse_nsorted;
+    }
+
+    if (i_msp->ms_type == MST_SPARSE)
+    {
+        o_msp->ms_data.as_sprs.mss_nslots = i_msp->ms_data.as_sprs.mss_nslots;
+        o_msp->ms_data.as_sprs.mss_nfilled =
+            i_msp->ms_data.as_sprs.mss_nfilled;
+    }
+
+    // Bring the register histogram along.
+    if (i_msp->ms_type == MST_COMPRESSED)
+    {
+        datasz = compressed_bufsz(i_msp);
+        o_msp->ms_data.as_comp.msc_histok =
+            i_msp->ms_data.as_comp.msc_histok;
+    }
+
+    if (datasz > 0)
+    {
+        multiset_reserve(o_msp, datasz);
+        memcpy(o_msp->ms_data.as_buf, i_msp->ms_data.as_buf, datasz);
+    }
+}
+
+// Size of the packed multiset.  Sets *o_type, unless it's NULL, to the
+// type it's packed as.
+//
+static size_t
+multiset_packed_size(multiset_t const * i_msp, int * o_type)
+{
+    uint8_t vers = g_output_version;
+
+    size_t retval = 0;
+    int type = i_msp->ms_type;
+
+    switch (i_msp->ms_type)
+    {
+    case MST_EMPTY:
+        switch (vers)
+        {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+            retval = 3;
+            break;
+        default:
+            Assert(vers >= 1 && vers <= MS_MAXVERSION);
+        }
+        break;
+
+    case MST_EXPLICIT:
+        switch (vers)
+        {
+        case 1:
+        case 2:
+        case 5:
+            {
+                ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+                retval = 3 + (8 * msep->mse_nelem);
+            }
+            break;
+        case 3:
+        case 4:
+            {
+                ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
+                retval = 3 + Min(explicit_delta_pack(msep, NULL),
+                                 8 * msep->mse_nelem);
+            }
+            break;
+        default:
+            Assert(vers >= 1 && vers <= MS_MAXVERSION);
+        }
+        break;
+
+    case MST_SPARSE:
+    case MST_COMPRESSED:
+        if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
+            size_t hdrsz = vers == 2 ? MS_MAXHDRSZ : 3;
+            size_t nbits = i_msp->ms_nbits;
+            size_t nregs = i_msp->ms_nregs;
+            size_t nfilled = numfilled(i_msp);
+            size_t log2nregs = i_msp->ms_log2nregs;
+            size_t sparseon = i_msp->ms_sparseon;
+            size_t sparsebitsz;
+            size_t cmprssbitsz;
+
+            // Should we pack this as MST_SPARSE or MST_COMPRESSED?
+            // IMPORTANT - matching code in multiset_pack!
+            //
+            sparsebitsz = numfilled(i_msp) * (log2nregs + nbits);
+            cmprssbitsz = nregs * nbits;
+
+            if ((vers == 3 || vers == 4) && sparseon)
+            {
+                uint32_t * slots = registers_sorted(i_msp);
+                size_t deltasz = sparse_delta_pack(slots, nfilled, nbits,
+                                                   NULL);
+                if (deltasz < (sparsebitsz + 7) / 8)
+                    sparsebitsz = deltasz * 8;
+                pfree(slots);
+            }
+
+            if (vers == 4)
+            {
+                uint32_t hist[MS_NREGVALS];
+                size_t entropysz;
+
+                register_histogram(i_msp, hist);
+                entropysz = entropy_pack(NULL, nregs, hist,
+                                         (size_t) 1 << nbits, NULL);
+                if (entropysz < (cmprssbitsz + 7) / 8)
+                    cmprssbitsz = entropysz * 8;
+            }
+
+            // If the vector does not have sparse enabled use
+            // compressed.
+            //
+            // If the vector is smaller then the max sparse size use
+            // compressed.
+            //
+            // If the max sparse size is auto (-1) use if smaller then
+            // compressed.
+            //
+            if (sparseon &&
+                ((g_max_sparse != -1 && nfilled <= g_max_sparse) ||
+                 (g_max_sparse == -1 && sparsebitsz < cmprssbitsz)))
+
+            {
+                // MST_SPARSE is more compact.
+                retval = hdrsz + ((sparsebitsz + 7) / 8);
+                type = MST_SPARSE;
+            }
+            else
+            {
+                // MST_COMPRESSED is more compact.
+                type = MST_COMPRESSED;
+                if (vers == 5)
+                    cmprssbitsz = nregs * packed_regwidth(vers, nbits);
+                retval = hdrsz + ((cmprssbitsz + 7) / 8);
+            }
+        }
+        else
+        {
+            Assert(vers >= 1 && vers <= MS_MAXVERSION);
+        }
+        break;
+
+    case MST_UNDEFINED:
+        if (vers >= 1 && vers <= MS_MAXVERSION)
+        {
             size_t hdrsz = 3;
+            retval = hdrsz;
+        }
+        else
+        {
+            Assert(vers >= 1 && vers <= MS_MAXVERSION);
+        }
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type value #4")));
+        break;
+    }
+
+    if (o_type != NULL)
+        *o_type = type;
+
+    return retval;
+}
+
+static uint8_t multiset_validate(multiset_t * o_msp,
+                                 uint8_t const * i_bitp,
+                                 size_t i_size);
+
+// Make sure a multiset has the metadata declared by a column's type
+// modifiers.
+//
+static void
+check_typmod(int32 typmod, multiset_t const * i_msp)
+{
+    multiset_t msx;
+
+    // Create a placeholder w/ declared metadata.
+    msx.ms_nbits = typmod_regwidth(typmod);
+    msx.ms_log2nregs = typmod_log2m(typmod);
+    msx.ms_nregs = (1 << msx.ms_log2nregs);
+    msx.ms_expthresh = decode_expthresh(typmod_expthresh(typmod));
+    msx.ms_sparseon = typmod_sparseon(typmod);
+
+    check_metadata(&msx, i_msp);
+}
+
+// Fetch the leading bytes of an hll argument, enough for its header
+// and any summary, without detoasting the rest of a toasted value.
+// Sets *o_size to the number of bytes fetched and *o_totsz to the size
+// of the whole value.
+//
+static uint8_t const *
+hll_arg_header(FunctionCallInfo fcinfo,
+               int i_argno,
+               size_t * o_size,
+               size_t * o_totsz)
+{
+    Datum dd = PG_GETARG_DATUM(i_argno);
+    bytea * bp;
+
+    if (VARATT_IS_EXTERNAL(DatumGetPointer(dd)) ||
+        VARATT_IS_COMPRESSED(DatumGetPointer(dd)))
+    {
+        *o_totsz = toast_raw_datum_size(dd) - VARHDRSZ;
+        bp = DatumGetByteaPSlice(dd, 0, MS_MAXHDRSZ);
+        *o_size = VARSIZE(bp) - VARHDRSZ;
+        return (uint8_t const *) VARDATA(bp);
+    }
+
+    // Short varlena headers are fine, we only read the bytes.
+    bp = PG_GETARG_BYTEA_PP(i_argno);
+    *o_totsz = VARSIZE_ANY_EXHDR(bp);
+    *o_size = *o_totsz;
+    return (uint8_t const *) VARDATA_ANY(bp);
+}
+
+PG_FUNCTION_INFO_V1(hll_in);
+Datum		hll_in(PG_FUNCTION_ARGS);
+Datum
+hll_in(PG_FUNCTION_ARGS)
+{
+    char const * str = PG_GETARG_CSTRING(0);
+    Datum dd;
+    bytea * bp;
+    size_t sz;
+    multiset_t ms;
+
+    int32 typmod = PG_GETARG_INT32(2);
+
+    if (str[0] == '\\' && str[1] == 'b')
+        dd = PointerGetDatum(base64_decode(&str[2]));
+    else
+        dd = DirectFunctionCall1(byteain, PG_GETARG_DATUM(0));
+
+    // Make sure the data is valid, without unpacking it.
+    bp = DatumGetByteaP(dd);
+    sz = VARSIZE(bp) - VARHDRSZ;
+    multiset_validate(&ms, (uint8_t *) VARDATA(bp), sz);
+
+    // The typmod value will be valid for COPY and \COPY statements.
+    // Check the metadata consistency in these cases.
+    if (typmod != -1)
+        check_typmod(typmod, &ms);
+
+    return dd;
+}
+
+PG_FUNCTION_INFO_V1(hll_out);
+Datum		hll_out(PG_FUNCTION_ARGS);
+Datum
+hll_out(PG_FUNCTION_ARGS)
+{
+    bytea * bp;
+    size_t sz;
+    char * str;
+    size_t len;
+
+    if (g_output_format != OUTPUT_FORMAT_BASE64)
+        return DirectFunctionCall1(byteaout, PG_GETARG_DATUM(0));
+
+    bp = PG_GETARG_BYTEA_PP(0);
+    sz = VARSIZE_ANY_EXHDR(bp);
+    str = (char *) palloc(2 + BASE64_ENCODED_SIZE(sz) + 1);
+    str[0] = '\\';
+    str[1] = 'b';
+    len = base64_encode(&str[2], (uint8_t const *) VARDATA_ANY(bp), sz);
+    str[2 + len] = '\0';
+
+    PG_RETURN_CSTRING(str);
+}
+
+PG_FUNCTION_INFO_V1(hll);
+Datum		hll(PG_FUNCTION_ARGS);
+Datum
+hll(PG_FUNCTION_ARGS)
+{
+    Datum dd = PG_GETARG_DATUM(0);
+    size_t hsz;
+    size_t sz;
+    uint8_t const * hbitp = hll_arg_header(fcinfo, 0, &hsz, &sz);
+    int32 typmod = PG_GETARG_INT32(1);	// !! DIFFERENT THEN IN hll_in!
+    bool isexplicit = PG_GETARG_BOOL(2); // explicit cast, not explicit vector
+
+    multiset_t ms;
+
+    // The metadata and size are all we check, so leave the registers
+    // of a toasted value where they are.
+    multiset_unpack_header(&ms, hbitp, hsz, sz, NULL);
+
+    // Make the compiler happpy.
+    (void) isexplicit;
+
+    // Make sure the declared metadata matches the incoming.
+    check_typmod(typmod, &ms);
+
+    // If we make it here we're good.
+    return dd;
+}
+
+PG_FUNCTION_INFO_V1(hll_hashval_in);
+Datum		hll_hashval_in(PG_FUNCTION_ARGS);
+Datum
+hll_hashval_in(PG_FUNCTION_ARGS)
+{
+    Datum dd = DirectFunctionCall1(int8in, PG_GETARG_DATUM(0));
+    return dd;
+}
+
+PG_FUNCTION_INFO_V1(hll_hashval_out);
+Datum		hll_hashval_out(PG_FUNCTION_ARGS);
+Datum
+hll_hashval_out(PG_FUNCTION_ARGS)
+{
+    Datum dd = DirectFunctionCall1(int8out, PG_GETARG_DATUM(0));
+    return dd;
+}
+
+PG_FUNCTION_INFO_V1(hll_hashval_eq);
+Datum		hll_hashval_eq(PG_FUNCTION_ARGS);
+Datum
+hll_hashval_eq(PG_FUNCTION_ARGS)
+{
+    int64 aa = PG_GETARG_INT64(0);
+    int64 bb = PG_GETARG_INT64(1);
+    PG_RETURN_BOOL(aa == bb);
+}
+
+PG_FUNCTION_INFO_V1(hll_hashval_ne);
+Datum		hll_hashval_ne(PG_FUNCTION_ARGS);
+Datum
+hll_hashval_ne(PG_FUNCTION_ARGS)
+{
+    int64 aa = PG_GETARG_INT64(0);
+    int64 bb = PG_GETARG_INT64(1);
+    PG_RETURN_BOOL(aa != bb);
+}
+
+PG_FUNCTION_INFO_V1(hll_hashval);
+Datum		hll_hashval(PG_FUNCTION_ARGS);
+Datum
+hll_hashval(PG_FUNCTION_ARGS)
+{
+    int64 aa = PG_GETARG_INT64(0);
+    PG_RETURN_INT64(aa);
+}
+
+PG_FUNCTION_INFO_V1(hll_hashval_int4);
+Datum		hll_hashval_int4(PG_FUNCTION_ARGS);
+Datum
+hll_hashval_int4(PG_FUNCTION_ARGS)
+{
+    int32 aa = PG_GETARG_INT32(0);
+    int64 aaaa = aa;	// extend value to 64 bits.
+    PG_RETURN_INT64(aaaa);
+}
+
+static void
+check_modifiers(int32 log2m, int32 regwidth, int64 expthresh, int32 sparseon)
+{
+    // Range check each of the modifiers.
+    if (log2m < 0 || log2m > MAX_BITVAL(LOG2M_BITS))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("log2m modifier must be between 0 and 31")));
+
+    if (regwidth < 0 || regwidth > MAX_BITVAL(REGWIDTH_BITS))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("regwidth modifier must be between 0 and 7")));
+
+    if (expthresh < -1 || expthresh > 4294967296LL)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("expthresh modifier must be between -1 and 2^32")));
+
+    if (expthresh > 0 && (1LL << integer_log2(expthresh)) != expthresh)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("expthresh modifier must be power of 2")));
+
+    if (sparseon < 0 || sparseon > MAX_BITVAL(SPARSEON_BITS))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("sparseon modifier must be 0 or 1")));
+}
+
+// This routine is cloned from the arrayutils ArrayGetIntegerTypmods
+// and converted to return 64 bit integers.
+//
+static int64 *
+ArrayGetInteger64Typmods(ArrayType *arr, int *n)
+{
+	int64	   *result;
+	Datum	   *elem_values;
+	int			i;
+
+	if (ARR_ELEMTYPE(arr) != CSTRINGOID)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_ELEMENT_ERROR),
+				 errmsg("typmod array must be type cstring[]")));
+
+	if (ARR_NDIM(arr) != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("typmod array must be one-dimensional")));
+
+	if (array_contains_nulls(arr))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("typmod array must not contain nulls")));
+
+	/* hardwired knowledge about cstring's representation details here */
+	deconstruct_array(arr, CSTRINGOID,
+					  -2, false, 'c',
+					  &elem_values, NULL, n);
+
+	result = (int64 *) palloc(*n * sizeof(int64));
+
+	for (i = 0; i < *n; i++)
+    {
+        char * endp = NULL;
+        result[i] = strtoll(DatumGetCString(elem_values[i]), &endp, 0);
+        if (*endp != '\0')
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("typmod array must contain integers")));
+    }
+
+	pfree(elem_values);
+
+	return result;
+}
+
+PG_FUNCTION_INFO_V1(hll_typmod_in);
+Datum		hll_typmod_in(PG_FUNCTION_ARGS);
+Datum
+hll_typmod_in(PG_FUNCTION_ARGS)
+{
+	ArrayType *	ta = PG_GETARG_ARRAYTYPE_P(0);
+	int64 * tl;
+	int nmods;
+    int32 typmod;
+    int32 log2m;
+    int32 regwidth;
+    int64 expthresh;
+    int32 sparseon;
+
+	tl = ArrayGetInteger64Typmods(ta, &nmods);
+
+    // Make sure the number of type modifiers is in a valid range.
+    if (nmods > 4 || nmods < 0)
+    {
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid number of type modifiers")));
+		typmod = 0;				/* keep compiler quiet */
+    }
+    else
+    {
+        // Process the type modifiers, supply defaults if necessary.
+        log2m =		(nmods >= 1) ? tl[0] : g_default_log2m;
+        regwidth =	(nmods >= 2) ? tl[1] : g_default_regwidth;
+        expthresh =	(nmods >= 3) ? tl[2] : g_default_expthresh;
+        sparseon =	(nmods == 4) ? tl[3] : g_default_sparseon;
+
+        check_modifiers(log2m, regwidth, expthresh, sparseon);
+
+        // Construct the typmod value.
+        typmod =
+            (log2m << (TYPMOD_BITS - LOG2M_BITS)) |
+            (regwidth << (TYPMOD_BITS - LOG2M_BITS - REGWIDTH_BITS)) |
+            (encode_expthresh(expthresh) <<
+                         (TYPMOD_BITS - LOG2M_BITS - REGWIDTH_BITS -
+                           EXPTHRESH_BITS)) |
+            (sparseon << (TYPMOD_BITS - LOG2M_BITS - REGWIDTH_BITS -
+                          EXPTHRESH_BITS - SPARSEON_BITS));
+    }
+
+	PG_RETURN_INT32(typmod);
+}
+
+PG_FUNCTION_INFO_V1(hll_typmod_out);
+Datum		hll_typmod_out(PG_FUNCTION_ARGS);
+Datum
+hll_typmod_out(PG_FUNCTION_ARGS)
+{
+    int32 typmod = (uint32) PG_GETARG_INT32(0);
+    int32 log2m = typmod_log2m(typmod);
+    int32 regwidth = typmod_regwidth(typmod);
+    int64 expthresh = decode_expthresh(typmod_expthresh(typmod));
+    int32 sparseon = typmod_sparseon(typmod);
 
-            // Decode the parameter byte.
-            uint8_t param = i_bitp[1];
-            size_t nbits = (param >> 5) + 1;
-            size_t log2nregs = param & 0x1f;
-            size_t nregs = 1 << log2nregs;
+    char buffer[1024];
+    size_t len;
+    char * typmodstr;
 
-            // Make sure the size is consistent.
-            size_t bitsz = nbits * nregs;
-            size_t packedbytesz = (bitsz + 7) / 8;
-            if ((i_size - hdrsz) != packedbytesz)
+    memset(buffer, '\0', sizeof(buffer));
+    snprintf(buffer, sizeof(buffer), "(%d,%d,%ld,%d)",
+             log2m, regwidth, expthresh, sparseon);
+
+    len = strlen(buffer) + 1;
+    typmodstr = (char *) palloc(len);
+    strncpy(typmodstr, buffer, len);
+
+	PG_RETURN_CSTRING(typmodstr);
+}
+
+static void
+multiset_union(multiset_t * o_msap, multiset_t const * i_msbp)
+{
+    int typea = o_msap->ms_type;
+    int typeb = i_msbp->ms_type;
+
+    // If either multiset is MST_UNDEFINED result is MST_UNDEFINED.
+    if (typea == MST_UNDEFINED || typeb == MST_UNDEFINED)
+    {
+        o_msap->ms_type = MST_UNDEFINED;
+        return;
+    }
+
+    // If B is MST_EMPTY, we're done, A is unchanged.
+    if (typeb == MST_EMPTY)
+        return;
+
+    // If A is MST_EMPTY, return B instead.
+    if (typea == MST_EMPTY)
+    {
+        multiset_copy(o_msap, i_msbp);
+        return;
+    }
+
+    switch (typea)
+    {
+    case MST_EXPLICIT:
+        {
+            switch (typeb)
             {
+            case MST_EXPLICIT:
+                {
+                    ms_explicit_t const * msebp =
+                        (ms_explicit_t const *) &i_msbp->ms_data.as_expl;
+
+                    // Note - we may not be explicit after this ...
+                    explicit_settle(o_msap);
+                    explicit_union(o_msap, msebp);
+                }
+                break;
+
+            case MST_SPARSE:
+            case MST_COMPRESSED:
+                {
+                    // Hang on to our elements.
+                    ms_explicit_t msea = o_msap->ms_data.as_expl;
+
+                    // Switch to a copy of B's registers.
+                    o_msap->ms_data.as_buf = NULL;
+                    o_msap->ms_bufsz = 0;
+                    multiset_copy(o_msap, i_msbp);
+
+                    // Union our elements into the copy.
+                    for (size_t ii = 0; ii < msea.mse_nelem; ++ii)
+                        register_add(o_msap, msea.mse_elems[ii]);
+
+                    if (msea.mse_elems != NULL)
+                        pfree(msea.mse_elems);
+                }
+                break;
+
+            default:
                 ereport(ERROR,
                         (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("inconsistently sized "
-                                "compressed multiset")));
+                         errmsg("undefined multiset type value #5")));
+                break;
             }
+        }
+        break;
 
-            // Make sure the compressed array fits in memory.
-            if (nregs * sizeof(compreg_t) > MS_MAXDATA)
+    case MST_SPARSE:
+        {
+            switch (typeb)
             {
+            case MST_EXPLICIT:
+                {
+                    // Note - we may not be sparse after this ...
+                    compressed_explicit_union(o_msap, i_msbp);
+                }
+                break;
+
+            case MST_SPARSE:
+                {
+                    ms_sparse_t const * mssbp = &i_msbp->ms_data.as_sprs;
+
+                    // Note - we may not be sparse after this ...
+                    for (size_t ii = 0; ii < mssbp->mss_nslots; ++ii)
+                    {
+                        uint32_t slot = mssbp->mss_slots[ii];
+                        if (slot != 0)
+                            register_set(o_msap,
+                                         SPARSE_NDX(slot), SPARSE_VAL(slot));
+                    }
+                }
+                break;
+
+            case MST_COMPRESSED:
+                {
+                    // The result is going to be dense anyway.
+                    sparse_to_compressed(o_msap);
+                    multiset_union(o_msap, i_msbp);
+                }
+                break;
+
+            default:
                 ereport(ERROR,
                         (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("compressed multiset too large")));
+                         errmsg("undefined multiset type value #5")));
+                break;
             }
-
-            unpack_header(o_msp, i_bitp, vers, type);
-
-            // Fill the registers.
-            compressed_unpack(o_msp->ms_data.as_comp.msc_regs,
-                              nbits, nregs, &i_bitp[hdrsz], i_size - hdrsz,
-                              vers);
-        }
-        else
-        {
-            ereport(ERROR,
-                    (errcode(ERRCODE_DATA_EXCEPTION),
-                     errmsg("unsupported compressed version %d",
-                            (int) vers)));
         }
         break;
 
-    case MST_UNDEFINED:
-        if (vers == 1)
+    case MST_COMPRESSED:
         {
-            size_t hdrsz = 3;
+            ms_compressed_t * mscap =
+                (ms_compressed_t *) &o_msap->ms_data.as_comp;
 
-            // Make sure the size is consistent.
-            if (i_size != hdrsz)
+            switch (typeb)
             {
+            case MST_EXPLICIT:
+                {
+                    compressed_explicit_union(o_msap, i_msbp);
+                }
+                break;
+
+            case MST_SPARSE:
+                {
+                    ms_sparse_t const * mssbp = &i_msbp->ms_data.as_sprs;
+
+                    for (size_t ii = 0; ii < mssbp->mss_nslots; ++ii)
+                    {
+                        uint32_t slot = mssbp->mss_slots[ii];
+                        if (slot != 0)
+                            compressed_raise(o_msap, SPARSE_NDX(slot),
+                                             SPARSE_VAL(slot));
+                    }
+                }
+                break;
+
+            case MST_COMPRESSED:
+                {
+                    ms_compressed_t const * mscbp =
+                        (ms_compressed_t const *) &i_msbp->ms_data.as_comp;
+
+                    // The compressed vectors must be the same length.
+                    if (o_msap->ms_nregs != i_msbp->ms_nregs)
+                        ereport(ERROR,
+                                (errcode(ERRCODE_DATA_EXCEPTION),
+                                 errmsg("union of differently length "
+                                        "compressed vectors not supported")));
+
+                    register_max(mscap->msc_regs, mscbp->msc_regs,
+                                 o_msap->ms_nregs);
+                    mscap->msc_histok = false;
+                }
+                break;
+
+            default:
                 ereport(ERROR,
                         (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("undefined multiset value")));
+                         errmsg("undefined multiset type value #6")));
+                break;
             }
-
-            unpack_header(o_msp, i_bitp, vers, type);
         }
-        else
+        break;
+
+    default:
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("undefined multiset type value #7")));
+        break;
+    }
+}
+
+// Would multiset_union of B into A change A?  Like multiset_add_changes
+// a change of type alone counts, but not one between MST_SPARSE and
+// MST_COMPRESSED, which are packed alike.  The metadata must match.
+//
+static bool
+multiset_union_changes(multiset_t const * i_msap, multiset_t const * i_msbp)
+{
+    int typea = i_msap->ms_type;
+    int typeb = i_msbp->ms_type;
+
+    if (typea == MST_UNDEFINED)
+        return false;
+
+    if (typeb == MST_UNDEFINED)
+        return true;
+
+    if (typeb == MST_EMPTY)
+        return false;
+
+    if (typea == MST_EMPTY)
+        return true;
+
+    if (typeb == MST_EXPLICIT)
+    {
+        ms_explicit_t const * msebp = &i_msbp->ms_data.as_expl;
+
+        for (size_t ii = 0; ii < msebp->mse_nelem; ++ii)
+            if (multiset_add_changes(i_msap, msebp->mse_elems[ii]))
+                return true;
+
+        return false;
+    }
+
+    // B has registers, so explicit elements get promoted.
+    if (typea == MST_EXPLICIT)
+        return true;
+
+    if (typeb == MST_SPARSE)
+    {
+        ms_sparse_t const * mssbp = &i_msbp->ms_data.as_sprs;
+
+        for (size_t ii = 0; ii < mssbp->mss_nslots; ++ii)
         {
-            ereport(ERROR,
-                    (errcode(ERRCODE_DATA_EXCEPTION),
-                     errmsg("unsupported undefined version %d",
-                            (int) vers)));
+            uint32_t slot = mssbp->mss_slots[ii];
+            if (slot != 0 &&
+                SPARSE_VAL(slot) > register_get(i_msap, SPARSE_NDX(slot)))
+                return true;
         }
 
-        break;
+        return false;
+    }
 
-    case MST_SPARSE:
-        if (vers == 1)
+    if (typeb == MST_COMPRESSED)
+    {
+        compreg_t const * regbp = i_msbp->ms_data.as_comp.msc_regs;
+
+        if (typea == MST_COMPRESSED)
         {
-            size_t hdrsz = 3;
+            compreg_t const * regap = i_msap->ms_data.as_comp.msc_regs;
 
-            ms_compressed_t * mscp;
+            for (size_t ii = 0; ii < i_msap->ms_nregs; ++ii)
+                if (regbp[ii] > regap[ii])
+                    return true;
+        }
+        else
+        {
+            for (size_t ii = 0; ii < i_msap->ms_nregs; ++ii)
+                if (regbp[ii] != 0 && regbp[ii] > register_get(i_msap, ii))
+                    return true;
+        }
 
-            if (i_size < hdrsz)
-            {
-                ereport(ERROR,
-                        (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("sparse multiset too small")));
-            }
-            else
-            {
-                // Decode the parameter byte.
-                uint8_t param = i_bitp[1];
-                size_t nbits = (param >> 5) + 1;
-                size_t log2nregs = param & 0x1f;
-                size_t nregs = 1 << log2nregs;
+        return false;
+    }
 
-                // Figure out how many encoded registers are in the
-                // bitstream.  We depend on the log2nregs + nbits being
-                // greater then the pad size so we aren't left with
-                // ambiguity in the final pad byte.
+    ereport(ERROR,
+            (errcode(ERRCODE_DATA_EXCEPTION),
+             errmsg("undefined multiset type value #5")));
+    return true;
+}
 
-                size_t bitsz = (i_size - hdrsz) * 8;
-                size_t chunksz = log2nregs + nbits;
-                size_t nfilled = bitsz / chunksz;
+static uint64_t
+unpack_element(uint8_t const * i_bitp)
+{
+    uint64_t val = 0;
+    val |= ((uint64_t) i_bitp[0] << 56);
+    val |= ((uint64_t) i_bitp[1] << 48);
+    val |= ((uint64_t) i_bitp[2] << 40);
+    val |= ((uint64_t) i_bitp[3] << 32);
+    val |= ((uint64_t) i_bitp[4] << 24);
+    val |= ((uint64_t) i_bitp[5] << 16);
+    val |= ((uint64_t) i_bitp[6] <<  8);
+    val |= ((uint64_t) i_bitp[7] <<  0);
+    return val;
+}
 
-                // Make sure the compressed array fits in memory.
-                if (nregs * sizeof(compreg_t) > MS_MAXDATA)
-                {
-                    ereport(ERROR,
-                            (errcode(ERRCODE_DATA_EXCEPTION),
-                             errmsg("sparse multiset too large")));
-                }
+// Check a packed multiset as thoroughly as multiset_unpack does, in
+// one pass over the bytes and without materializing it.  The header
+// and size go through multiset_unpack_header, which fills in o_msp's
+// metadata; past that only explicit elements need to be in ascending
+// order, since any register value decodes, except that a byte wide
+// version 5 register has to fit in regwidth.  A summary is checked for
+// a cardinality and fill count that could be real.  Delta and entropy
+// coded multisets have to be decoded to be checked, so they are
+// unpacked.
+//
+static uint8_t
+multiset_validate(multiset_t * o_msp, uint8_t const * i_bitp, size_t i_size)
+{
+    uint8_t vers = multiset_unpack_header(o_msp, i_bitp, i_size, i_size,
+                                          NULL);
+    double card;
+    uint32_t nfilled;
 
-                unpack_header(o_msp, i_bitp, vers, type);
+    if (packed_delta(i_bitp, i_size) || packed_entropy(i_bitp, i_size))
+    {
+        multiset_t ms;
+        multiset_unpack(&ms, i_bitp, i_size, NULL);
+        multiset_release(&ms);
+        return vers;
+    }
 
-                mscp = &o_msp->ms_data.as_comp;
+    switch (o_msp->ms_type)
+    {
+    case MST_EXPLICIT:
+        {
+            // Signed, like element_compare.
+            int64_t prev = 0;
 
-                // Pre-zero the registers since sparse only fills
-                // in occasional ones.
-                //
-                for (int ii = 0; ii < nregs; ++ii)
-                    mscp->msc_regs[ii] = 0;
+            for (size_t ndx = 3; ndx < i_size; ndx += 8)
+            {
+                int64_t val = (int64_t) unpack_element(&i_bitp[ndx]);
+
+                // Let multiset_unpack report it, with the elements.
+                if (ndx > 3 && val <= prev)
+                {
+                    multiset_t ms;
+                    multiset_unpack(&ms, i_bitp, i_size, NULL);
+                }
 
-                // Fill the registers.
-                sparse_unpack(mscp->msc_regs,
-                              nbits, log2nregs, nfilled,
-                              &i_bitp[hdrsz], i_size - hdrsz);
+                prev = val;
             }
         }
-        else
-        {
+        break;
+
+    case MST_SPARSE:
+    case MST_COMPRESSED:
+        if (packed_summary(i_bitp, i_size, &card, &nfilled) &&
+            (card < 0.0 || nfilled > o_msp->ms_nregs))
             ereport(ERROR,
                     (errcode(ERRCODE_DATA_EXCEPTION),
-                     errmsg("unsupported sparse version %d",
-                            (int) vers)));
-        }
+                     errmsg("inconsistent summary in hll argument")));
+
+        if (o_msp->ms_type == MST_COMPRESSED &&
+            packed_regwidth(vers, o_msp->ms_nbits) != o_msp->ms_nbits &&
+            !registers_fit(&i_bitp[3], o_msp->ms_nregs, o_msp->ms_nbits))
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("invalid register value "
+                            "in compressed hll argument")));
         break;
 
     default:
-        // This is always an error.
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type")));
         break;
     }
 
     return vers;
 }
 
-static size_t
-pack_header(uint8_t * o_bitp,
-            uint8_t vers,
-            uint8_t type,
-            size_t nbits,
-            size_t log2nregs,
-            int64 expthresh,
-            size_t sparseon)
+// Union a packed multiset straight into a sparse or compressed
+// multiset, decoding the bitstream as we merge instead of unpacking
+// it into a multiset_t first.  Returns false, having changed nothing,
+// if the packed multiset has to go through multiset_unpack; that's
+// also the path that reports anything malformed, so the errors come
+// out exactly as they would have.
+//
+// WARNING!  This routine can change the type of the multiset!
+//
+static bool
+multiset_union_packed(multiset_t * o_msap,
+                      uint8_t const * i_bitp,
+                      size_t i_size)
 {
-    size_t ndx = 0;
+    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
+    uint8_t type = i_bitp[0] & 0xf;
+    size_t hdrsz = packed_hdrsz(i_bitp, i_size);
 
-    o_bitp[ndx++] = (vers << 4) | type;
-    o_bitp[ndx++] = ((nbits - 1) << 5) | log2nregs;
-    o_bitp[ndx++] = (sparseon << 6) | encode_expthresh(expthresh);
+    multiset_t msb;		// Header only, never has data.
 
-    return ndx;
-}
+    if (o_msap->ms_type != MST_SPARSE && o_msap->ms_type != MST_COMPRESSED)
+        return false;
 
-static void
-multiset_pack(multiset_t const * i_msp, uint8_t * o_bitp, size_t i_size)
-{
-    uint8_t vers = g_output_version;
+    if (vers < 1 || vers > MS_MAXVERSION || i_size < hdrsz ||
+        packed_delta(i_bitp, i_size) || packed_entropy(i_bitp, i_size))
+        return false;
 
-    size_t nbits = i_msp->ms_nbits;
-    size_t log2nregs = i_msp->ms_log2nregs;
-    int64 expthresh = i_msp->ms_expthresh;
-    size_t sparseon = i_msp->ms_sparseon;
+    multiset_init(&msb, CurrentMemoryContext);
+    msb.ms_type = type;
+    unpack_header(&msb, i_bitp, vers, type);
 
-    switch (i_msp->ms_type)
+    switch (type)
     {
-    case MST_EMPTY:
-        pack_header(o_bitp, vers, MST_EMPTY,
-                    nbits, log2nregs, expthresh, sparseon);
-        break;
-
     case MST_EXPLICIT:
         {
-            ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
-            size_t size = msep->mse_nelem;
+            size_t nelem = (i_size - hdrsz) / 8;
+            uint8_t const * elemp = &i_bitp[hdrsz];
 
-            size_t ndx = pack_header(o_bitp, vers, MST_EXPLICIT,
-                                     nbits, log2nregs, expthresh, sparseon);
+            if (((i_size - hdrsz) % 8) != 0 || (i_size - hdrsz) > MS_MAXDATA)
+                return false;
 
-            for (size_t ii = 0; ii < size; ++ii)
+            // Only ascending elements with no duplicates are valid.
+            for (size_t ii = 1; ii < nelem; ++ii)
             {
-                uint64_t val = msep->mse_elems[ii];
-
-                o_bitp[ndx++] = (val >> 56) & 0xff;
-                o_bitp[ndx++] = (val >> 48) & 0xff;
-                o_bitp[ndx++] = (val >> 40) & 0xff;
-                o_bitp[ndx++] = (val >> 32) & 0xff;
-                o_bitp[ndx++] = (val >> 24) & 0xff;
-                o_bitp[ndx++] = (val >> 16) & 0xff;
-                o_bitp[ndx++] = (val >>  8) & 0xff;
-                o_bitp[ndx++] = (val >>  0) & 0xff;
+                int64 prev = (int64) unpack_element(&elemp[(ii - 1) * 8]);
+                int64 curr = (int64) unpack_element(&elemp[ii * 8]);
+                if (prev >= curr)
+                    return false;
             }
+
+            check_metadata(o_msap, &msb);
+
+            for (size_t ii = 0; ii < nelem; ++ii)
+                register_add(o_msap, unpack_element(&elemp[ii * 8]));
         }
         break;
 
-    case MST_COMPRESSED:
+    case MST_SPARSE:
         {
-            ms_compressed_t const * mscp = &i_msp->ms_data.as_comp;
-            size_t nregs = i_msp->ms_nregs;
-            size_t nfilled = numfilled(i_msp);
-
-            // Should we pack this as MST_SPARSE or MST_COMPRESSED?
-            // IMPORTANT - matching code in multiset_packed_size!
-            size_t sparsebitsz;
-            size_t cmprssbitsz;
-            sparsebitsz = nfilled * (log2nregs + nbits);
-            cmprssbitsz = nregs * nbits;
-
-            // If the vector does not have sparse enabled use
-            // compressed.
-            //
-            // If the vector is smaller then the max sparse size use
-            // compressed.
-            //
-            // If the max sparse size is auto (-1) use if smaller then
-            // compressed.
-            //
-            if (sparseon &&
-                ((g_max_sparse != -1 && nfilled <= g_max_sparse) ||
-                 (g_max_sparse == -1 && sparsebitsz < cmprssbitsz)))
+            size_t bitsz = (i_size - hdrsz) * 8;
+            size_t chunksz = msb.ms_log2nregs + msb.ms_nbits;
+            size_t nfilled = bitsz / chunksz;
+            uint32_t regmask = (1 << msb.ms_nbits) - 1;
+            uint8_t const * bitp = &i_bitp[hdrsz];
+            size_t size = i_size - hdrsz;
+            int64 prevndx = -1;
+
+            if (msb.ms_nregs * sizeof(compreg_t) > MS_MAXDATA ||
+                bitsz - chunksz * nfilled >= 8)
+                return false;
+
+            // Repeated indexes are decoded last-one-wins, which can
+            // lower a register; leave those to multiset_unpack.
+            for (size_t ii = 0; ii < nfilled; ii += MS_DECODE_BATCH)
             {
-                size_t ndx = pack_header(o_bitp, vers, MST_SPARSE,
-                                         nbits, log2nregs, expthresh, sparseon);
+                size_t nvals = Min(MS_DECODE_BATCH, nfilled - ii);
+                size_t offset = ii / 8 * chunksz;
+                uint32_t chunks[MS_DECODE_BATCH];
 
-                // Marshal the registers.
-                sparse_pack(mscp->msc_regs,
-                            nbits, nregs, log2nregs, nfilled,
-                            &o_bitp[ndx], i_size - ndx);
+                bitstream_decode(chunks, nvals, &bitp[offset],
+                                 size - offset, chunksz);
+                for (size_t jj = 0; jj < nvals; ++jj)
+                {
+                    int64 ndx = chunks[jj] >> msb.ms_nbits;
+                    if (ndx <= prevndx)
+                        return false;
+                    prevndx = ndx;
+                }
             }
-            else
+
+            check_metadata(o_msap, &msb);
+
+            for (size_t ii = 0; ii < nfilled; ii += MS_DECODE_BATCH)
             {
-                size_t ndx = pack_header(o_bitp, vers, MST_COMPRESSED,
-                                         nbits, log2nregs, expthresh, sparseon);
+                size_t nvals = Min(MS_DECODE_BATCH, nfilled - ii);
+                size_t offset = ii / 8 * chunksz;
+                uint32_t chunks[MS_DECODE_BATCH];
 
-                // Marshal the registers.
-                compressed_pack(mscp->msc_regs, nbits, nregs,
-                                &o_bitp[ndx], i_size - ndx, vers);
+                bitstream_decode(chunks, nvals, &bitp[offset],
+                                 size - offset, chunksz);
+                for (size_t jj = 0; jj < nvals; ++jj)
+                {
+                    uint32_t val = chunks[jj] & regmask;
+                    if (val != 0)
+                        register_set(o_msap, chunks[jj] >> msb.ms_nbits,
+                                     val);
+                }
             }
-            break;
         }
-
-    case MST_UNDEFINED:
-        pack_header(o_bitp, vers, MST_UNDEFINED,
-                    nbits, log2nregs, expthresh, sparseon);
         break;
 
-    case MST_SPARSE:
-        // We only marshal (pack) into sparse format; complain if
-        // an in-memory multiset claims it is sparse.
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("invalid internal sparse format")));
+    case MST_COMPRESSED:
+        {
+            size_t width = packed_regwidth(vers, msb.ms_nbits);
+            size_t bitsz = width * msb.ms_nregs;
+
+            if ((i_size - hdrsz) != (bitsz + 7) / 8 ||
+                msb.ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+                return false;
+
+            if (width != msb.ms_nbits &&
+                !registers_fit(&i_bitp[hdrsz], msb.ms_nregs, msb.ms_nbits))
+                return false;
+
+            check_metadata(o_msap, &msb);
+
+            if (o_msap->ms_type == MST_SPARSE)
+                sparse_to_compressed(o_msap);
+
+            compressed_unpack_max(o_msap->ms_data.as_comp.msc_regs,
+                                  width, msb.ms_nregs,
+                                  &i_bitp[hdrsz], i_size - hdrsz);
+            o_msap->ms_data.as_comp.msc_histok = false;
+        }
         break;
 
     default:
+        return false;
+    }
+
+    return true;
+}
+
+double gamma_register_count_squared(int nregs);
+double
+gamma_register_count_squared(int nregs)
+{
+    if (nregs <= 8)
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type value #2")));
-        break;
+                 errmsg("number of registers too small")));
+
+    switch (nregs)
+    {
+    case 16:	return 0.673 * nregs * nregs;
+    case 32:	return 0.697 * nregs * nregs;
+    case 64:	return 0.709 * nregs * nregs;
+    default:	return (0.7213 / (1.0 + 1.079 / nregs)) * nregs * nregs;
     }
 }
 
-static size_t
-multiset_copy_size(multiset_t const * i_msp)
+// Count the registers of a sparse or compressed multiset by value.
+//
+static void
+register_histogram(multiset_t const * i_msp, uint32_t * o_hist)
 {
-    size_t retval = 0;
+    memset(o_hist, '\0', MS_NREGVALS * sizeof(uint32_t));
+
+    if (i_msp->ms_type == MST_SPARSE)
+    {
+        ms_sparse_t const * mssp = &i_msp->ms_data.as_sprs;
+
+        for (size_t ii = 0; ii < mssp->mss_nslots; ++ii)
+            if (mssp->mss_slots[ii] != 0)
+                o_hist[SPARSE_VAL(mssp->mss_slots[ii])]++;
+
+        o_hist[0] = i_msp->ms_nregs - mssp->mss_nfilled;
+    }
+    else
+    {
+        memcpy(o_hist, compressed_histogram(i_msp),
+               ((size_t) 1 << i_msp->ms_nbits) * sizeof(uint32_t));
+    }
+}
+
+// Cardinality of a sparse or compressed multiset from its register
+// histogram.  Only the metadata of the multiset is used.
+//
+static double
+histogram_card(multiset_t const * i_msp, uint32_t const * i_hist)
+{
+    size_t nbits = i_msp->ms_nbits;
+    size_t log2m = i_msp->ms_log2nregs;
+    size_t nregs = i_msp->ms_nregs;
+
+    uint64 max_register_value = (1ULL << nbits) - 1;
+    uint64 pw_bits = (max_register_value - 1);
+    uint64 total_bits = (pw_bits + log2m);
+    uint64 two_to_l = (1ULL << total_bits);
+
+    double large_estimator_cutoff = (double) two_to_l/30.0;
+
+    double sum;
+    int zero_count;
+    double estimator;
+
+    zero_count = i_hist[0];
+
+    // Fold the histogram into the harmonic sum, smallest terms
+    // first.  Every term is exact, and so is the sum unless the
+    // registers span more than 53 bits.
+    sum = 0.0;
+    for (ssize_t kk = max_register_value; kk >= 0; --kk)
+        sum += ldexp((double) i_hist[kk], (int) -kk);
+
+    estimator = gamma_register_count_squared(nregs) / sum;
+
+    if ((zero_count != 0) && (estimator < (5.0 * nregs / 2.0)))
+        return nregs * log((double) nregs / zero_count);
+    else if (estimator <= large_estimator_cutoff)
+        return estimator;
+    else
+        return -(double) two_to_l * log(1.0 - (estimator/two_to_l));
+}
+
+static double
+multiset_card(multiset_t const * i_msp)
+{
+    double retval = 0.0;
 
     switch (i_msp->ms_type)
     {
     case MST_EMPTY:
-        retval = __builtin_offsetof(multiset_t, ms_data);
+        retval = 0.0;
         break;
 
     case MST_EXPLICIT:
         {
             ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
-            retval = __builtin_offsetof(multiset_t, ms_data.as_expl.mse_elems);
-            retval += (msep->mse_nelem * sizeof(uint64_t));
+            return msep->mse_nelem;
         }
         break;
 
+    case MST_SPARSE:
     case MST_COMPRESSED:
         {
-            retval = __builtin_offsetof(multiset_t, ms_data.as_comp.msc_regs);
-            retval += (i_msp->ms_nregs * sizeof(compreg_t));
+            uint32_t hist[MS_NREGVALS];
+
+            register_histogram(i_msp, hist);
+
+            retval = histogram_card(i_msp, hist);
         }
         break;
 
     case MST_UNDEFINED:
-        retval = __builtin_offsetof(multiset_t, ms_data);
+        // Our caller will convert this to a NULL.
+        retval = -1.0;
         break;
 
     default:
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type value #3")));
+                 errmsg("undefined multiset type value #8")));
         break;
     }
 
     return retval;
 }
 
-static size_t
-multiset_packed_size(multiset_t const * i_msp)
+// Ertl's sigma and tau series, see "New cardinality estimation
+// algorithms for HyperLogLog sketches" (Otmar Ertl, 2017).
+//
+static double
+ertl_sigma(double x)
 {
-    uint8_t vers = g_output_version;
+    double y = 1.0;
+    double z = x;
+    double zprev;
 
-    size_t retval = 0;
+    if (x == 1.0)
+        return INFINITY;
 
-    switch (i_msp->ms_type)
+    do
     {
-    case MST_EMPTY:
-        switch (vers)
-        {
-        case 1:
-            retval = 3;
-            break;
-        default:
-            Assert(vers == 1);
-        }
-        break;
+        x *= x;
+        zprev = z;
+        z += x * y;
+        y += y;
+    } while (z != zprev);
+
+    return z;
+}
+
+static double
+ertl_tau(double x)
+{
+    double y = 1.0;
+    double z = 1.0 - x;
+    double zprev;
+
+    if (x == 0.0 || x == 1.0)
+        return 0.0;
+
+    do
+    {
+        x = sqrt(x);
+        zprev = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != zprev);
+
+    return z / 3.0;
+}
+
+// Cardinality of a sparse or compressed multiset from its register
+// histogram with Ertl's improved raw estimator.  It has no bias bump
+// between the small and large ranges so it doesn't need the linear
+// counting or large range corrections.  Only the metadata of the
+// multiset is used.
+//
+static double
+histogram_card_ertl(multiset_t const * i_msp, uint32_t const * i_hist)
+{
+    size_t nregs = i_msp->ms_nregs;
+    size_t maxval = (1 << i_msp->ms_nbits) - 1;
+    size_t qq;
+    double nsat;
+    double zz;
+
+    // Registers above qq are saturated, either by the register width
+    // or by running out of hash bits.
+    qq = Min(maxval - 1, 64 - i_msp->ms_log2nregs);
+
+    nsat = 0.0;
+    for (size_t kk = qq + 1; kk <= maxval; ++kk)
+        nsat += i_hist[kk];
+
+    zz = nregs * ertl_tau(1.0 - nsat / nregs);
+    for (size_t kk = qq; kk >= 1; --kk)
+        zz = 0.5 * (zz + i_hist[kk]);
+    zz += nregs * ertl_sigma((double) i_hist[0] / nregs);
+
+    return (0.5 / log(2.0)) * nregs * nregs / zz;
+}
+
+// Cardinality of a multiset with Ertl's estimator.  Only sparse and
+// compressed multisets are estimated; the others come out the same
+// as with multiset_card.
+//
+static double
+multiset_card_ertl(multiset_t const * i_msp)
+{
+    uint32_t hist[MS_NREGVALS];
+
+    if (i_msp->ms_type != MST_SPARSE && i_msp->ms_type != MST_COMPRESSED)
+        return multiset_card(i_msp);
+
+    register_histogram(i_msp, hist);
+
+    return histogram_card_ertl(i_msp, hist);
+}
+
+// Cardinality of a packed multiset, computed while walking the
+// bitstream rather than from an unpacked copy.  Explicit multisets
+// are counted from their size, sparse and compressed ones are
+// decoded straight into a register histogram unless they have a
+// summary with the classic estimate.  Entropy coded ones carry their
+// histogram.
+//
+// Returns false if the packed multiset has to be unpacked instead:
+// it's empty or undefined, delta coded explicit, from another schema
+// version, malformed, or a sparse bitstream that isn't in canonical
+// ascending order.
+// multiset_unpack reports or handles all of those.
+//
+static bool
+packed_card(uint8_t const * i_bitp,
+            size_t i_size,
+            bool i_ertl,
+            double * o_card)
+{
+    uint8_t vers = (i_bitp[0] >> 4) & 0xf;
+    uint8_t type = i_bitp[0] & 0xf;
+    size_t hdrsz = packed_hdrsz(i_bitp, i_size);
+
+    multiset_t ms;		// Header only, never has data.
+    uint32_t hist[MS_NREGVALS];
+
+    if (vers < 1 || vers > MS_MAXVERSION || i_size < hdrsz)
+        return false;
+
+    if (!i_ertl && packed_summary(i_bitp, i_size, o_card, NULL))
+        return true;
+
+    multiset_init(&ms, CurrentMemoryContext);
+    ms.ms_type = type;
+    unpack_header(&ms, i_bitp, vers, type);
 
+    switch (type)
+    {
     case MST_EXPLICIT:
-        switch (vers)
+        // Delta coded elements are only checked by unpacking them.
+        if (packed_delta(i_bitp, i_size))
+            return false;
+
         {
-        case 1:
+            size_t nelem = (i_size - hdrsz) / 8;
+            uint8_t const * elemp = &i_bitp[hdrsz];
+
+            if (((i_size - hdrsz) % 8) != 0 || (i_size - hdrsz) > MS_MAXDATA)
+                return false;
+
+            // Only ascending elements with no duplicates are valid.
+            for (size_t ii = 1; ii < nelem; ++ii)
             {
-                ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
-                retval = 3 + (8 * msep->mse_nelem);
+                int64 prev = (int64) unpack_element(&elemp[(ii - 1) * 8]);
+                int64 curr = (int64) unpack_element(&elemp[ii * 8]);
+                if (prev >= curr)
+                    return false;
             }
-            break;
-        default:
-            Assert(vers == 1);
+
+            *o_card = nelem;
+            return true;
         }
-        break;
 
-    case MST_COMPRESSED:
-        if (vers == 1)
+    case MST_SPARSE:
+        if (packed_delta(i_bitp, i_size))
         {
-            size_t hdrsz = 3;
-            size_t nbits = i_msp->ms_nbits;
-            size_t nregs = i_msp->ms_nregs;
-            size_t nfilled = numfilled(i_msp);
-            size_t log2nregs = i_msp->ms_log2nregs;
-            size_t sparseon = i_msp->ms_sparseon;
-            size_t sparsebitsz;
-            size_t cmprssbitsz;
+            if (!sparse_delta_histogram(&ms, &i_bitp[hdrsz], i_size - hdrsz,
+                                        hist))
+                return false;
+        }
+        else
+        {
+            size_t bitsz = (i_size - hdrsz) * 8;
+            size_t chunksz = ms.ms_log2nregs + ms.ms_nbits;
+            size_t nfilled = bitsz / chunksz;
+            uint32_t regmask = (1 << ms.ms_nbits) - 1;
+            uint8_t const * bitp = &i_bitp[hdrsz];
+            size_t size = i_size - hdrsz;
+            int64 prevndx = -1;
 
-            // Should we pack this as MST_SPARSE or MST_COMPRESSED?
-            // IMPORTANT - matching code in multiset_pack!
-            //
-            sparsebitsz = numfilled(i_msp) * (log2nregs + nbits);
-            cmprssbitsz = nregs * nbits;
+            if (ms.ms_nregs * sizeof(compreg_t) > MS_MAXDATA ||
+                bitsz - chunksz * nfilled >= 8)
+                return false;
 
-            // If the vector does not have sparse enabled use
-            // compressed.
-            //
-            // If the vector is smaller then the max sparse size use
-            // compressed.
-            //
-            // If the max sparse size is auto (-1) use if smaller then
-            // compressed.
-            //
-            if (sparseon &&
-                ((g_max_sparse != -1 && nfilled <= g_max_sparse) ||
-                 (g_max_sparse == -1 && sparsebitsz < cmprssbitsz)))
+            memset(hist, '\0', sizeof(hist));
 
+            for (size_t ii = 0; ii < nfilled; ii += MS_DECODE_BATCH)
             {
-                // MST_SPARSE is more compact.
-                retval = hdrsz + ((sparsebitsz + 7) / 8);
-            }
-            else
-            {
-                // MST_COMPRESSED is more compact.
-                retval = hdrsz + ((cmprssbitsz + 7) / 8);
+                size_t nvals = Min(MS_DECODE_BATCH, nfilled - ii);
+                size_t offset = ii / 8 * chunksz;
+                uint32_t chunks[MS_DECODE_BATCH];
+
+                bitstream_decode(chunks, nvals, &bitp[offset],
+                                 size - offset, chunksz);
+                for (size_t jj = 0; jj < nvals; ++jj)
+                {
+                    int64 ndx = chunks[jj] >> ms.ms_nbits;
+
+                    // Repeated indexes are decoded last-one-wins.
+                    if (ndx <= prevndx)
+                        return false;
+                    prevndx = ndx;
+
+                    hist[chunks[jj] & regmask]++;
+                }
             }
-        }
-        else
-        {
-            Assert(vers == 1);
+
+            hist[0] += ms.ms_nregs - nfilled;
         }
         break;
 
-    case MST_UNDEFINED:
-        if (vers == 1)
+    case MST_COMPRESSED:
+        if (packed_entropy(i_bitp, i_size))
         {
-            size_t hdrsz = 3;
-            retval = hdrsz;
+            huffman_code_t hc;
+            size_t codesz;
+            size_t cntsz;
+
+            if (ms.ms_nregs * sizeof(compreg_t) > MS_MAXDATA)
+                return false;
+
+            // The counts are the histogram.
+            cntsz = entropy_counts(&ms, &i_bitp[hdrsz], i_size - hdrsz,
+                                   hist, &hc, &codesz);
+            if (cntsz == 0 || i_size - hdrsz - cntsz != codesz)
+                return false;
         }
         else
         {
-            Assert(vers == 1);
-        }
-        break;
+            size_t nregs = ms.ms_nregs;
+            size_t width = packed_regwidth(vers, ms.ms_nbits);
+            size_t bitsz = width * nregs;
+            uint8_t const * bitp = &i_bitp[hdrsz];
+            size_t size = i_size - hdrsz;
 
-    case MST_SPARSE:
-        // We only marshal (pack) into sparse format; complain if
-        // an in-memory multiset claims it is sparse.
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("invalid internal sparse format")));
+            // Interleave four histograms as in register_histogram.
+            uint32_t hists[4][MS_NREGVALS];
+
+            if (size != (bitsz + 7) / 8 ||
+                nregs * sizeof(compreg_t) > MS_MAXDATA)
+                return false;
+
+            memset(hists, '\0', sizeof(hists));
+
+            for (size_t ii = 0; ii < nregs; ii += MS_DECODE_BATCH)
+            {
+                size_t nvals = Min(MS_DECODE_BATCH, nregs - ii);
+                size_t offset = ii / 8 * width;
+                compreg_t vals[MS_DECODE_BATCH];
+                size_t jj = 0;
+
+                compressed_decode(vals, nvals, &bitp[offset],
+                                  size - offset, width);
+                for (; jj + 4 <= nvals; jj += 4)
+                {
+                    hists[0][vals[jj + 0]]++;
+                    hists[1][vals[jj + 1]]++;
+                    hists[2][vals[jj + 2]]++;
+                    hists[3][vals[jj + 3]]++;
+                }
+                for (; jj < nvals; ++jj)
+                    hists[0][vals[jj]]++;
+            }
+
+            for (size_t kk = 0; kk < MS_NREGVALS; ++kk)
+                hist[kk] = hists[0][kk] + hists[1][kk] +
+                    hists[2][kk] + hists[3][kk];
+
+            // Byte wide registers may not fit in regwidth.
+            for (size_t kk = (size_t) 1 << ms.ms_nbits; kk < MS_NREGVALS; ++kk)
+                if (hist[kk] != 0)
+                    return false;
+        }
         break;
 
     default:
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type value #4")));
-        break;
+        return false;
     }
 
-    return retval;
+    if (i_ertl)
+        *o_card = histogram_card_ertl(&ms, hist);
+    else
+        *o_card = histogram_card(&ms, hist);
+
+    return true;
 }
 
-PG_FUNCTION_INFO_V1(hll_in);
-Datum		hll_in(PG_FUNCTION_ARGS);
-Datum
-hll_in(PG_FUNCTION_ARGS)
-{
-    Datum dd = DirectFunctionCall1(byteain, PG_GETARG_DATUM(0));
+// ----------------------------------------------------------------
+// Decode Cache
+// ----------------------------------------------------------------
 
-    int32 typmod = PG_GETARG_INT32(2);
+// Stored hlls that are too large to keep inline are TOASTed, and
+// every function reading one fetches and unpacks it again.  When
+// hll.decode_cache_size is set the unpacked multisets of such hlls
+// are kept, per backend, keyed by their TOAST pointer and evicted
+// least recently used first.
+//
+// A TOASTed value is never changed in place; an update stores a new
+// one under a new value id.  The whole pointer is compared on lookup
+// so a value id reused after wraparound is only mistaken for the old
+// value if the sizes match as well.
+//
+typedef struct
+{
+    Oid			dk_toastrelid;
+    Oid			dk_valueid;
 
-    // Unpack to make sure the data is valid.
-    bytea * bp = DatumGetByteaP(dd);
-    size_t sz = VARSIZE(bp) - VARHDRSZ;
-    multiset_t ms;
-    multiset_unpack(&ms, (uint8_t *) VARDATA(bp), sz, NULL);
+} decode_key_t;
 
-    // The typmod value will be valid for COPY and \COPY statements.
-    // Check the metadata consistency in these cases.
-    if (typmod != -1)
-    {
-        int32 log2m = typmod_log2m(typmod);
-        int32 regwidth = typmod_regwidth(typmod);
-        int64 expthresh = decode_expthresh(typmod_expthresh(typmod));
-        int32 sparseon = typmod_sparseon(typmod);
+typedef struct
+{
+    decode_key_t			de_key;	// Must be first.
+    struct varatt_external	de_toast;
+    multiset_t				de_ms;
+    size_t					de_size;
+    dlist_node				de_lru;
 
-        // Create a placeholder w/ declared metadata.
-        multiset_t msx;
-        msx.ms_nbits = regwidth;
-        msx.ms_nregs = (1 << log2m);
-        msx.ms_log2nregs = log2m;
-        msx.ms_expthresh = expthresh;
-        msx.ms_sparseon = sparseon;
+} decode_entry_t;
 
-        // Make sure the declared metadata matches the incoming.
-        check_metadata(&msx, &ms);
-    }
+static HTAB * g_decode_cache = NULL;
+static MemoryContext g_decode_mcxt = NULL;
+static dlist_head g_decode_lru = DLIST_STATIC_INIT(g_decode_lru);
+static size_t g_decode_bytes = 0;
+static int64 g_decode_hits = 0;
+static int64 g_decode_misses = 0;
 
-    return dd;
+static void
+decode_cache_evict(decode_entry_t * i_dep)
+{
+    g_decode_bytes -= i_dep->de_size;
+    multiset_release(&i_dep->de_ms);
+    dlist_delete(&i_dep->de_lru);
+    hash_search(g_decode_cache, &i_dep->de_key, HASH_REMOVE, NULL);
 }
 
-PG_FUNCTION_INFO_V1(hll_out);
-Datum		hll_out(PG_FUNCTION_ARGS);
-Datum
-hll_out(PG_FUNCTION_ARGS)
+// Evict entries until the cache takes at most i_maxbytes.
+//
+static void
+decode_cache_trim(size_t i_maxbytes)
 {
-    // NOTE - It's still worth interposing on these calls in case
-    // we want to support alternate representations in the future.
-
-    Datum dd = DirectFunctionCall1(byteaout, PG_GETARG_DATUM(0));
-    return dd;
+    while (g_decode_bytes > i_maxbytes && !dlist_is_empty(&g_decode_lru))
+        decode_cache_evict(dlist_tail_element(decode_entry_t, de_lru,
+                                              &g_decode_lru));
 }
 
-PG_FUNCTION_INFO_V1(hll);
-Datum		hll(PG_FUNCTION_ARGS);
-Datum
-hll(PG_FUNCTION_ARGS)
+// The unpacked multiset of an hll stored out of line, from the cache
+// or unpacked into it; NULL when the cache is off or the hll isn't a
+// TOAST pointer.  Callers must not change it.  If it is too large to
+// cache at all it lives in the current memory context instead.
+//
+// It is valid only until the next call, which may evict it to make
+// room; copy it first to hold two at once.
+//
+static multiset_t const *
+decode_cache_get(Datum i_hll)
 {
-    Datum dd = PG_GETARG_DATUM(0);
-    bytea * bp = DatumGetByteaP(dd);
-    size_t sz = VARSIZE(bp) - VARHDRSZ;
-    int32 typmod = PG_GETARG_INT32(1);	// !! DIFFERENT THEN IN hll_in!
-    bool isexplicit = PG_GETARG_BOOL(2); // explicit cast, not explicit vector
-    int32 log2m = typmod_log2m(typmod);
-    int32 regwidth = typmod_regwidth(typmod);
-    int64 expthresh = decode_expthresh(typmod_expthresh(typmod));
-    int32 sparseon = typmod_sparseon(typmod);
-
+    struct varlena * ap = (struct varlena *) DatumGetPointer(i_hll);
+    size_t maxbytes = (size_t) g_decode_cache_size * 1024;
+    struct varatt_external toast;
+    decode_key_t key;
+    decode_entry_t * dep;
+    bytea * ab;
+    multiset_t * msp;
     multiset_t ms;
-    multiset_t msx;
-
-    // Unpack the bit data.
-    multiset_unpack(&ms, (uint8_t *) VARDATA(bp), sz, NULL);
-
-    // Make the compiler happpy.
-    (void) isexplicit;
+    size_t size;
 
-    // Create a placeholder w/ declared metadata.
-    msx.ms_nbits = regwidth;
-    msx.ms_nregs = (1 << log2m);
-    msx.ms_log2nregs = log2m;
-    msx.ms_expthresh = expthresh;
-    msx.ms_sparseon = sparseon;
+    if (maxbytes == 0)
+    {
+        decode_cache_trim(0);
+        return NULL;
+    }
 
-    // Make sure the declared metadata matches the incoming.
-    check_metadata(&msx, &ms);
+    if (!VARATT_IS_EXTERNAL_ONDISK(ap))
+        return NULL;
 
-    // If we make it here we're good.
-    return dd;
-}
+    if (g_decode_cache == NULL)
+    {
+        HASHCTL ctl;
+
+        g_decode_mcxt = AllocSetContextCreate(TopMemoryContext,
+                                              "hll decode cache",
+                                              ALLOCSET_DEFAULT_SIZES);
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(decode_key_t);
+        ctl.entrysize = sizeof(decode_entry_t);
+        ctl.hcxt = g_decode_mcxt;
+        g_decode_cache = hash_create("hll decode cache", 256, &ctl,
+                                     HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
 
-PG_FUNCTION_INFO_V1(hll_hashval_in);
-Datum		hll_hashval_in(PG_FUNCTION_ARGS);
-Datum
-hll_hashval_in(PG_FUNCTION_ARGS)
-{
-    Datum dd = DirectFunctionCall1(int8in, PG_GETARG_DATUM(0));
-    return dd;
-}
+    // The setting may have been lowered since the last call.
+    decode_cache_trim(maxbytes);
 
-PG_FUNCTION_INFO_V1(hll_hashval_out);
-Datum		hll_hashval_out(PG_FUNCTION_ARGS);
-Datum
-hll_hashval_out(PG_FUNCTION_ARGS)
-{
-    Datum dd = DirectFunctionCall1(int8out, PG_GETARG_DATUM(0));
-    return dd;
-}
+    VARATT_EXTERNAL_GET_POINTER(toast, ap);
+    memset(&key, 0, sizeof(key));
+    key.dk_toastrelid = toast.va_toastrelid;
+    key.dk_valueid = toast.va_valueid;
 
-PG_FUNCTION_INFO_V1(hll_hashval_eq);
-Datum		hll_hashval_eq(PG_FUNCTION_ARGS);
-Datum
-hll_hashval_eq(PG_FUNCTION_ARGS)
-{
-    int64 aa = PG_GETARG_INT64(0);
-    int64 bb = PG_GETARG_INT64(1);
-    PG_RETURN_BOOL(aa == bb);
-}
+    dep = (decode_entry_t *) hash_search(g_decode_cache, &key, HASH_FIND,
+                                         NULL);
+    if (dep != NULL)
+    {
+        if (memcmp(&dep->de_toast, &toast, sizeof(toast)) == 0)
+        {
+            ++g_decode_hits;
+            dlist_move_head(&g_decode_lru, &dep->de_lru);
+            return &dep->de_ms;
+        }
 
-PG_FUNCTION_INFO_V1(hll_hashval_ne);
-Datum		hll_hashval_ne(PG_FUNCTION_ARGS);
-Datum
-hll_hashval_ne(PG_FUNCTION_ARGS)
-{
-    int64 aa = PG_GETARG_INT64(0);
-    int64 bb = PG_GETARG_INT64(1);
-    PG_RETURN_BOOL(aa != bb);
-}
+        decode_cache_evict(dep);
+    }
 
-PG_FUNCTION_INFO_V1(hll_hashval);
-Datum		hll_hashval(PG_FUNCTION_ARGS);
-Datum
-hll_hashval(PG_FUNCTION_ARGS)
-{
-    int64 aa = PG_GETARG_INT64(0);
-    PG_RETURN_INT64(aa);
-}
+    ++g_decode_misses;
 
-PG_FUNCTION_INFO_V1(hll_hashval_int4);
-Datum		hll_hashval_int4(PG_FUNCTION_ARGS);
-Datum
-hll_hashval_int4(PG_FUNCTION_ARGS)
-{
-    int32 aa = PG_GETARG_INT32(0);
-    int64 aaaa = aa;	// extend value to 64 bits.
-    PG_RETURN_INT64(aaaa);
-}
+    // Unpack outside the cache first so a bad value leaves nothing
+    // behind in it.
+    ab = DatumGetByteaP(i_hll);
+    msp = (multiset_t *) palloc(sizeof(multiset_t));
+    multiset_unpack(msp, (uint8_t *) VARDATA(ab), VARSIZE(ab) - VARHDRSZ,
+                    NULL);
 
-static void
-check_modifiers(int32 log2m, int32 regwidth, int64 expthresh, int32 sparseon)
-{
-    // Range check each of the modifiers.
-    if (log2m < 0 || log2m > MAX_BITVAL(LOG2M_BITS))
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("log2m modifier must be between 0 and 31")));
+    if (sizeof(decode_entry_t) + multiset_copy_size(msp) > maxbytes)
+        return msp;
 
-    if (regwidth < 0 || regwidth > MAX_BITVAL(REGWIDTH_BITS))
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("regwidth modifier must be between 0 and 7")));
+    multiset_init(&ms, g_decode_mcxt);
+    multiset_copy(&ms, msp);
+    size = sizeof(decode_entry_t) + ms.ms_bufsz;
 
-    if (expthresh < -1 || expthresh > 4294967296LL)
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("expthresh modifier must be between -1 and 2^32")));
+    decode_cache_trim(maxbytes > size ? maxbytes - size : 0);
 
-    if (expthresh > 0 && (1LL << integer_log2(expthresh)) != expthresh)
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("expthresh modifier must be power of 2")));
+    dep = (decode_entry_t *) hash_search(g_decode_cache, &key, HASH_ENTER,
+                                         NULL);
+    dep->de_toast = toast;
+    dep->de_ms = ms;
+    dep->de_size = size;
+    dlist_push_head(&g_decode_lru, &dep->de_lru);
+    g_decode_bytes += size;
 
-    if (sparseon < 0 || sparseon > MAX_BITVAL(SPARSEON_BITS))
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("sparseon modifier must be 0 or 1")));
+    return &dep->de_ms;
 }
 
-// This routine is cloned from the arrayutils ArrayGetIntegerTypmods
-// and converted to return 64 bit integers.
+// Returns the decode cache counters of this backend.
 //
-static int64 *
-ArrayGetInteger64Typmods(ArrayType *arr, int *n)
+PG_FUNCTION_INFO_V1(hll_decode_cache_stats);
+Datum		hll_decode_cache_stats(PG_FUNCTION_ARGS);
+Datum
+hll_decode_cache_stats(PG_FUNCTION_ARGS)
 {
-	int64	   *result;
-	Datum	   *elem_values;
-	int			i;
+    int64 counts[4];
 
-	if (ARR_ELEMTYPE(arr) != CSTRINGOID)
-		ereport(ERROR,
-				(errcode(ERRCODE_ARRAY_ELEMENT_ERROR),
-				 errmsg("typmod array must be type cstring[]")));
+	Datum		result;
 
-	if (ARR_NDIM(arr) != 1)
-		ereport(ERROR,
-				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
-				 errmsg("typmod array must be one-dimensional")));
+    counts[0] = g_decode_hits;
+    counts[1] = g_decode_misses;
+    counts[2] = g_decode_cache ? hash_get_num_entries(g_decode_cache) : 0;
+    counts[3] = g_decode_bytes;
 
-	if (array_contains_nulls(arr))
-		ereport(ERROR,
-				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-				 errmsg("typmod array must not contain nulls")));
+    // Build the result tuple.
+	{
+		TupleDesc tupleDesc;
+		char * values[4];
+		HeapTuple tuple;
 
-	/* hardwired knowledge about cstring's representation details here */
-	deconstruct_array(arr, CSTRINGOID,
-					  -2, false, 'c',
-					  &elem_values, NULL, n);
+		/* Build a tuple descriptor for our result type */
+		if (get_call_result_type(fcinfo, NULL, &tupleDesc) !=
+            TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
 
-	result = (int64 *) palloc(*n * sizeof(int64));
+		for (int j = 0; j < 4; ++j)
+		{
+			values[j] = palloc(32);
+			snprintf(values[j], 32, INT64_FORMAT, counts[j]);
+		}
 
-	for (i = 0; i < *n; i++)
-    {
-        char * endp = NULL;
-        result[i] = strtoll(DatumGetCString(elem_values[i]), &endp, 0);
-        if (*endp != '\0')
-            ereport(ERROR,
-                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                     errmsg("typmod array must contain integers")));
-    }
+		tuple = BuildTupleFromCStrings(TupleDescGetAttInMetadata(tupleDesc),
+									   values);
 
-	pfree(elem_values);
+		result = HeapTupleGetDatum(tuple);
+	}
 
-	return result;
+	PG_RETURN_DATUM(result);
 }
 
-PG_FUNCTION_INFO_V1(hll_typmod_in);
-Datum		hll_typmod_in(PG_FUNCTION_ARGS);
+// Empties the decode cache of this backend and zeroes its counters.
+//
+PG_FUNCTION_INFO_V1(hll_decode_cache_reset);
+Datum		hll_decode_cache_reset(PG_FUNCTION_ARGS);
 Datum
-hll_typmod_in(PG_FUNCTION_ARGS)
+hll_decode_cache_reset(PG_FUNCTION_ARGS)
 {
-	ArrayType *	ta = PG_GETARG_ARRAYTYPE_P(0);
-	int64 * tl;
-	int nmods;
-    int32 typmod;
-    int32 log2m;
-    int32 regwidth;
-    int64 expthresh;
-    int32 sparseon;
+    decode_cache_trim(0);
+    g_decode_hits = 0;
+    g_decode_misses = 0;
 
-	tl = ArrayGetInteger64Typmods(ta, &nmods);
+    PG_RETURN_VOID();
+}
 
-    // Make sure the number of type modifiers is in a valid range.
-    if (nmods > 4 || nmods < 0)
-    {
-        ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("invalid number of type modifiers")));
-		typmod = 0;				/* keep compiler quiet */
-    }
-    else
-    {
-        // Process the type modifiers, supply defaults if necessary.
-        log2m =		(nmods >= 1) ? tl[0] : g_default_log2m;
-        regwidth =	(nmods >= 2) ? tl[1] : g_default_regwidth;
-        expthresh =	(nmods >= 3) ? tl[2] : g_default_expthresh;
-        sparseon =	(nmods == 4) ? tl[3] : g_default_sparseon;
+// ----------------------------------------------------------------
+// Expanded Objects
+// ----------------------------------------------------------------
 
-        check_modifiers(log2m, regwidth, expthresh, sparseon);
+// An expanded hll keeps its multiset unpacked between calls.  hll_add,
+// hll_add_rev and hll_union return one, and change a read-write one
+// passed as their first multiset in place, so in h || a || b || c or
+// in a PL/pgSQL variable the multiset is only packed once PostgreSQL
+// stores or outputs it, with the output version and max sparse
+// setting in effect then.  Functions that don't know about expanded
+// hlls get the packed value when they detoast their argument.
+//
+// The multiset's data lives in the object's own memory context.
+//
+typedef struct
+{
+    ExpandedObjectHeader	eh_hdr;
+    multiset_t				eh_ms;
 
-        // Construct the typmod value.
-        typmod =
-            (log2m << (TYPMOD_BITS - LOG2M_BITS)) |
-            (regwidth << (TYPMOD_BITS - LOG2M_BITS - REGWIDTH_BITS)) |
-            (encode_expthresh(expthresh) <<
-                         (TYPMOD_BITS - LOG2M_BITS - REGWIDTH_BITS -
-                           EXPTHRESH_BITS)) |
-            (sparseon << (TYPMOD_BITS - LOG2M_BITS - REGWIDTH_BITS -
-                          EXPTHRESH_BITS - SPARSEON_BITS));
-    }
+    // Packed size, with its varlena header, and the settings it was
+    // figured for; 0 if the multiset has changed since.
+    size_t					eh_flatsz;
+    int						eh_flatvers;
+    int						eh_flatmaxsparse;
 
-	PG_RETURN_INT32(typmod);
-}
+} expanded_hll_t;
 
-PG_FUNCTION_INFO_V1(hll_typmod_out);
-Datum		hll_typmod_out(PG_FUNCTION_ARGS);
-Datum
-hll_typmod_out(PG_FUNCTION_ARGS)
+static Size
+expanded_hll_get_flat_size(ExpandedObjectHeader * eohptr)
 {
-    int32 typmod = (uint32) PG_GETARG_INT32(0);
-    int32 log2m = typmod_log2m(typmod);
-    int32 regwidth = typmod_regwidth(typmod);
-    int64 expthresh = decode_expthresh(typmod_expthresh(typmod));
-    int32 sparseon = typmod_sparseon(typmod);
+    expanded_hll_t * ehp = (expanded_hll_t *) eohptr;
 
-    char buffer[1024];
-    size_t len;
-    char * typmodstr;
+    if (ehp->eh_flatsz == 0 ||
+        ehp->eh_flatvers != g_output_version ||
+        ehp->eh_flatmaxsparse != g_max_sparse)
+    {
+        ehp->eh_flatsz = VARHDRSZ + multiset_packed_size(&ehp->eh_ms, NULL);
+        ehp->eh_flatvers = g_output_version;
+        ehp->eh_flatmaxsparse = g_max_sparse;
+    }
 
-    memset(buffer, '\0', sizeof(buffer));
-    snprintf(buffer, sizeof(buffer), "(%d,%d,%ld,%d)",
-             log2m, regwidth, expthresh, sparseon);
+    return ehp->eh_flatsz;
+}
 
-    len = strlen(buffer) + 1;
-    typmodstr = (char *) palloc(len);
-    strncpy(typmodstr, buffer, len);
+static void
+expanded_hll_flatten_into(ExpandedObjectHeader * eohptr,
+                          void * result,
+                          Size allocated_size)
+{
+    expanded_hll_t * ehp = (expanded_hll_t *) eohptr;
+    bytea * cb = (bytea *) result;
 
-	PG_RETURN_CSTRING(typmodstr);
+    Assert(allocated_size == ehp->eh_flatsz);
+
+    SET_VARSIZE(cb, allocated_size);
+    multiset_pack(&ehp->eh_ms, (uint8_t *) VARDATA(cb),
+                  allocated_size - VARHDRSZ);
 }
 
-static void
-multiset_union(multiset_t * o_msap, multiset_t const * i_msbp)
+static const ExpandedObjectMethods expanded_hll_methods =
 {
-    int typea = o_msap->ms_type;
-    int typeb = i_msbp->ms_type;
+    expanded_hll_get_flat_size,
+    expanded_hll_flatten_into
+};
 
-    // If either multiset is MST_UNDEFINED result is MST_UNDEFINED.
-    if (typea == MST_UNDEFINED || typeb == MST_UNDEFINED)
-    {
-        o_msap->ms_type = MST_UNDEFINED;
-        return;
-    }
+// Make an empty expanded hll in a new child context of i_parent.
+//
+static expanded_hll_t *
+expanded_hll_create(MemoryContext i_parent)
+{
+    MemoryContext objcxt = AllocSetContextCreate(i_parent, "expanded hll",
+                                                 ALLOCSET_SMALL_SIZES);
+    expanded_hll_t * ehp =
+        (expanded_hll_t *) MemoryContextAlloc(objcxt, sizeof(*ehp));
 
-    // If B is MST_EMPTY, we're done, A is unchanged.
-    if (typeb == MST_EMPTY)
-        return;
+    EOH_init_header(&ehp->eh_hdr, &expanded_hll_methods, objcxt);
+    multiset_init(&ehp->eh_ms, objcxt);
+    ehp->eh_flatsz = 0;
 
-    // If A is MST_EMPTY, return B instead.
-    if (typea == MST_EMPTY)
-    {
-        memcpy(o_msap, i_msbp, multiset_copy_size(i_msbp));
-        return;
-    }
+    return ehp;
+}
 
-    switch (typea)
-    {
-    case MST_EXPLICIT:
-        {
-            switch (typeb)
-            {
-            case MST_EXPLICIT:
-                {
-                    ms_explicit_t const * msebp =
-                        (ms_explicit_t const *) &i_msbp->ms_data.as_expl;
+// Is the hll argument an expanded one?  Read-only or read-write.
+//
+static bool
+expanded_hll_isarg(FunctionCallInfo fcinfo, int i_argno)
+{
+    return VARATT_IS_EXTERNAL_EXPANDED(PG_GETARG_POINTER(i_argno));
+}
 
-                    // Note - we may not be explicit after this ...
-                    explicit_union(o_msap, msebp);
-                }
-                break;
+// The multiset of an hll argument, read only: an expanded hll's own,
+// a cached one, or the packed one unpacked into o_msp.  A cached one
+// is valid only until the next lookup; see decode_cache_get.
+//
+static multiset_t const *
+expanded_hll_getarg(FunctionCallInfo fcinfo, int i_argno, multiset_t * o_msp)
+{
+    multiset_t const * msp;
+    bytea * ab;
 
-            case MST_COMPRESSED:
-                {
-                    // Make a copy of B since we can't modify it in place.
-                    multiset_t mst;
-                    memcpy(&mst, i_msbp, multiset_copy_size(i_msbp));
-                    // Union into the copy.
-                    compressed_explicit_union(&mst, o_msap);
-                    // Copy the result over the A argument.
-                    memcpy(o_msap, &mst, multiset_copy_size(&mst));
-                }
-                break;
+    if (expanded_hll_isarg(fcinfo, i_argno))
+        return &((expanded_hll_t *)
+                 DatumGetEOHP(PG_GETARG_DATUM(i_argno)))->eh_ms;
 
-            default:
-                ereport(ERROR,
-                        (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("undefined multiset type value #5")));
-                break;
-            }
-        }
-        break;
+    msp = decode_cache_get(PG_GETARG_DATUM(i_argno));
+    if (msp != NULL)
+        return msp;
 
-    case MST_COMPRESSED:
-        {
-            ms_compressed_t * mscap =
-                (ms_compressed_t *) &o_msap->ms_data.as_comp;
+    ab = PG_GETARG_BYTEA_P(i_argno);
+    multiset_unpack(o_msp, (uint8_t *) VARDATA(ab), VARSIZE(ab) - VARHDRSZ,
+                    NULL);
 
-            switch (typeb)
-            {
-            case MST_EXPLICIT:
-                {
-                    compressed_explicit_union(o_msap, i_msbp);
-                }
-                break;
+    return o_msp;
+}
 
-            case MST_COMPRESSED:
-                {
-                    ms_compressed_t const * mscbp =
-                        (ms_compressed_t const *) &i_msbp->ms_data.as_comp;
+// A read-write expanded hll holding an hll argument for the caller to
+// change: the argument itself if it's one already, otherwise a new one
+// in the current memory context.  The caller clears eh_flatsz if it
+// changes the multiset.
+//
+static expanded_hll_t *
+expanded_hll_modarg(FunctionCallInfo fcinfo, int i_argno)
+{
+    Datum ad = PG_GETARG_DATUM(i_argno);
+    expanded_hll_t * ehp;
+    multiset_t const * msp;
 
-                    // The compressed vectors must be the same length.
-                    if (o_msap->ms_nregs != i_msbp->ms_nregs)
-                        ereport(ERROR,
-                                (errcode(ERRCODE_DATA_EXCEPTION),
-                                 errmsg("union of differently length "
-                                        "compressed vectors not supported")));
+    if (VARATT_IS_EXTERNAL_EXPANDED_RW(DatumGetPointer(ad)))
+        ehp = (expanded_hll_t *) DatumGetEOHP(ad);
+    else
+    {
+        ehp = expanded_hll_create(CurrentMemoryContext);
 
-                    for (unsigned ii = 0; ii < o_msap->ms_nregs; ++ii)
-                    {
-                        if (mscap->msc_regs[ii] < mscbp->msc_regs[ii])
-                            mscap->msc_regs[ii] = mscbp->msc_regs[ii];
-                    }
-                }
-                break;
+        if (expanded_hll_isarg(fcinfo, i_argno))
+            msp = &((expanded_hll_t *) DatumGetEOHP(ad))->eh_ms;
+        else
+            msp = decode_cache_get(ad);
 
-            default:
-                ereport(ERROR,
-                        (errcode(ERRCODE_DATA_EXCEPTION),
-                         errmsg("undefined multiset type value #6")));
-                break;
-            }
+        if (msp != NULL)
+        {
+            multiset_copy(&ehp->eh_ms, msp);
         }
-        break;
+        else
+        {
+            bytea * ab = PG_GETARG_BYTEA_P(i_argno);
+            MemoryContext oldcxt =
+                MemoryContextSwitchTo(ehp->eh_hdr.eoh_context);
 
-    default:
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type value #7")));
-        break;
+            multiset_unpack(&ehp->eh_ms, (uint8_t *) VARDATA(ab),
+                            VARSIZE(ab) - VARHDRSZ, NULL);
+            MemoryContextSwitchTo(oldcxt);
+        }
     }
+
+    return ehp;
 }
 
-double gamma_register_count_squared(int nregs);
-double
-gamma_register_count_squared(int nregs)
+// The result of a function that found it wouldn't change the multiset
+// of its hll argument, given the expanded hll expanded_hll_modarg made
+// for it.  That's the argument itself, so a stored hll is stored again
+// as it was, TOAST value and all, without being packed.  A packed one
+// that the current output version and max sparse setting would pack
+// differently is returned packed anew though, as if it had changed;
+// hll_union(h, h) keeps upgrading h.
+//
+// A read-only expanded argument, a PL/pgSQL variable say, gets the
+// read-write copy made for it instead; returning the argument would
+// have the caller flatten it to copy it.  An expanded hll made just
+// for a packed argument is dropped if it isn't returned.
+//
+static Datum
+expanded_hll_unchanged(FunctionCallInfo fcinfo,
+                       int i_argno,
+                       expanded_hll_t * ehp)
 {
-    if (nregs <= 8)
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("number of registers too small")));
+    Datum ad = PG_GETARG_DATUM(i_argno);
 
-    switch (nregs)
+    if (expanded_hll_isarg(fcinfo, i_argno))
     {
-    case 16:	return 0.673 * nregs * nregs;
-    case 32:	return 0.697 * nregs * nregs;
-    case 64:	return 0.709 * nregs * nregs;
-    default:	return (0.7213 / (1.0 + 1.079 / nregs)) * nregs * nregs;
+        if (DatumGetEOHP(ad) != &ehp->eh_hdr)
+            return EOHPGetRWDatum(&ehp->eh_hdr);
+
+        return ad;
     }
+    else
+    {
+        size_t hsz;
+        size_t totsz;
+        uint8_t const * hdrp = hll_arg_header(fcinfo, i_argno, &hsz, &totsz);
+        int type;
+        size_t packedsz = multiset_packed_size(&ehp->eh_ms, &type);
+
+        // Given the multiset, the version and type decide the rest.
+        if (hsz < 1 || hdrp[0] >> 4 != g_output_version ||
+            (hdrp[0] & 0xf) != type || totsz != packedsz)
+            return EOHPGetRWDatum(&ehp->eh_hdr);
+    }
+
+    DeleteExpandedObject(EOHPGetRWDatum(&ehp->eh_hdr));
+
+    return ad;
 }
 
-static double
-multiset_card(multiset_t const * i_msp)
+// Cardinality of a multiset.
+//
+PG_FUNCTION_INFO_V1(hll_cardinality);
+Datum		hll_cardinality(PG_FUNCTION_ARGS);
+Datum
+hll_cardinality(PG_FUNCTION_ARGS)
 {
-    size_t nbits = i_msp->ms_nbits;
-    size_t log2m = i_msp->ms_log2nregs;
-
     double retval = 0.0;
 
-    uint64 max_register_value = (1ULL << nbits) - 1;
-    uint64 pw_bits = (max_register_value - 1);
-    uint64 total_bits = (pw_bits + log2m);
-    uint64 two_to_l = (1ULL << total_bits);
-
-    double large_estimator_cutoff = (double) two_to_l/30.0;
+    bytea * ab;
+    size_t asz;
+    uint8_t * abitp;
+    multiset_t ms;
+    multiset_t const * msp;
 
-    switch (i_msp->ms_type)
+    // An expanded multiset is already unpacked.
+    if (expanded_hll_isarg(fcinfo, 0))
+        msp = expanded_hll_getarg(fcinfo, 0, &ms);
+    else
     {
-    case MST_EMPTY:
-        retval = 0.0;
-        break;
-
-    case MST_EXPLICIT:
+        // A summary answers from the leading bytes alone, so try those
+        // first rather than fetching all of a toasted value, and only
+        // then the cache.
+        if (VARATT_IS_EXTERNAL(PG_GETARG_POINTER(0)) ||
+            VARATT_IS_COMPRESSED(PG_GETARG_POINTER(0)))
         {
-            ms_explicit_t const * msep = &i_msp->ms_data.as_expl;
-            return msep->mse_nelem;
-        }
-        break;
+            bytea * hb =
+                DatumGetByteaPSlice(PG_GETARG_DATUM(0), 0, MS_MAXHDRSZ);
 
-    case MST_COMPRESSED:
-        {
-            unsigned ii;
-            double sum;
-            int zero_count;
-            uint64_t rval;
-            double estimator;
-
-            ms_compressed_t const * mscp = &i_msp->ms_data.as_comp;
-            size_t nregs = i_msp->ms_nregs;
+            if (packed_summary((uint8_t *) VARDATA(hb),
+                               VARSIZE(hb) - VARHDRSZ, &retval, NULL))
+                PG_RETURN_FLOAT8(retval);
+        }
 
-            sum = 0.0;
-            zero_count = 0;
+        msp = decode_cache_get(PG_GETARG_DATUM(0));
+    }
 
-            for (ii = 0; ii < nregs; ++ii)
-            {
-                rval = mscp->msc_regs[ii];
-                sum += 1.0 / (1L << rval);
-                if (rval == 0)
-                    ++zero_count;
-            }
+    if (msp != NULL)
+    {
+        retval = multiset_card(msp);
 
-            estimator = gamma_register_count_squared(nregs) / sum;
+        if (retval == -1.0)
+            PG_RETURN_NULL();
+        else
+            PG_RETURN_FLOAT8(retval);
+    }
 
-            if ((zero_count != 0) && (estimator < (5.0 * nregs / 2.0)))
-                retval = nregs * log((double) nregs / zero_count);
-            else if (estimator <= large_estimator_cutoff)
-                retval = estimator;
-            else
-                return (-1 * two_to_l) * log(1.0 - (estimator/two_to_l));
-        }
-        break;
+    // Short varlena headers are fine, we only read the bytes.
+    ab = PG_GETARG_BYTEA_PP(0);
+    asz = VARSIZE_ANY_EXHDR(ab);
+    abitp = (uint8_t *) VARDATA_ANY(ab);
 
-    case MST_UNDEFINED:
-        // Our caller will convert this to a NULL.
-        retval = -1.0;
-        break;
+    if (!packed_card(abitp, asz, false, &retval))
+    {
+        multiset_unpack(&ms, abitp, asz, NULL);
 
-    default:
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("undefined multiset type value #8")));
-        break;
+        retval = multiset_card(&ms);
     }
 
-    return retval;
+    if (retval == -1.0)
+        PG_RETURN_NULL();
+    else
+        PG_RETURN_FLOAT8(retval);
 }
 
-// Cardinality of a multiset.
+// Cardinality of a multiset with a named estimator.
 //
-PG_FUNCTION_INFO_V1(hll_cardinality);
-Datum		hll_cardinality(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(hll_cardinality_estimator);
+Datum		hll_cardinality_estimator(PG_FUNCTION_ARGS);
 Datum
-hll_cardinality(PG_FUNCTION_ARGS)
+hll_cardinality_estimator(PG_FUNCTION_ARGS)
 {
     double retval = 0.0;
 
     bytea * ab;
     size_t asz;
+    uint8_t * abitp;
+    char * estimator;
+    bool ertl = false;
     multiset_t ms;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    ab = PG_GETARG_BYTEA_PP(0);
+    asz = VARSIZE_ANY_EXHDR(ab);
+    abitp = (uint8_t *) VARDATA_ANY(ab);
 
-    multiset_unpack(&ms, (uint8_t *) VARDATA(ab), asz, NULL);
+    estimator = text_to_cstring(PG_GETARG_TEXT_PP(1));
 
-    retval = multiset_card(&ms);
+    if (strcmp(estimator, "ertl") == 0)
+        ertl = true;
+    else if (strcmp(estimator, "classic") != 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("unknown cardinality estimator \"%s\"", estimator)));
+
+    if (!packed_card(abitp, asz, ertl, &retval))
+    {
+        multiset_unpack(&ms, abitp, asz, NULL);
+
+        retval = ertl ? multiset_card_ertl(&ms) : multiset_card(&ms);
+    }
 
     if (retval == -1.0)
         PG_RETURN_NULL();
@@ -2014,76 +6617,54 @@ hll_cardinality(PG_FUNCTION_ARGS)
 
 // Union of a pair of multiset.
 //
+// A union that changes nothing, including one of an hll with itself,
+// returns the first argument; see expanded_hll_unchanged.
+//
 PG_FUNCTION_INFO_V1(hll_union);
 Datum		hll_union(PG_FUNCTION_ARGS);
 Datum
 hll_union(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
-    size_t asz;
-    bytea * bb;
-    size_t bsz;
-
-    bytea * cb;
-    size_t csz;
+    expanded_hll_t * ehp;
+    multiset_t const * msbp;
 
-    multiset_t	msa;
     multiset_t	msb;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
-
-    bb = PG_GETARG_BYTEA_P(1);
-    bsz = VARSIZE(bb) - VARHDRSZ;
-
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
-    multiset_unpack(&msb, (uint8_t *) VARDATA(bb), bsz, NULL);
-
-    check_metadata(&msa, &msb);
+    ehp = expanded_hll_modarg(fcinfo, 0);
+    msbp = expanded_hll_getarg(fcinfo, 1, &msb);
 
-    multiset_union(&msa, &msb);
+    check_metadata(&ehp->eh_ms, msbp);
 
-    csz = multiset_packed_size(&msa);
-    cb = (bytea *) palloc(VARHDRSZ + csz);
-    SET_VARSIZE(cb, VARHDRSZ + csz);
+    if (!multiset_union_changes(&ehp->eh_ms, msbp))
+        PG_RETURN_DATUM(expanded_hll_unchanged(fcinfo, 0, ehp));
 
-    multiset_pack(&msa, (uint8_t *) VARDATA(cb), csz);
+    multiset_union(&ehp->eh_ms, msbp);
+    ehp->eh_flatsz = 0;
 
-    PG_RETURN_BYTEA_P(cb);
+    PG_RETURN_DATUM(EOHPGetRWDatum(&ehp->eh_hdr));
 }
 
 // Add an integer hash to a multiset.
 //
+// An add that changes nothing returns the multiset; see
+// expanded_hll_unchanged.
+//
 PG_FUNCTION_INFO_V1(hll_add);
 Datum		hll_add(PG_FUNCTION_ARGS);
 Datum
 hll_add(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
-    size_t asz;
-    int64 val;
-
-    bytea * cb;
-    size_t csz;
-
-    multiset_t	msa;
-
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
-
-    val = PG_GETARG_INT64(1);
-
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    int64 val = PG_GETARG_INT64(1);
+    expanded_hll_t * ehp = expanded_hll_modarg(fcinfo, 0);
 
-    multiset_add(&msa, val);
+    if (!multiset_add_changes(&ehp->eh_ms, val))
+        PG_RETURN_DATUM(expanded_hll_unchanged(fcinfo, 0, ehp));
 
-    csz = multiset_packed_size(&msa);
-    cb = (bytea *) palloc(VARHDRSZ + csz);
-    SET_VARSIZE(cb, VARHDRSZ + csz);
+    multiset_add(&ehp->eh_ms, val);
+    explicit_settle(&ehp->eh_ms);
+    ehp->eh_flatsz = 0;
 
-    multiset_pack(&msa, (uint8_t *) VARDATA(cb), csz);
-
-    PG_RETURN_BYTEA_P(cb);
+    PG_RETURN_DATUM(EOHPGetRWDatum(&ehp->eh_hdr));
 }
 
 // Add a multiset to an integer hash.
@@ -2093,31 +6674,66 @@ Datum		hll_add_rev(PG_FUNCTION_ARGS);
 Datum
 hll_add_rev(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
-    size_t asz;
-    int64 val;
+    int64 val = PG_GETARG_INT64(0);
+    expanded_hll_t * ehp = expanded_hll_modarg(fcinfo, 1);
 
-    bytea * cb;
-    size_t csz;
+    if (!multiset_add_changes(&ehp->eh_ms, val))
+        PG_RETURN_DATUM(expanded_hll_unchanged(fcinfo, 1, ehp));
 
-    multiset_t	msa;
+    multiset_add(&ehp->eh_ms, val);
+    explicit_settle(&ehp->eh_ms);
+    ehp->eh_flatsz = 0;
 
-    val = PG_GETARG_INT64(0);
+    PG_RETURN_DATUM(EOHPGetRWDatum(&ehp->eh_hdr));
+}
 
-    ab = PG_GETARG_BYTEA_P(1);
-    asz = VARSIZE(ab) - VARHDRSZ;
+// Would adding an integer hash change a multiset?  Lets an UPDATE skip
+// the rows that hll_add would leave alone.
+//
+PG_FUNCTION_INFO_V1(hll_add_would_change);
+Datum		hll_add_would_change(PG_FUNCTION_ARGS);
+Datum
+hll_add_would_change(PG_FUNCTION_ARGS)
+{
+    int64 val = PG_GETARG_INT64(1);
+    multiset_t const * msp;
 
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    multiset_t	ms;
 
-    multiset_add(&msa, val);
+    msp = expanded_hll_getarg(fcinfo, 0, &ms);
 
-    csz = multiset_packed_size(&msa);
-    cb = (bytea *) palloc(VARHDRSZ + csz);
-    SET_VARSIZE(cb, VARHDRSZ + csz);
+    PG_RETURN_BOOL(multiset_add_changes(msp, val));
+}
 
-    multiset_pack(&msa, (uint8_t *) VARDATA(cb), csz);
+// Would the union with a second multiset change the first?
+//
+PG_FUNCTION_INFO_V1(hll_union_would_change);
+Datum		hll_union_would_change(PG_FUNCTION_ARGS);
+Datum
+hll_union_would_change(PG_FUNCTION_ARGS)
+{
+    multiset_t const * msap;
+    multiset_t const * msbp;
 
-    PG_RETURN_BYTEA_P(cb);
+    multiset_t	msa;
+    multiset_t	msb;
+
+    msap = expanded_hll_getarg(fcinfo, 0, &msa);
+
+    // Looking the second argument up in the decode cache may evict the
+    // first, so hold a copy of a cached one.
+    if (msap != &msa && !expanded_hll_isarg(fcinfo, 0))
+    {
+        multiset_init(&msa, CurrentMemoryContext);
+        multiset_copy(&msa, msap);
+        msap = &msa;
+    }
+
+    msbp = expanded_hll_getarg(fcinfo, 1, &msb);
+
+    check_metadata(msap, msbp);
+
+    PG_RETURN_BOOL(multiset_union_changes(msap, msbp));
 }
 
 // Pretty-print a multiset
@@ -2171,7 +6787,7 @@ hll_empty4(PG_FUNCTION_ARGS)
     ms.ms_expthresh = expthresh;
     ms.ms_sparseon = sparseon;
 
-    csz = multiset_packed_size(&ms);
+    csz = multiset_packed_size(&ms, NULL);
     cb = (bytea *) palloc(VARHDRSZ + csz);
     SET_VARSIZE(cb, VARHDRSZ + csz);
 
@@ -2243,16 +6859,16 @@ Datum		hll_schema_version(PG_FUNCTION_ARGS);
 Datum
 hll_schema_version(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
+    uint8_t const * abitp;
+    size_t ahsz;
     size_t asz;
     multiset_t	msa;
     uint8_t vers;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    abitp = hll_arg_header(fcinfo, 0, &ahsz, &asz);
 
-    // Unpack the multiset.
-    vers = multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    // Only the header is needed.
+    vers = multiset_unpack_header(&msa, abitp, ahsz, asz, NULL);
 
 	PG_RETURN_INT32(vers);
 }
@@ -2264,16 +6880,16 @@ Datum		hll_type(PG_FUNCTION_ARGS);
 Datum
 hll_type(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
+    uint8_t const * abitp;
+    size_t ahsz;
     size_t asz;
     multiset_t	msa;
     uint8_t type;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    abitp = hll_arg_header(fcinfo, 0, &ahsz, &asz);
 
-    // Unpack the multiset.
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, &type);
+    // Only the header is needed.
+    multiset_unpack_header(&msa, abitp, ahsz, asz, &type);
 
 	PG_RETURN_INT32(type);
 }
@@ -2285,15 +6901,15 @@ Datum		hll_log2m(PG_FUNCTION_ARGS);
 Datum
 hll_log2m(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
+    uint8_t const * abitp;
+    size_t ahsz;
     size_t asz;
     multiset_t	msa;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    abitp = hll_arg_header(fcinfo, 0, &ahsz, &asz);
 
-    // Unpack the multiset.
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    // Only the header is needed.
+    multiset_unpack_header(&msa, abitp, ahsz, asz, NULL);
 
 	PG_RETURN_INT32(msa.ms_log2nregs);
 }
@@ -2305,15 +6921,15 @@ Datum		hll_regwidth(PG_FUNCTION_ARGS);
 Datum
 hll_regwidth(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
+    uint8_t const * abitp;
+    size_t ahsz;
     size_t asz;
     multiset_t	msa;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    abitp = hll_arg_header(fcinfo, 0, &ahsz, &asz);
 
-    // Unpack the multiset.
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    // Only the header is needed.
+    multiset_unpack_header(&msa, abitp, ahsz, asz, NULL);
 
 	PG_RETURN_INT32(msa.ms_nbits);
 }
@@ -2325,7 +6941,8 @@ Datum		hll_expthresh(PG_FUNCTION_ARGS);
 Datum
 hll_expthresh(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
+    uint8_t const * abitp;
+    size_t ahsz;
     size_t asz;
     multiset_t	msa;
 
@@ -2337,11 +6954,10 @@ hll_expthresh(PG_FUNCTION_ARGS)
 
 	Datum		result;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    abitp = hll_arg_header(fcinfo, 0, &ahsz, &asz);
 
-    // Unpack the multiset.
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    // Only the header is needed.
+    multiset_unpack_header(&msa, abitp, ahsz, asz, NULL);
 
     nbits = msa.ms_nbits;
     nregs = msa.ms_nregs;
@@ -2384,15 +7000,15 @@ Datum		hll_sparseon(PG_FUNCTION_ARGS);
 Datum
 hll_sparseon(PG_FUNCTION_ARGS)
 {
-    bytea * ab;
+    uint8_t const * abitp;
+    size_t ahsz;
     size_t asz;
     multiset_t	msa;
 
-    ab = PG_GETARG_BYTEA_P(0);
-    asz = VARSIZE(ab) - VARHDRSZ;
+    abitp = hll_arg_header(fcinfo, 0, &ahsz, &asz);
 
-    // Unpack the multiset.
-    multiset_unpack(&msa, (uint8_t *) VARDATA(ab), asz, NULL);
+    // Only the header is needed.
+    multiset_unpack_header(&msa, abitp, ahsz, asz, NULL);
 
 	PG_RETURN_INT32(msa.ms_sparseon);
 }
@@ -2407,12 +7023,13 @@ hll_set_output_version(PG_FUNCTION_ARGS)
     int32 old_vers = g_output_version;
     int32 vers = PG_GETARG_INT32(0);
 
-    if (vers != 1)
+    if (vers < 1 || vers > MS_MAXVERSION)
         ereport(ERROR,
                 (errcode(ERRCODE_DATA_EXCEPTION),
-                 errmsg("output version must be 1")));
+                 errmsg("output version must be between 1 and %d",
+                        MS_MAXVERSION)));
 
-    g_output_version = vers;
+    set_session_option("hll.output_version", vers);
 
     PG_RETURN_INT32(old_vers);
 }
@@ -2432,7 +7049,7 @@ hll_set_max_sparse(PG_FUNCTION_ARGS)
                 (errcode(ERRCODE_DATA_EXCEPTION),
                  errmsg("sparse threshold must be in range [-1,MAXINT]")));
 
-    g_max_sparse = maxsparse;
+    set_session_option("hll.max_sparse", maxsparse);
 
     PG_RETURN_INT32(old_maxsparse);
 }
@@ -2458,10 +7075,10 @@ hll_set_defaults(PG_FUNCTION_ARGS)
 
     check_modifiers(log2m, regwidth, expthresh, sparseon);
 
-    g_default_log2m = log2m;
-    g_default_regwidth = regwidth;
-    g_default_expthresh = expthresh;
-    g_default_sparseon = sparseon;
+    set_session_option("hll.default_log2m", log2m);
+    set_session_option("hll.default_regwidth", regwidth);
+    set_session_option("hll.default_expthresh", expthresh);
+    set_session_option("hll.default_sparseon", sparseon);
 
     // Build the result tuple.
 	{
@@ -2740,30 +7357,97 @@ hll_ne(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(retval);
 }
 
-// This function creates a multiset_t in a temporary context.
+// Aggregate transition states are carved out of blocks allocated in
+// the aggregate context rather than giving each group its own memory
+// context.  The headers are never freed individually, the blocks go
+// away wholesale when the aggregate context is reset.  The explicit
+// elements and registers are allocated directly in the aggregate
+// context since they grow.
+//
+// An arena is cached in fn_extra for each aggregate context seen by
+// the calling aggregate (there is one per grouping set).  A reset
+// callback unlinks the arena when its context goes away.
+//
+#define MS_ARENA_BLOCKSZ	(8 * 1024)
+
+typedef struct ms_arena
+{
+    MemoryContext			msa_mcxt;	// The aggregate context.
+    char *					msa_free;	// Next free header.
+    size_t					msa_avail;	// Bytes left in the block.
+    struct ms_arena *		msa_next;	// Other contexts' arenas.
+    struct ms_arena **		msa_prevp;
+    MemoryContextCallback	msa_cb;
+
+} ms_arena_t;
+
+static void
+arena_reset_callback(void * arg)
+{
+    ms_arena_t * arena = (ms_arena_t *) arg;
+
+    *arena->msa_prevp = arena->msa_next;
+    if (arena->msa_next != NULL)
+        arena->msa_next->msa_prevp = arena->msa_prevp;
+}
+
+static ms_arena_t *
+arena_lookup(FmgrInfo * flinfo, MemoryContext aggctx)
+{
+    ms_arena_t ** headp;
+    ms_arena_t * arena;
+
+    if (flinfo->fn_extra == NULL)
+        flinfo->fn_extra = MemoryContextAllocZero(flinfo->fn_mcxt,
+                                                  sizeof(ms_arena_t *));
+
+    headp = (ms_arena_t **) flinfo->fn_extra;
+
+    for (arena = *headp; arena != NULL; arena = arena->msa_next)
+        if (arena->msa_mcxt == aggctx)
+            return arena;
+
+    arena = (ms_arena_t *) MemoryContextAllocZero(aggctx, sizeof(ms_arena_t));
+    arena->msa_mcxt = aggctx;
+
+    arena->msa_next = *headp;
+    arena->msa_prevp = headp;
+    if (*headp != NULL)
+        (*headp)->msa_prevp = &arena->msa_next;
+    *headp = arena;
+
+    arena->msa_cb.func = arena_reset_callback;
+    arena->msa_cb.arg = arena;
+    MemoryContextRegisterResetCallback(aggctx, &arena->msa_cb);
+
+    return arena;
+}
+
+// This function creates a multiset_t in the aggregate context.
 //
-multiset_t *	setup_multiset(MemoryContext rcontext);
+multiset_t *	setup_multiset(FunctionCallInfo fcinfo, MemoryContext aggctx);
 multiset_t *
-setup_multiset(MemoryContext rcontext)
+setup_multiset(FunctionCallInfo fcinfo, MemoryContext aggctx)
 {
-    MemoryContext tmpcontext;
-    MemoryContext oldcontext;
+    ms_arena_t * arena = arena_lookup(fcinfo->flinfo, aggctx);
+    size_t hdrsz = MAXALIGN(sizeof(multiset_t));
     multiset_t * msp;
 
-    tmpcontext = AllocSetContextCreate(rcontext,
-                                       "multiset",
-                                       ALLOCSET_DEFAULT_MINSIZE,
-                                       ALLOCSET_DEFAULT_INITSIZE,
-                                       ALLOCSET_DEFAULT_MAXSIZE);
+    // Start a new block if this one is used up.
+    if (arena->msa_avail < hdrsz)
+    {
+        arena->msa_free = (char *) MemoryContextAlloc(aggctx, MS_ARENA_BLOCKSZ);
+        arena->msa_avail = MS_ARENA_BLOCKSZ;
+    }
 
-    oldcontext = MemoryContextSwitchTo(tmpcontext);
+    msp = (multiset_t *) arena->msa_free;
+    arena->msa_free += hdrsz;
+    arena->msa_avail -= hdrsz;
 
-    msp = (multiset_t *) palloc(sizeof(multiset_t));
+    multiset_init(msp, aggctx);
 
     msp->ms_type = MST_UNINIT;
 
-    MemoryContextSwitchTo(oldcontext);
-
     return msp;
 }
 
@@ -2785,6 +7469,7 @@ hll_union_trans(PG_FUNCTION_ARGS)
     multiset_t * msap;
 
     multiset_t msb;
+    multiset_t const * msbp;
 
     // We must be called as a transition routine or we fail.
     if (!AggCheckCallContext(fcinfo, &aggctx))
@@ -2795,7 +7480,7 @@ hll_union_trans(PG_FUNCTION_ARGS)
     // Is the first argument a NULL?
     if (PG_ARGISNULL(0))
     {
-        msap = setup_multiset(aggctx);
+        msap = setup_multiset(fcinfo, aggctx);
     }
     else
     {
@@ -2805,26 +7490,36 @@ hll_union_trans(PG_FUNCTION_ARGS)
     // Is the second argument non-null?
     if (!PG_ARGISNULL(1))
     {
-        // This is the packed "argument" vector.
-        bb = PG_GETARG_BYTEA_P(1);
-        bsz = VARSIZE(bb) - VARHDRSZ;
+        msbp = decode_cache_get(PG_GETARG_DATUM(1));
+        if (msbp == NULL)
+        {
+            // This is the packed "argument" vector.
+            bb = PG_GETARG_BYTEA_P(1);
+            bsz = VARSIZE(bb) - VARHDRSZ;
 
-        multiset_unpack(&msb, (uint8_t *) VARDATA(bb), bsz, NULL);
+            // Once the accumulator has registers, merge the argument
+            // straight into them.
+            if (multiset_union_packed(msap, (uint8_t *) VARDATA(bb), bsz))
+                PG_RETURN_POINTER(msap);
+
+            multiset_unpack(&msb, (uint8_t *) VARDATA(bb), bsz, NULL);
+            msbp = &msb;
+        }
 
         // Was the first argument uninitialized?
         if (msap->ms_type == MST_UNINIT)
         {
             // Yes, clone the metadata from the second arg.
-            copy_metadata(msap, &msb);
+            copy_metadata(msap, msbp);
             msap->ms_type = MST_EMPTY;
         }
         else
         {
             // Nope, make sure the metadata is compatible.
-            check_metadata(msap, &msb);
+            check_metadata(msap, msbp);
         }
 
-        multiset_union(msap, &msb);
+        multiset_union(msap, msbp);
     }
 
     PG_RETURN_POINTER(msap);
@@ -2858,12 +7553,10 @@ hll_add_trans4(PG_FUNCTION_ARGS)
         int64 expthresh = PG_GETARG_INT64(4);
         int32 sparseon = PG_GETARG_INT32(5);
 
-        msap = setup_multiset(aggctx);
+        msap = setup_multiset(fcinfo, aggctx);
 
         check_modifiers(log2m, regwidth, expthresh, sparseon);
 
-        memset(msap, '\0', sizeof(multiset_t));
-
         msap->ms_type = MST_EMPTY;
         msap->ms_nbits = regwidth;
         msap->ms_nregs = 1 << log2m;
@@ -2881,7 +7574,7 @@ hll_add_trans4(PG_FUNCTION_ARGS)
     {
         int64 val = PG_GETARG_INT64(1);
 
-        multiset_add(msap, val);
+        multiset_add_pending(msap, val);
     }
 
     PG_RETURN_POINTER(msap);
@@ -2915,12 +7608,10 @@ hll_add_trans3(PG_FUNCTION_ARGS)
         int64 expthresh = PG_GETARG_INT64(4);
         int32 sparseon = g_default_sparseon;
 
-        msap = setup_multiset(aggctx);
+        msap = setup_multiset(fcinfo, aggctx);
 
         check_modifiers(log2m, regwidth, expthresh, sparseon);
 
-        memset(msap, '\0', sizeof(multiset_t));
-
         msap->ms_type = MST_EMPTY;
         msap->ms_nbits = regwidth;
         msap->ms_nregs = 1 << log2m;
@@ -2938,7 +7629,7 @@ hll_add_trans3(PG_FUNCTION_ARGS)
     {
         int64 val = PG_GETARG_INT64(1);
 
-        multiset_add(msap, val);
+        multiset_add_pending(msap, val);
     }
 
     PG_RETURN_POINTER(msap);
@@ -2972,12 +7663,10 @@ hll_add_trans2(PG_FUNCTION_ARGS)
         int64 expthresh = g_default_expthresh;
         int32 sparseon = g_default_sparseon;
 
-        msap = setup_multiset(aggctx);
+        msap = setup_multiset(fcinfo, aggctx);
 
         check_modifiers(log2m, regwidth, expthresh, sparseon);
 
-        memset(msap, '\0', sizeof(multiset_t));
-
         msap->ms_type = MST_EMPTY;
         msap->ms_nbits = regwidth;
         msap->ms_nregs = 1 << log2m;
@@ -2995,7 +7684,7 @@ hll_add_trans2(PG_FUNCTION_ARGS)
     {
         int64 val = PG_GETARG_INT64(1);
 
-        multiset_add(msap, val);
+        multiset_add_pending(msap, val);
     }
 
     PG_RETURN_POINTER(msap);
@@ -3029,12 +7718,10 @@ hll_add_trans1(PG_FUNCTION_ARGS)
         int64 expthresh = g_default_expthresh;
         int32 sparseon = g_default_sparseon;
 
-        msap = setup_multiset(aggctx);
+        msap = setup_multiset(fcinfo, aggctx);
 
         check_modifiers(log2m, regwidth, expthresh, sparseon);
 
-        memset(msap, '\0', sizeof(multiset_t));
-
         msap->ms_type = MST_EMPTY;
         msap->ms_nbits = regwidth;
         msap->ms_nregs = 1 << log2m;
@@ -3052,7 +7739,7 @@ hll_add_trans1(PG_FUNCTION_ARGS)
     {
         int64 val = PG_GETARG_INT64(1);
 
-        multiset_add(msap, val);
+        multiset_add_pending(msap, val);
     }
 
     PG_RETURN_POINTER(msap);
@@ -3086,12 +7773,10 @@ hll_add_trans0(PG_FUNCTION_ARGS)
         int64 expthresh = g_default_expthresh;
         int32 sparseon = g_default_sparseon;
 
-        msap = setup_multiset(aggctx);
+        msap = setup_multiset(fcinfo, aggctx);
 
         check_modifiers(log2m, regwidth, expthresh, sparseon);
 
-        memset(msap, '\0', sizeof(multiset_t));
-
         msap->ms_type = MST_EMPTY;
         msap->ms_nbits = regwidth;
         msap->ms_nregs = 1 << log2m;
@@ -3109,7 +7794,7 @@ hll_add_trans0(PG_FUNCTION_ARGS)
     {
         int64 val = PG_GETARG_INT64(1);
 
-        multiset_add(msap, val);
+        multiset_add_pending(msap, val);
     }
 
     PG_RETURN_POINTER(msap);
@@ -3151,7 +7836,9 @@ hll_pack(PG_FUNCTION_ARGS)
         }
         else
         {
-            csz = multiset_packed_size(msap);
+            multiset_settle(msap);
+
+            csz = multiset_packed_size(msap, NULL);
             cb = (bytea *) palloc(VARHDRSZ + csz);
             SET_VARSIZE(cb, VARHDRSZ + csz);
 
@@ -3202,6 +7889,7 @@ hll_card_unpacked(PG_FUNCTION_ARGS)
         }
         else
         {
+            multiset_settle(msap);
             retval = multiset_card(msap);
         }
 
@@ -3254,6 +7942,7 @@ hll_floor_card_unpacked(PG_FUNCTION_ARGS)
         }
         else
         {
+            multiset_settle(msap);
             retval = multiset_card(msap);
         }
 
@@ -3313,6 +8002,7 @@ hll_ceil_card_unpacked(PG_FUNCTION_ARGS)
         }
         else
         {
+            multiset_settle(msap);
             retval = multiset_card(msap);
         }
 
@@ -3335,12 +8025,205 @@ hll_ceil_card_unpacked(PG_FUNCTION_ARGS)
     }
 }
 
+// Combine function, merges two partial aggregation states.
+//
+// NOTE - This function is not declared STRICT, either state may be
+// NULL (or uninitialized) when a worker saw no input rows.
+//
+PG_FUNCTION_INFO_V1(hll_union_internal);
+Datum		hll_union_internal(PG_FUNCTION_ARGS);
+Datum
+hll_union_internal(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggctx;
+
+    multiset_t * msap;
+    multiset_t * msbp;
+
+    // We must be called as a transition routine or we fail.
+    if (!AggCheckCallContext(fcinfo, &aggctx))
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("hll_union_internal outside aggregate context")));
+
+    msap = PG_ARGISNULL(0) ? NULL : (multiset_t *) PG_GETARG_POINTER(0);
+    msbp = PG_ARGISNULL(1) ? NULL : (multiset_t *) PG_GETARG_POINTER(1);
+
+    // Is there anything to merge from the second state?
+    if (msbp == NULL || msbp->ms_type == MST_UNINIT)
+    {
+        if (msap == NULL)
+            PG_RETURN_NULL();
+
+        PG_RETURN_POINTER(msap);
+    }
+
+    // Both states must be up to date before they're combined.
+    multiset_settle(msbp);
+    if (msap != NULL)
+        multiset_settle(msap);
+
+    // Is the first state missing or uninitialized?
+    if (msap == NULL || msap->ms_type == MST_UNINIT)
+    {
+        // Yes, clone the second state.  It must live in the aggregate
+        // context since the second state may be freed under us.
+        if (msap == NULL)
+            msap = setup_multiset(fcinfo, aggctx);
+
+        multiset_copy(msap, msbp);
+    }
+    else
+    {
+        // Nope, make sure the metadata is compatible.
+        check_metadata(msap, msbp);
+
+        multiset_union(msap, msbp);
+    }
+
+    PG_RETURN_POINTER(msap);
+}
+
+// Serialization function, flattens a multiset_t aggregation state.
+//
+// The header and data are shipped verbatim; it's only ever read back
+// by the same library in another backend of the same cluster.
+//
+PG_FUNCTION_INFO_V1(hll_serialize);
+Datum		hll_serialize(PG_FUNCTION_ARGS);
+Datum
+hll_serialize(PG_FUNCTION_ARGS)
+{
+    bytea * sb;
+    size_t ssz;
+
+    multiset_t * msap;
+
+    // We must be called as a transition routine or we fail.
+    if (!AggCheckCallContext(fcinfo, NULL))
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("hll_serialize outside aggregate context")));
+
+    msap = (multiset_t *) PG_GETARG_POINTER(0);
+
+    multiset_settle(msap);
+
+    ssz = multiset_copy_size(msap);
+    sb = (bytea *) palloc(VARHDRSZ + MS_HDRSZ + ssz);
+    SET_VARSIZE(sb, VARHDRSZ + MS_HDRSZ + ssz);
+
+    memcpy(VARDATA(sb), msap, MS_HDRSZ);
+    memcpy(VARDATA(sb) + MS_HDRSZ, msap->ms_data.as_buf, ssz);
+
+    PG_RETURN_BYTEA_P(sb);
+}
+
+// Deserialization function, rebuilds a multiset_t aggregation state
+// from the output of hll_serialize.
+//
+PG_FUNCTION_INFO_V1(hll_deserialize);
+Datum		hll_deserialize(PG_FUNCTION_ARGS);
+Datum
+hll_deserialize(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggctx;
+
+    bytea * sb;
+    size_t ssz;
+
+    multiset_t * msap;
+
+    // We must be called as a transition routine or we fail.
+    if (!AggCheckCallContext(fcinfo, &aggctx))
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("hll_deserialize outside aggregate context")));
+
+    sb = PG_GETARG_BYTEA_P(0);
+    ssz = VARSIZE(sb) - VARHDRSZ;
+
+    if (ssz < MS_HDRSZ)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("invalid serialized hll state size %d", (int) ssz)));
+
+    msap = setup_multiset(fcinfo, aggctx);
+
+    memcpy(msap, VARDATA(sb), MS_HDRSZ);
+    ssz -= MS_HDRSZ;
+
+    // The explicit element count is implied by the data size; the
+    // state was settled before it was serialized.
+    if (msap->ms_type == MST_EXPLICIT)
+    {
+        msap->ms_data.as_expl.mse_nelem = ssz / sizeof(uint64_t);
+        msap->ms_data.as_expl.mse_nsorted = ssz / sizeof(uint64_t);
+    }
+
+    // So is the sparse table size, which must be a power of two.
+    if (msap->ms_type == MST_SPARSE)
+    {
+        size_t nslots = ssz / sizeof(uint32_t);
+        if (nslots < MS_MINSPARSE || (nslots & (nslots - 1)) != 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_EXCEPTION),
+                     errmsg("invalid serialized hll state size %d",
+                            (int) (MS_HDRSZ + ssz))));
+        msap->ms_data.as_sprs.mss_nslots = nslots;
+    }
+
+    if (multiset_copy_size(msap) != ssz)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_EXCEPTION),
+                 errmsg("invalid serialized hll state size %d",
+                        (int) (MS_HDRSZ + ssz))));
+
+    // The register histogram isn't shipped, but needs its room.
+    if (msap->ms_type == MST_COMPRESSED)
+    {
+        multiset_reserve(msap, compressed_bufsz(msap));
+        msap->ms_data.as_comp.msc_histok = false;
+    }
+
+    if (ssz > 0)
+    {
+        multiset_reserve(msap, ssz);
+        memcpy(msap->ms_data.as_buf, VARDATA(sb) + MS_HDRSZ, ssz);
+    }
+
+    // Recount the filled sparse registers.
+    if (msap->ms_type == MST_SPARSE)
+    {
+        ms_sparse_t * mssp = &msap->ms_data.as_sprs;
+        for (size_t ii = 0; ii < mssp->mss_nslots; ++ii)
+            if (mssp->mss_slots[ii] != 0)
+                mssp->mss_nfilled++;
+    }
+
+    PG_RETURN_POINTER(msap);
+}
+
 PG_FUNCTION_INFO_V1(hll_recv);
 Datum hll_recv(PG_FUNCTION_ARGS);
 Datum
 hll_recv(PG_FUNCTION_ARGS)
 {
     Datum dd = DirectFunctionCall1(bytearecv, PG_GETARG_DATUM(0));
+
+    // Receive functions are always passed the typmod as well, which
+    // is valid for binary COPY.
+    int32 typmod = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : -1;
+
+    // Make sure the data is valid, as hll_in does.
+    bytea * bp = DatumGetByteaP(dd);
+    size_t sz = VARSIZE(bp) - VARHDRSZ;
+    multiset_t ms;
+    multiset_validate(&ms, (uint8_t *) VARDATA(bp), sz);
+
+    if (typmod != -1)
+        check_typmod(typmod, &ms);
+
     return dd;
 }
 
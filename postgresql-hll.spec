@@ -19,7 +19,7 @@
 
 Summary: Aggregate Knowledge HyperLogLog PostgreSQL extension.
 Name: postgresql%{shortversion}-hll
-Version: 2.10.0
+Version: 2.11.0
 Release: 0
 License: Apache License, Version 2.0
 URL: https://github.com/aggregateknowledge/postgresql-hll
@@ -49,6 +49,8 @@ mkdir -p $RPM_BUILD_ROOT
 mkdir -p $RPM_BUILD_ROOT%{pgbaseinstdir}/share/extension
 install -m644 hll.control $RPM_BUILD_ROOT%{pgbaseinstdir}/share/extension
 install -m644 hll--2.10.0.sql $RPM_BUILD_ROOT%{pgbaseinstdir}/share/extension
+install -m644 hll--2.10.0--2.11.0.sql $RPM_BUILD_ROOT%{pgbaseinstdir}/share/extension
+install -m644 hll--2.11.0.sql $RPM_BUILD_ROOT%{pgbaseinstdir}/share/extension
 
 mkdir -p $RPM_BUILD_ROOT%{pgbaseinstdir}/lib
 install -m755 hll.so $RPM_BUILD_ROOT%{pgbaseinstdir}/lib
@@ -63,6 +65,8 @@ rm -rf $RPM_BUILD_ROOT
 %dir %{pgbaseinstdir}/share/extension
 %{pgbaseinstdir}/share/extension/hll.control
 %{pgbaseinstdir}/share/extension/hll--2.10.0.sql
+%{pgbaseinstdir}/share/extension/hll--2.10.0--2.11.0.sql
+%{pgbaseinstdir}/share/extension/hll--2.11.0.sql
 
 %{pgbaseinstdir}/lib/hll.so
 
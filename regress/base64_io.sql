@@ -0,0 +1,69 @@
+-- ----------------------------------------------------------------
+-- Base64 text output, and base64 and hex text input.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SET hll.output_format = base64;
+
+SELECT E'\\x118b7f'::hll;
+
+SELECT E'\\x128b7f0000000000000001'::hll;
+
+SELECT E'\\x138b7f0001'::hll;
+
+SELECT E'\\x14847f0102030405060708090a'::hll;
+
+-- Base64 input, with and without padding.
+
+SELECT E'\\bEYt/'::hll = E'\\x118b7f'::hll;
+
+SELECT E'\\bEot/AAAAAAAAAAE='::hll = E'\\x128b7f0000000000000001'::hll;
+
+SELECT E'\\bFIR/AQIDBAUGBwgJCg=='::hll = E'\\x14847f0102030405060708090a'::hll;
+
+-- ERROR:  invalid base64 hll input
+SELECT E'\\bEYt'::hll;
+
+-- ERROR:  invalid base64 hll input
+SELECT E'\\bE4t/A=E='::hll;
+
+-- ERROR:  invalid base64 hll input
+SELECT E'\\bEYt*'::hll;
+
+-- ERROR:  multiset header too small
+SELECT E'\\b'::hll;
+
+-- Dense sketches are long enough for the vectorized codec.
+
+SELECT length(hll_add_agg(hll_hash_integer(gs))::text)
+  FROM generate_series(1, 10000) AS gs;
+
+SELECT hll_add_agg(hll_hash_integer(gs))::text::hll =
+       hll_add_agg(hll_hash_integer(gs))
+  FROM generate_series(1, 10000) AS gs;
+
+-- Text COPY round trip.
+
+DROP TABLE IF EXISTS test_qkzdwmfa;
+
+CREATE TABLE test_qkzdwmfa (v1 hll);
+
+INSERT INTO test_qkzdwmfa
+SELECT hll_add_agg(hll_hash_integer(gs))
+  FROM generate_series(1, 10000) AS gs;
+
+INSERT INTO test_qkzdwmfa VALUES (E'\\x138b7f0001');
+
+\COPY test_qkzdwmfa TO 'base64.dat'
+
+\COPY test_qkzdwmfa FROM 'base64.dat'
+
+SELECT count(*) FROM test_qkzdwmfa AS aa, test_qkzdwmfa AS bb
+ WHERE aa.v1 = bb.v1;
+
+RESET hll.output_format;
+
+SELECT E'\\bEYt/'::hll;
+
+DROP TABLE test_qkzdwmfa;
@@ -0,0 +1,28 @@
+-- ----------------------------------------------------------------
+-- Regression tests for the named cardinality estimators.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+-- Undefined, empty and explicit multisets are the same either way.
+SELECT hll_cardinality(E'\\x108b49'::hll, 'classic'),
+       hll_cardinality(E'\\x108b49'::hll, 'ertl');
+
+SELECT hll_cardinality(hll_empty(11,5,256,1), 'classic'),
+       hll_cardinality(hll_empty(11,5,256,1), 'ertl');
+
+SELECT hll_cardinality(E'\\x128b498895a3f5af28cafeda0ce907e4355b60'::hll, 'classic'),
+       hll_cardinality(E'\\x128b498895a3f5af28cafeda0ce907e4355b60'::hll, 'ertl');
+
+-- Dense multisets below, in and above the transition region.
+SELECT n,
+       round(hll_cardinality(h, 'classic')) = round(hll_cardinality(h)) AS same,
+       round(hll_cardinality(h, 'classic')) AS classic,
+       round(hll_cardinality(h, 'ertl')) AS ertl
+  FROM (SELECT n, hll_add_agg(hll_hash_integer(gs), 10, 5, 0, 0) AS h
+          FROM (VALUES (100), (2500), (1000000)) AS ns(n),
+               generate_series(1, n) AS gs
+         GROUP BY n) AS tt
+ ORDER BY n;
+
+SELECT hll_cardinality(hll_empty(11,5,256,1), 'other');
@@ -0,0 +1,106 @@
+-- ----------------------------------------------------------------
+-- The decode cache of sketches stored out of line.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SET max_parallel_workers_per_gather = 0;
+
+DROP TABLE IF EXISTS test_vbxnqeml;
+
+CREATE TABLE test_vbxnqeml (
+    n integer,
+    h hll
+);
+
+ALTER TABLE test_vbxnqeml ALTER COLUMN h SET STORAGE EXTERNAL;
+
+INSERT INTO test_vbxnqeml
+SELECT n, hll_add_agg(hll_hash_integer(gs), 14, 5, 0, 0)
+  FROM (VALUES (1000), (10000), (100000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+-- Off by default.
+SHOW hll.decode_cache_size;
+
+DROP TABLE IF EXISTS test_tjrwkzpa;
+
+CREATE TABLE test_tjrwkzpa AS
+SELECT n, #h AS card
+  FROM test_vbxnqeml;
+
+SELECT hits, misses, entries FROM hll_decode_cache_stats();
+
+SET hll.decode_cache_size = '1MB';
+
+-- The first reads fill the cache, later ones hit it.
+SELECT count(*)
+  FROM test_vbxnqeml t JOIN test_tjrwkzpa r USING (n)
+ WHERE #t.h = r.card;
+
+SELECT hits, misses, entries FROM hll_decode_cache_stats();
+
+SELECT count(*)
+  FROM test_vbxnqeml t JOIN test_tjrwkzpa r USING (n)
+ WHERE #t.h = r.card;
+
+SELECT hits, misses, entries FROM hll_decode_cache_stats();
+
+-- Each sketch holds the hashes of the smaller ones.
+SELECT hll_union_agg(h) = (SELECT h FROM test_vbxnqeml WHERE n = 100000)
+  FROM test_vbxnqeml;
+
+SELECT n, hll_union(h, h) = h AS self_union
+  FROM test_vbxnqeml
+ ORDER BY n;
+
+SELECT hits, misses, entries, bytes > 0 AS bytes
+  FROM hll_decode_cache_stats();
+
+-- Inline sketches aren't cached.
+SELECT #hll_empty(14,5,0,0);
+
+SELECT hits, misses, entries FROM hll_decode_cache_stats();
+
+-- Turning it off empties it.
+SET hll.decode_cache_size = 0;
+
+SELECT count(*)
+  FROM test_vbxnqeml t JOIN test_tjrwkzpa r USING (n)
+ WHERE #t.h = r.card;
+
+SELECT hits, misses, entries, bytes FROM hll_decode_cache_stats();
+
+-- Sketches larger than the cache are decoded but not kept.
+SET hll.decode_cache_size = '8kB';
+
+SELECT hll_decode_cache_reset();
+
+SELECT count(*)
+  FROM test_vbxnqeml t JOIN test_tjrwkzpa r USING (n)
+ WHERE #t.h = r.card;
+
+SELECT hits, misses, entries, bytes FROM hll_decode_cache_stats();
+
+-- A summary answers without fetching or caching the sketch.
+SELECT hll_set_output_version(2);
+
+UPDATE test_vbxnqeml SET h = hll_union(h, h);
+
+SET hll.decode_cache_size = '1MB';
+
+SELECT hll_decode_cache_reset();
+
+SELECT count(*)
+  FROM test_vbxnqeml t JOIN test_tjrwkzpa r USING (n)
+ WHERE #t.h = r.card;
+
+SELECT hits, misses, entries FROM hll_decode_cache_stats();
+
+SELECT hll_set_output_version(1);
+
+RESET hll.decode_cache_size;
+
+DROP TABLE test_tjrwkzpa;
+DROP TABLE test_vbxnqeml;
@@ -0,0 +1,114 @@
+-- ----------------------------------------------------------------
+-- Chains of adds and unions, which keep the multiset unpacked
+-- between calls, give the same hll as building it in one go.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+-- In an expression.
+SELECT hll_empty(11,5,-1,1) || hll_hash_integer(1)
+                            || hll_hash_integer(2)
+                            || hll_hash_integer(3);
+
+SELECT #(hll_empty(11,5,-1,1) || hll_hash_integer(1)
+                              || hll_hash_integer(2)
+                              || hll_hash_integer(3));
+
+SELECT hll_hash_integer(1) || (hll_hash_integer(2) || hll_empty(11,5,-1,1))
+     = hll_add_agg(hll_hash_integer(gs), 11, 5, -1, 1)
+  FROM generate_series(1, 2) AS gs;
+
+-- In PL/pgSQL variables.
+CREATE OR REPLACE FUNCTION testfunc_qbmvjxrd(n integer) RETURNS hll AS $$
+DECLARE
+    h hll := hll_empty(11,5,-1,1);
+BEGIN
+    FOR i IN 1 .. n LOOP
+        IF i % 2 = 0 THEN
+            h := hll_add(h, hll_hash_integer(i));
+        ELSE
+            h := hll_hash_integer(i) || h;
+        END IF;
+    END LOOP;
+    RETURN h;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION testfunc_fhwnbzqe(n integer) RETURNS hll AS $$
+DECLARE
+    h hll := hll_empty(11,5,-1,1);
+BEGIN
+    FOR i IN 1 .. n LOOP
+        h := h || hll_add(hll_empty(11,5,-1,1), hll_hash_integer(i));
+    END LOOP;
+    RETURN h;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT n, hll_type(testfunc_qbmvjxrd(n)) AS type,
+       testfunc_qbmvjxrd(n) = agg AS add_same,
+       testfunc_fhwnbzqe(n) = agg AS union_same
+  FROM (SELECT n, hll_add_agg(hll_hash_integer(gs), 11, 5, -1, 1) AS agg
+          FROM (VALUES (1), (100), (1000), (5000)) AS ns(n),
+               generate_series(1, n) AS gs
+         GROUP BY n) AS aggs
+ ORDER BY n;
+
+-- Adding to a copy leaves the original alone.
+CREATE OR REPLACE FUNCTION testfunc_cprlemsx(n integer) RETURNS boolean AS $$
+DECLARE
+    h hll := testfunc_qbmvjxrd(n);
+    g hll;
+BEGIN
+    g := h || hll_hash_integer(n + 1);
+    g := g || h;
+    RETURN h = testfunc_qbmvjxrd(n) AND g = testfunc_qbmvjxrd(n + 1);
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT testfunc_cprlemsx(10), testfunc_cprlemsx(1000);
+
+SELECT hll_union(h, h) = h AS self_union
+  FROM (SELECT testfunc_qbmvjxrd(1000) AS h) AS hs;
+
+-- Stored after each add.  Sparse sketches with chunks narrower than
+-- a byte can have a whole chunk of zeros in their padding.
+DROP TABLE IF EXISTS test_ycnqtsha;
+
+CREATE TABLE test_ycnqtsha (
+    log2m integer,
+    regwidth integer,
+    h hll
+);
+
+INSERT INTO test_ycnqtsha
+VALUES (4, 1, hll_empty(4,1,0,1)),
+       (4, 2, hll_empty(4,2,0,1)),
+       (5, 1, hll_empty(5,1,0,1));
+
+CREATE OR REPLACE FUNCTION testfunc_wkhzrnpc() RETURNS bigint AS $$
+DECLARE
+    nbad bigint := 0;
+BEGIN
+    FOR i IN 1 .. 40 LOOP
+        UPDATE test_ycnqtsha SET h = h || hll_hash_integer(i);
+        nbad := nbad + (
+            SELECT count(*)
+              FROM test_ycnqtsha
+             WHERE h <> (SELECT hll_add_agg(hll_hash_integer(gs),
+                                            log2m, regwidth, 0, 1)
+                           FROM generate_series(1, i) AS gs));
+    END LOOP;
+    RETURN nbad;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT testfunc_wkhzrnpc();
+
+DROP FUNCTION testfunc_wkhzrnpc();
+DROP FUNCTION testfunc_cprlemsx(integer);
+DROP FUNCTION testfunc_fhwnbzqe(integer);
+DROP FUNCTION testfunc_qbmvjxrd(integer);
+DROP TABLE test_ycnqtsha;
@@ -0,0 +1,62 @@
+-- ----------------------------------------------------------------
+-- Validation of text and binary input.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+-- ERROR:  multiset header too small
+SELECT E'\\x'::hll;
+
+-- ERROR:  multiset header too small
+SELECT E'\\x11'::hll;
+
+-- ERROR:  inconsistently sized empty multiset
+SELECT E'\\x118b7f00'::hll;
+
+-- ERROR:  unknown schema version 3
+SELECT E'\\x308b7f'::hll;
+
+SELECT E'\\x128b7f00000000000000010000000000000002'::hll;
+
+-- ERROR:  duplicate or descending explicit elements
+SELECT E'\\x128b7f00000000000000020000000000000001'::hll;
+
+-- ERROR:  inconsistently sized compressed multiset
+SELECT E'\\x148b7f00'::hll;
+
+SELECT E'\\x138b7f0001'::hll;
+
+-- ERROR:  inconsistent padding in sparse hll argument
+SELECT E'\\x138b7f000100'::hll;
+
+SELECT E'\\x2484803ff08598b59e3a060000000100000000000000000020'::hll;
+
+-- ERROR:  inconsistent summary in hll argument
+SELECT E'\\x248480bff00000000000000000000100000000000000000020'::hll;
+
+-- Binary COPY checks the values and the column's type modifiers.
+
+DROP TABLE IF EXISTS test_ehgvoxra;
+
+CREATE TABLE test_ehgvoxra (v1 hll);
+
+INSERT INTO test_ehgvoxra VALUES (hll_empty(11,5,-1,1));
+
+\COPY test_ehgvoxra TO 'validate.dat' WITH (FORMAT "binary")
+
+\COPY test_ehgvoxra FROM 'validate.dat' WITH (FORMAT "binary")
+
+SELECT count(*) FROM test_ehgvoxra;
+
+DROP TABLE IF EXISTS test_ywqnbfdu;
+
+CREATE TABLE test_ywqnbfdu (v1 hll(10,5,-1,1));
+
+-- ERROR:  register count does not match: source uses 2048 and dest uses 1024
+\COPY test_ywqnbfdu FROM 'validate.dat' WITH (FORMAT "binary")
+
+SELECT count(*) FROM test_ywqnbfdu;
+
+DROP TABLE test_ywqnbfdu;
+
+DROP TABLE test_ehgvoxra;
@@ -0,0 +1,61 @@
+-- ----------------------------------------------------------------
+-- Metadata functions and typmod casts of sketches stored out of
+-- line, which read just the leading bytes of the value.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+DROP TABLE IF EXISTS test_qfhdkzsy;
+
+CREATE TABLE test_qfhdkzsy (
+    vers integer,
+    h hll
+);
+
+ALTER TABLE test_qfhdkzsy ALTER COLUMN h SET STORAGE EXTERNAL;
+
+INSERT INTO test_qfhdkzsy
+SELECT 1, hll_add_agg(hll_hash_integer(gs), 14, 5, 0, 0)
+  FROM generate_series(1, 100000) AS gs;
+
+SELECT hll_set_output_version(2);
+
+INSERT INTO test_qfhdkzsy
+SELECT 2, hll_add_agg(hll_hash_integer(gs), 14, 5, 0, 0)
+  FROM generate_series(1, 100000) AS gs;
+
+SELECT hll_set_output_version(1);
+
+SELECT vers,
+       hll_schema_version(h),
+       hll_type(h),
+       hll_log2m(h),
+       hll_regwidth(h),
+       hll_expthresh(h),
+       hll_sparseon(h)
+  FROM test_qfhdkzsy
+ ORDER BY vers;
+
+SELECT vers, hll_cardinality(h::hll(14,5,0,0)) = hll_cardinality(h)
+  FROM test_qfhdkzsy
+ ORDER BY vers;
+
+-- ERROR:  register count does not match: source uses 16384 and dest uses 8192
+SELECT h::hll(13,5,0,0) FROM test_qfhdkzsy WHERE vers = 1;
+
+-- ERROR:  sparse enable does not match: source uses 0 and dest uses 1
+SELECT h::hll(14,5,0,1) FROM test_qfhdkzsy WHERE vers = 2;
+
+DROP TABLE IF EXISTS test_zmwpcknv;
+
+CREATE TABLE test_zmwpcknv (
+    h hll(14,5,0,0)
+);
+
+INSERT INTO test_zmwpcknv SELECT h FROM test_qfhdkzsy;
+
+SELECT count(*) FROM test_zmwpcknv t JOIN test_qfhdkzsy s ON t.h = s.h;
+
+DROP TABLE test_zmwpcknv;
+
+DROP TABLE test_qfhdkzsy;
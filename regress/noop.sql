@@ -0,0 +1,115 @@
+-- ----------------------------------------------------------------
+-- Adds and unions that change nothing, and the predicates that say
+-- so ahead of time.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+SELECT hll_add_would_change(hll_empty(), hll_hash_integer(1)) AS empty,
+       hll_add_would_change(h, hll_hash_integer(1)) AS present,
+       hll_add_would_change(h, hll_hash_integer(3)) AS absent
+  FROM (SELECT hll_empty() || hll_hash_integer(1)
+                           || hll_hash_integer(2) AS h) AS hs;
+
+SELECT hll_union_would_change(h, hll_empty()) AS with_empty,
+       hll_union_would_change(hll_empty(), h) AS into_empty,
+       hll_union_would_change(h, h) AS with_itself,
+       hll_union_would_change(h, hll_empty() || hll_hash_integer(3))
+           AS with_new
+  FROM (SELECT hll_empty() || hll_hash_integer(1)
+                           || hll_hash_integer(2) AS h) AS hs;
+
+-- Nothing changes an undefined hll, which a union spreads.
+SELECT hll_add_would_change(E'\\x108b7f'::hll, hll_hash_integer(1)),
+       hll_union_would_change(hll_empty(11,5,-1,1), E'\\x108b7f'::hll);
+
+SELECT hll_union_would_change(hll_empty(10,5), hll_empty(11,5));
+
+-- Explicit, sparse and compressed.
+DROP TABLE IF EXISTS test_mzqdfrwa;
+
+CREATE TABLE test_mzqdfrwa (
+    n integer,
+    h hll
+);
+
+INSERT INTO test_mzqdfrwa
+SELECT n, hll_add_agg(hll_hash_integer(gs), 11, 5, -1, 1)
+  FROM (VALUES (10), (200), (20000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+-- The hashes already in a sketch never change it.
+SELECT n, hll_type(h) AS type, agrees, old_change, new_change
+  FROM test_mzqdfrwa,
+       LATERAL (SELECT bool_and(hll_add_would_change(h, v) = (h || v <> h))
+                           AS agrees,
+                       bool_or(gs <= n AND hll_add_would_change(h, v))
+                           AS old_change,
+                       bool_or(hll_add_would_change(h, v)) AS new_change
+                  FROM generate_series(1, 2 * n) AS gs,
+                       LATERAL hll_hash_integer(gs) AS v) AS checks
+ ORDER BY n;
+
+-- Each sketch holds the hashes of the smaller ones.
+SELECT a.n AS a, b.n AS b,
+       hll_union_would_change(a.h, b.h) AS would_change,
+       hll_union(a.h, b.h) <> a.h AS changes
+  FROM test_mzqdfrwa a, test_mzqdfrwa b
+ ORDER BY a.n, b.n;
+
+-- An UPDATE can skip the rows an add would leave alone.
+UPDATE test_mzqdfrwa SET h = h || hll_hash_integer(5)
+ WHERE hll_add_would_change(h, hll_hash_integer(5));
+
+UPDATE test_mzqdfrwa SET h = h || hll_hash_integer(100)
+ WHERE hll_add_would_change(h, hll_hash_integer(100));
+
+-- A union that changes nothing still packs an hll of another schema
+-- version anew.
+SELECT hll_set_output_version(3);
+
+SELECT n, hll_schema_version(h) AS vers,
+       hll_schema_version(hll_union(h, h)) AS union_vers,
+       hll_schema_version(h || hll_hash_integer(1)) AS add_vers
+  FROM test_mzqdfrwa
+ ORDER BY n;
+
+SELECT hll_set_output_version(1);
+
+SELECT n, hll_union(h, h)::bytea = h::bytea AS same_bytes
+  FROM test_mzqdfrwa
+ ORDER BY n;
+
+DROP TABLE test_mzqdfrwa;
+
+-- With room in the decode cache for only one of the sketches, looking
+-- up the second mustn't lose the first.
+DROP TABLE IF EXISTS test_qpwlhnca;
+
+CREATE TABLE test_qpwlhnca (
+    n integer,
+    h hll
+);
+
+ALTER TABLE test_qpwlhnca ALTER COLUMN h SET STORAGE EXTERNAL;
+
+INSERT INTO test_qpwlhnca
+SELECT n, hll_add_agg(hll_hash_integer(gs), 14, 5, 0, 0)
+  FROM (VALUES (1000), (100000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+SET hll.decode_cache_size = 24;
+
+SELECT a.n AS a, b.n AS b,
+       hll_union_would_change(a.h, b.h) AS would_change,
+       hll_union(a.h, b.h) <> a.h AS changes
+  FROM test_qpwlhnca a, test_qpwlhnca b
+ ORDER BY a.n, b.n;
+
+RESET hll.decode_cache_size;
+
+DROP TABLE test_qpwlhnca;
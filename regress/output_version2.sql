@@ -0,0 +1,67 @@
+-- ----------------------------------------------------------------
+-- Schema version 2, which stores the cardinality of sparse and
+-- compressed sketches next to their registers.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+DROP TABLE IF EXISTS test_vtdnxqwe;
+
+CREATE TABLE test_vtdnxqwe (
+    n integer,
+    h hll
+);
+
+INSERT INTO test_vtdnxqwe
+SELECT n, hll_add_agg(hll_hash_integer(gs), 11, 5, -1, 1)
+  FROM (VALUES (1), (100), (300), (100000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+SELECT hll_set_output_version(2);
+
+-- Empty and explicit sketches carry no summary.
+SELECT hll_empty(4,5,0,0);
+
+SELECT hll_add(hll_empty(10,5,-1,1), hll_hash_integer(1));
+
+-- Sparse and compressed sketches do.
+SELECT hll_add_agg(hll_hash_integer(gs), 10, 5, 0, 1)
+  FROM generate_series(1, 3) AS gs;
+
+SELECT hll_add(hll_empty(4,5,0,0), hll_hash_integer(1));
+
+SELECT hll_schema_version(E'\\x238ac0400809048289860a000000034ec97f0b6010');
+
+SELECT round(hll_cardinality(E'\\x2484803ff08598b59e3a060000000100000000000000000020')::numeric, 6);
+
+-- Rewriting stored version 1 sketches leaves their cardinalities alone.
+SELECT n, hll_type(h) AS type,
+       hll_schema_version(hll_union(h, h)) AS vers,
+       length(hll_union(h, h)::bytea) - length(h::bytea) AS grown,
+       hll_cardinality(hll_union(h, h)) = hll_cardinality(h) AS same,
+       hll_cardinality(hll_union(h, h), 'ertl') = hll_cardinality(h, 'ertl') AS same_ertl
+  FROM test_vtdnxqwe
+ ORDER BY n;
+
+-- Both versions are read, and combine.
+SELECT hll_union(E'\\x138a404ec97f0b6010',
+                 E'\\x238ac0400809048289860a000000034ec97f0b6010')
+     = E'\\x238ac0400809048289860a000000034ec97f0b6010'::hll;
+
+-- A saturated sketch of narrow registers reads back what it wrote.
+SELECT h::text::hll = h AS same,
+       round(hll_cardinality(h)::numeric) AS card
+  FROM (SELECT hll_add_agg(hll_hash_integer(gs), 11, 3, -1, 1) AS h
+          FROM generate_series(1, 20000) AS gs) AS hs;
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_union(E'\\x138a404ec97f0b6010',
+                 E'\\x238ac0400809048289860a000000034ec97f0b6010');
+
+SELECT hll_set_output_version(6);
+
+DROP TABLE test_vtdnxqwe;
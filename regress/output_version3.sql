@@ -0,0 +1,86 @@
+-- ----------------------------------------------------------------
+-- Schema version 3, which delta codes explicit and sparse bodies
+-- when that is smaller.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+DROP TABLE IF EXISTS test_pjcwrmvz;
+
+CREATE TABLE test_pjcwrmvz (
+    n integer,
+    h hll
+);
+
+INSERT INTO test_pjcwrmvz
+SELECT n, hll_add_agg(hll_hash_integer(gs), 11, 5, -1, 1)
+  FROM (VALUES (1), (20), (100), (160), (500), (100000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+SELECT hll_set_output_version(3);
+
+-- Small bodies keep the version 1 coding.
+SELECT hll_add(hll_empty(10,5,-1,1), hll_hash_integer(1));
+
+SELECT hll_add_agg(hll_hash_integer(gs), 10, 5, 0, 1)
+  FROM generate_series(1, 3) AS gs;
+
+-- Larger ones are delta coded.
+SELECT hll_add_agg(hll_hash_integer(gs), 10, 5, 0, 1)
+  FROM generate_series(1, 11) AS gs;
+
+SELECT hll_schema_version(E'\\x338ac00b08173ae8833b1ce56172100b08c82094422042');
+
+SELECT hll_cardinality(E'\\x338ac00b08173ae8833b1ce56172100b08c82094422042')
+     = hll_cardinality(hll_add_agg(hll_hash_integer(gs), 10, 5, 0, 1))
+  FROM generate_series(1, 11) AS gs;
+
+DROP TABLE IF EXISTS test_gzkwhvqa;
+
+CREATE TABLE test_gzkwhvqa AS
+SELECT n, hll_union(h, h) AS h
+  FROM test_pjcwrmvz;
+
+-- Never larger than version 1, and the same sketch.
+SELECT v1.n, hll_type(v3.h) AS type,
+       hll_schema_version(v3.h) AS vers,
+       length(v1.h::bytea) AS v1_length,
+       length(v3.h::bytea) AS v3_length,
+       hll_cardinality(v3.h) = hll_cardinality(v1.h) AS same
+  FROM test_pjcwrmvz v1
+  JOIN test_gzkwhvqa v3 USING (n)
+ ORDER BY n;
+
+-- Unions of both versions.
+SELECT v1.n, hll_union(v1.h, v3.h) = v3.h AS union_same
+  FROM test_pjcwrmvz v1
+  JOIN test_gzkwhvqa v3 USING (n)
+ ORDER BY n;
+
+SELECT hll_cardinality(hll_union_agg(h)) = (SELECT hll_cardinality(hll_union_agg(h)) FROM test_pjcwrmvz)
+  FROM test_gzkwhvqa;
+
+-- Writing them back out as version 1 gives the original bytes.
+SELECT hll_set_output_version(1);
+
+SELECT v1.n, hll_union(v3.h, v3.h)::bytea = v1.h::bytea AS same_bytes
+  FROM test_pjcwrmvz v1
+  JOIN test_gzkwhvqa v3 USING (n)
+ ORDER BY n;
+
+SELECT hll_union(E'\\x338ac00b08173ae8833b1ce56172100b08c82094422042',
+                 E'\\x338ac00b08173ae8833b1ce56172100b08c82094422042');
+
+-- Malformed delta coded bodies.
+SELECT E'\\x338ac00b08173ae8833b1ce56172100b08c820944220'::hll;
+SELECT E'\\x338ac00b08173ae8833b1ce56172100b08c8209442204200'::hll;
+SELECT E'\\x338ac0ff'::hll;
+SELECT E'\\x328aff'::hll;
+SELECT E'\\x328aff01'::hll;
+SELECT E'\\x328aff0221000000000000000000000000'::hll;
+
+DROP TABLE test_gzkwhvqa;
+DROP TABLE test_pjcwrmvz;
@@ -0,0 +1,87 @@
+-- ----------------------------------------------------------------
+-- Schema version 4, which entropy codes the registers of compressed
+-- bodies when that is smaller.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+DROP TABLE IF EXISTS test_rqkzxnbe;
+
+CREATE TABLE test_rqkzxnbe (
+    n integer,
+    h hll
+);
+
+INSERT INTO test_rqkzxnbe
+SELECT n, hll_add_agg(hll_hash_integer(gs), 11, 5, 0, 0)
+  FROM (VALUES (1), (100), (1000), (10000), (100000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+SELECT hll_set_output_version(4);
+
+-- Registers that do not code smaller keep the version 1 coding.
+SELECT hll_add_agg(hll_hash_integer(gs), 4, 5, 0, 0)
+  FROM generate_series(1, 50) AS gs;
+
+-- Others are entropy coded.
+SELECT hll_add_agg(hll_hash_integer(gs), 4, 5, 0, 0)
+  FROM generate_series(1, 10) AS gs;
+
+SELECT hll_schema_version(E'\\x44848002080602d5888a');
+
+SELECT hll_cardinality(E'\\x44848002080602d5888a')
+     = hll_cardinality(hll_add_agg(hll_hash_integer(gs), 4, 5, 0, 0))
+  FROM generate_series(1, 10) AS gs;
+
+-- A single register value codes in no bits.
+SELECT hll_cardinality(E'\\x4484800010');
+
+DROP TABLE IF EXISTS test_mwcjtyoa;
+
+CREATE TABLE test_mwcjtyoa AS
+SELECT n, hll_union(h, h) AS h
+  FROM test_rqkzxnbe;
+
+-- Never larger than version 1, and the same sketch.
+SELECT v1.n, hll_type(v4.h) AS type,
+       hll_schema_version(v4.h) AS vers,
+       length(v1.h::bytea) AS v1_length,
+       length(v4.h::bytea) AS v4_length,
+       hll_cardinality(v4.h) = hll_cardinality(v1.h) AS same
+  FROM test_rqkzxnbe v1
+  JOIN test_mwcjtyoa v4 USING (n)
+ ORDER BY n;
+
+-- Unions of both versions.
+SELECT v1.n, hll_union(v1.h, v4.h) = v4.h AS union_same
+  FROM test_rqkzxnbe v1
+  JOIN test_mwcjtyoa v4 USING (n)
+ ORDER BY n;
+
+SELECT hll_cardinality(hll_union_agg(h)) = (SELECT hll_cardinality(hll_union_agg(h)) FROM test_rqkzxnbe)
+  FROM test_mwcjtyoa;
+
+-- Writing them back out as version 1 gives the original bytes.
+SELECT hll_set_output_version(1);
+
+SELECT v1.n, hll_union(v4.h, v4.h)::bytea = v1.h::bytea AS same_bytes
+  FROM test_rqkzxnbe v1
+  JOIN test_mwcjtyoa v4 USING (n)
+ ORDER BY n;
+
+SELECT hll_union(E'\\x44848002080602d5888a',
+                 E'\\x44848002080602d5888a');
+
+-- Malformed entropy coded bodies.
+SELECT E'\\x44848002080602d588'::hll;
+SELECT E'\\x44848002080602d5888a00'::hll;
+SELECT E'\\x44848002090602d5888a'::hll;
+SELECT E'\\x44848002080602d5888b'::hll;
+SELECT E'\\x448480ff'::hll;
+SELECT E'\\x448480'::hll;
+
+DROP TABLE test_mwcjtyoa;
+DROP TABLE test_rqkzxnbe;
@@ -0,0 +1,80 @@
+-- ----------------------------------------------------------------
+-- Schema version 5, which packs the registers of compressed bodies
+-- one to a byte.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+DROP TABLE IF EXISTS test_hvbdlqxo;
+
+CREATE TABLE test_hvbdlqxo (
+    n integer,
+    h hll
+);
+
+INSERT INTO test_hvbdlqxo
+SELECT n, hll_add_agg(hll_hash_integer(gs), 11, 5, 0, 0)
+  FROM (VALUES (1), (100), (1000), (100000)) AS ns(n),
+       generate_series(1, n) AS gs
+ GROUP BY n;
+
+SELECT hll_set_output_version(5);
+
+-- Explicit and sparse bodies keep the version 1 coding.
+SELECT hll_add(hll_empty(10,5,-1,1), hll_hash_integer(1));
+
+-- Compressed ones take a byte per register.
+SELECT hll_add_agg(hll_hash_integer(gs), 4, 5, 0, 0)
+  FROM generate_series(1, 10) AS gs;
+
+SELECT hll_schema_version(E'\\x54840002000101020000000100000100000101');
+
+SELECT hll_cardinality(E'\\x54840002000101020000000100000100000101')
+     = hll_cardinality(hll_add_agg(hll_hash_integer(gs), 4, 5, 0, 0))
+  FROM generate_series(1, 10) AS gs;
+
+DROP TABLE IF EXISTS test_zqmfrkwa;
+
+CREATE TABLE test_zqmfrkwa AS
+SELECT n, hll_union(h, h) AS h
+  FROM test_hvbdlqxo;
+
+SELECT v1.n, hll_type(v5.h) AS type,
+       hll_schema_version(v5.h) AS vers,
+       length(v1.h::bytea) AS v1_length,
+       length(v5.h::bytea) AS v5_length,
+       hll_cardinality(v5.h) = hll_cardinality(v1.h) AS same
+  FROM test_hvbdlqxo v1
+  JOIN test_zqmfrkwa v5 USING (n)
+ ORDER BY n;
+
+-- Unions of both versions.
+SELECT v1.n, hll_union(v1.h, v5.h) = v5.h AS union_same
+  FROM test_hvbdlqxo v1
+  JOIN test_zqmfrkwa v5 USING (n)
+ ORDER BY n;
+
+SELECT hll_cardinality(hll_union_agg(h)) = (SELECT hll_cardinality(hll_union_agg(h)) FROM test_hvbdlqxo)
+  FROM test_zqmfrkwa;
+
+-- Writing them back out as version 1 gives the original bytes.
+SELECT hll_set_output_version(1);
+
+SELECT v1.n, hll_union(v5.h, v5.h)::bytea = v1.h::bytea AS same_bytes
+  FROM test_hvbdlqxo v1
+  JOIN test_zqmfrkwa v5 USING (n)
+ ORDER BY n;
+
+SELECT hll_union(E'\\x54840002000101020000000100000100000101',
+                 E'\\x54840002000101020000000100000100000101');
+
+-- Malformed byte wide bodies.
+SELECT E'\\x548400020001010200000001000001000001'::hll;
+SELECT E'\\x5484000200010102000000010000010000010100'::hll;
+SELECT E'\\x54840002000101020000000100000100002001'::hll;
+SELECT E'\\x548400020001010200000001000001000001ff'::hll;
+
+DROP TABLE test_zqmfrkwa;
+DROP TABLE test_hvbdlqxo;
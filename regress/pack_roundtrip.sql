@@ -0,0 +1,22 @@
+-- ----------------------------------------------------------------
+-- The packed bytes of every register width, sparse and compressed,
+-- must stay the same as the reference packer's, and must come back
+-- unchanged from an unpack and repack.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+-- Fewer than eight registers, whole groups of eight, and both
+-- sparse and compressed outputs.
+SELECT log2m, regwidth, n, hll_type(v), md5(v::text),
+       v = hll_union(v, hll_empty(log2m, regwidth, 0, 1)) AS roundtrip
+  FROM (SELECT log2m, regwidth, n,
+               hll_add_agg(hll_hash_integer(gs), log2m, regwidth, 0, 1) AS v
+          FROM (VALUES (0), (2), (4), (11), (14)) AS ls(log2m),
+               generate_series(1, 7) AS rw(regwidth),
+               (VALUES (10), (3000)) AS ns(n),
+               generate_series(1, n) AS gs
+         GROUP BY log2m, regwidth, n) AS tt
+ ORDER BY log2m, regwidth, n;
@@ -0,0 +1,115 @@
+-- ----------------------------------------------------------------
+-- Parallel aggregation must agree with serial aggregation.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+SELECT hll_set_defaults(11,5,-1,1);
+
+DROP TABLE IF EXISTS test_pqagvyth;
+
+CREATE TABLE test_pqagvyth (
+    recno    integer,
+    grp      integer,
+    v1       hll
+);
+
+INSERT INTO test_pqagvyth (recno, grp, v1)
+SELECT gs, gs % 4, hll_add(hll_empty(), hll_hash_integer(gs))
+  FROM generate_series(1, 20000) AS gs;
+
+-- Force a parallel plan regardless of table size.
+ALTER TABLE test_pqagvyth SET (parallel_workers = 2);
+
+ANALYZE test_pqagvyth;
+
+-- Serial results.
+
+SET max_parallel_workers_per_gather = 0;
+
+DROP TABLE IF EXISTS test_tvbmrkwe;
+
+CREATE TABLE test_tvbmrkwe AS
+SELECT 1 AS caseno, hll_add_agg(hll_hash_integer(recno)) AS v1
+  FROM test_pqagvyth
+UNION ALL
+SELECT 2, hll_add_agg(hll_hash_integer(recno), 12)
+  FROM test_pqagvyth
+UNION ALL
+SELECT 3, hll_add_agg(hll_hash_integer(recno), 12, 4)
+  FROM test_pqagvyth
+UNION ALL
+SELECT 4, hll_add_agg(hll_hash_integer(recno), 12, 4, 256)
+  FROM test_pqagvyth
+UNION ALL
+SELECT 5, hll_add_agg(hll_hash_integer(recno), 12, 4, 256, 0)
+  FROM test_pqagvyth
+UNION ALL
+SELECT 6, hll_add_agg(hll_hash_integer(recno), 12, 4, 256)
+  FROM test_pqagvyth WHERE recno <= 100
+UNION ALL
+SELECT 7, hll_union_agg(v1)
+  FROM test_pqagvyth
+UNION ALL
+SELECT 8, hll_union_agg(v1)
+  FROM test_pqagvyth WHERE recno <= 100
+UNION ALL
+SELECT 9, hll_union_agg(v1)
+  FROM test_pqagvyth WHERE recno < 0
+UNION ALL
+SELECT 10 + grp, hll_union_agg(v1)
+  FROM test_pqagvyth GROUP BY grp;
+
+-- Parallel results.
+
+SET parallel_setup_cost = 0;
+
+SET parallel_tuple_cost = 0;
+
+SET max_parallel_workers_per_gather = 2;
+
+SELECT hll_add_agg(hll_hash_integer(recno))
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 1)
+  FROM test_pqagvyth;
+
+SELECT hll_add_agg(hll_hash_integer(recno), 12)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 2)
+  FROM test_pqagvyth;
+
+SELECT hll_add_agg(hll_hash_integer(recno), 12, 4)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 3)
+  FROM test_pqagvyth;
+
+SELECT hll_add_agg(hll_hash_integer(recno), 12, 4, 256)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 4)
+  FROM test_pqagvyth;
+
+SELECT hll_add_agg(hll_hash_integer(recno), 12, 4, 256, 0)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 5)
+  FROM test_pqagvyth;
+
+SELECT hll_add_agg(hll_hash_integer(recno), 12, 4, 256)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 6)
+  FROM test_pqagvyth WHERE recno <= 100;
+
+SELECT hll_union_agg(v1)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 7)
+  FROM test_pqagvyth;
+
+SELECT hll_union_agg(v1)
+       = (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 8)
+  FROM test_pqagvyth WHERE recno <= 100;
+
+SELECT hll_union_agg(v1) IS NULL
+       AND (SELECT v1 FROM test_tvbmrkwe WHERE caseno = 9) IS NULL
+  FROM test_pqagvyth WHERE recno < 0;
+
+SELECT grp, hll_union_agg(v1) = (SELECT v1 FROM test_tvbmrkwe
+                                  WHERE caseno = 10 + grp)
+  FROM test_pqagvyth GROUP BY grp ORDER BY grp;
+
+DROP TABLE test_tvbmrkwe;
+
+DROP TABLE test_pqagvyth;
@@ -0,0 +1,51 @@
+-- ----------------------------------------------------------------
+-- Cardinalities of aggregation states finalized on every row, which
+-- come from the register histogram kept up to date in the state,
+-- must match those of the packed running totals.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+DROP AGGREGATE IF EXISTS hll_card_agg_cwqkbmzt (hll_hashval, integer, integer, bigint, integer);
+CREATE AGGREGATE hll_card_agg_cwqkbmzt (hll_hashval, integer, integer, bigint, integer) (
+       SFUNC = hll_add_trans4,
+       STYPE = internal,
+       FINALFUNC = hll_card_unpacked
+);
+
+DROP AGGREGATE IF EXISTS hll_union_card_agg_cwqkbmzt (hll);
+CREATE AGGREGATE hll_union_card_agg_cwqkbmzt (hll) (
+       SFUNC = hll_union_trans,
+       STYPE = internal,
+       FINALFUNC = hll_card_unpacked
+);
+
+-- Running adds through the explicit, sparse and compressed states.
+SELECT count(*) AS nrows,
+       count(*) FILTER (WHERE unpacked <> packed) AS nmismatched
+  FROM (SELECT hll_card_agg_cwqkbmzt(hll_hash_integer(gs), 10, 5, -1, 1)
+                   OVER w AS unpacked,
+               hll_cardinality(hll_add_agg(hll_hash_integer(gs), 10, 5, -1, 1)
+                   OVER w) AS packed
+          FROM generate_series(1, 5000) AS gs
+        WINDOW w AS (ORDER BY gs)) AS tt;
+
+-- Running unions of sparse and compressed sketches, then adds.
+SELECT count(*) AS nrows,
+       count(*) FILTER (WHERE unpacked <> packed) AS nmismatched
+  FROM (SELECT hll_union_card_agg_cwqkbmzt(h) OVER w AS unpacked,
+               hll_cardinality(hll_union_agg(h) OVER w) AS packed
+          FROM (SELECT gs % 100 AS gg,
+                       hll_add_agg(hll_hash_integer(gs), 10, 5, -1, 1) AS h
+                  FROM generate_series(1, 20000) AS gs
+                 GROUP BY gs % 100
+                 UNION ALL
+                SELECT 100 + gs, hll_add(hll_empty(10, 5, -1, 1),
+                                         hll_hash_integer(-gs))
+                  FROM generate_series(1, 50) AS gs) AS hh
+        WINDOW w AS (ORDER BY gg)) AS tt;
+
+DROP AGGREGATE hll_union_card_agg_cwqkbmzt (hll);
+DROP AGGREGATE hll_card_agg_cwqkbmzt (hll_hashval, integer, integer, bigint, integer);
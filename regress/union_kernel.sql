@@ -0,0 +1,46 @@
+-- ----------------------------------------------------------------
+-- The SIMD register max kernels must agree with the scalar one.
+-- ----------------------------------------------------------------
+
+SELECT hll_set_output_version(1);
+
+SELECT hll_set_max_sparse(-1);
+
+DROP TABLE IF EXISTS test_wjnqerzs;
+
+CREATE TABLE test_wjnqerzs (
+    grp      integer,
+    v4       hll,
+    v11      hll
+);
+
+INSERT INTO test_wjnqerzs (grp, v4, v11)
+SELECT gs % 100,
+       hll_add_agg(hll_hash_integer(gs), 4, 5, 0, 0),
+       hll_add_agg(hll_hash_integer(gs), 11, 5, 0, 0)
+  FROM generate_series(1, 100000) AS gs
+ GROUP BY gs % 100;
+
+SET hll.union_kernel = scalar;
+
+DROP TABLE IF EXISTS test_ycmbkdvo;
+
+CREATE TABLE test_ycmbkdvo AS
+SELECT hll_union_agg(v4) AS v4, hll_union_agg(v11) AS v11
+  FROM test_wjnqerzs;
+
+SET hll.union_kernel = auto;
+
+SELECT hll_union_agg(v4) = (SELECT v4 FROM test_ycmbkdvo),
+       hll_union_agg(v11) = (SELECT v11 FROM test_ycmbkdvo)
+  FROM test_wjnqerzs;
+
+SELECT hll_union(a.v11, b.v11) = hll_union(b.v11, a.v11)
+  FROM test_wjnqerzs a, test_wjnqerzs b
+ WHERE a.grp = 1 AND b.grp = 2;
+
+RESET hll.union_kernel;
+
+DROP TABLE test_ycmbkdvo;
+
+DROP TABLE test_wjnqerzs;